@@ -10,10 +10,15 @@ namespace co {
 
 class __coapi Closure {
   public:
-    Closure() = default;
+    Closure() : next(0), stack_size(0) {}
     virtual ~Closure() = default;
     
     virtual void run() = 0;
+
+    // used by the scheduler to queue the closure as a new task, without
+    // allocating a node for it
+    Closure* next;
+    uint32 stack_size; // size of the dedicated stack, 0 for a shared stack
 };
 
 namespace xx {
@@ -9,10 +9,14 @@
 #include "./co/sock.h"
 #include "./co/event.h"
 #include "./co/mutex.h"
+#include "./co/semaphore.h"
 #include "./co/pool.h"
 #include "./co/chan.h"
 #include "./co/io_event.h"
 #include "./co/wait_group.h"
+#include "./co/local.h"
+#include "./co/task_group.h"
+#include "./co/future.h"
 
 namespace co {
 
@@ -86,6 +90,64 @@ inline void go(F&& f, T* t, P&& p) {
     go(new_closure(std::forward<F>(f), t, std::forward<P>(p)));
 }
 
+/**
+ * add a task, which will run as a coroutine on a dedicated stack
+ *   - The stack is mmaped with a guard page, and it is taken from a pool of
+ *     stacks in the scheduler. Unlike coroutines on the shared stacks, no stack
+ *     data will be copied when the coroutine is suspended or resumed.
+ *   - eg.
+ *     go_stack(64 * 1024, f);             // void f();
+ *     go_stack(64 * 1024, []() { ... });  // lambda
+ *
+ * @param stack_size  size of the stack in bytes, 0 for the value of co_stack_size.
+ * @param cb          a pointer to a Closure created by new_closure(), or an user-defined Closure.
+ */
+__coapi void go_stack(uint32 stack_size, Closure* cb);
+
+template<typename F>
+inline void go_stack(uint32 stack_size, F&& f) {
+    go_stack(stack_size, new_closure(std::forward<F>(f)));
+}
+
+/**
+ * add a batch of tasks, which will run as coroutines 
+ *   - The tasks are distributed across the schedulers in one pass, and each 
+ *     scheduler gets its share with a single enqueue and at most one wakeup. 
+ *     It is much cheaper than calling go() for each task. 
+ *   - eg. 
+ *     co::vector<co::Closure*> v(1024); 
+ *     for (int i = 0; i < 1024; ++i) v.push_back(co::new_closure(f)); 
+ *     go_batch(v); 
+ *
+ * @param cbs  an array of pointers to Closures.
+ * @param n    number of Closures in the array.
+ */
+__coapi void go_batch(Closure* const* cbs, size_t n);
+
+inline void go_batch(const co::vector<Closure*>& cbs) {
+    go_batch(cbs.data(), cbs.size());
+}
+
+/**
+ * add a task, which will run as a coroutine in the high priority lane 
+ *   - New and ready coroutines in the high priority lane are resumed before 
+ *     those in the normal lane of the same scheduler, and the coroutine stays 
+ *     in the high priority lane until it ends. 
+ *   - At most co_prio_quota high priority coroutines are resumed in a row, 
+ *     then a coroutine in the normal lane will run, so it will not starve. 
+ *   - eg. 
+ *     go_prio(f);               // void f(); 
+ *     go_prio([]() { ... });    // lambda 
+ *
+ * @param cb  a pointer to a Closure created by new_closure(), or an user-defined Closure.
+ */
+__coapi void go_prio(Closure* cb);
+
+template<typename F>
+inline void go_prio(F&& f) {
+    go_prio(new_closure(std::forward<F>(f)));
+}
+
 // define main function
 //   - make code in main function also runs in coroutine
 #define DEF_main(argc, argv) \
@@ -138,6 +200,28 @@ class __coapi MainSched {
 // get all the schedulers
 __coapi const co::vector<Sched*>& scheds();
 
+// runtime statistics of a scheduler
+struct sched_stat {
+    int id;             // id of the scheduler
+    uint64 coroutines;  // number of coroutines alive
+    uint64 switches;    // number of context switches (coroutines resumed)
+    uint64 stack_bytes; // bytes of stack data copied when coroutines were suspended
+    uint64 ready;       // number of tasks taken from the ready queues in the last round
+    uint64 timers;      // number of pending timers
+    uint64 wait_us;     // time (us) waiting for events in epoll
+    uint64 run_us;      // time (us) running tasks
+    uint64 io_events;   // number of I/O events handled
+    uint64 overruns;    // number of coroutines running longer than co_watchdog_ms
+    uint64 buf_hits;    // stack save buffers taken from the cache
+    uint64 buf_misses;  // stack save buffers allocated
+};
+
+// get runtime statistics of all the schedulers
+//   - Counters are updated by each scheduler thread with relaxed atomic
+//     operations, the result may be a little behind the schedulers.
+//   - Set co_stats_log_ms to write statistics to the log periodically.
+__coapi co::vector<sched_stat> sched_stats();
+
 // get number of the schedulers
 __coapi int sched_num();
 
@@ -202,6 +286,14 @@ __coapi void del_io_event(sock_t fd);
 //     or the timer expires, the scheduler will resume the coroutine. 
 __coapi void yield();
 
+// yield the current coroutine if its time slice (co_time_slice_ms) is used up
+//   - The coroutine will be resumed later, after other ready coroutines. 
+//   - It is cheap enough to be called in CPU-heavy loops, as the time slice is 
+//     checked by a watchdog thread in background, which is started on the 
+//     first call of this function. 
+//   - It does nothing if called from non-coroutine. 
+__coapi void maybe_yield();
+
 // resume the coroutine
 //   - It is thread safe and can be called anywhere.
 //   - @co: a pointer to the coroutine (result of co::coroutine())
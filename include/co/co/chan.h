@@ -2,10 +2,40 @@
 
 #include "../def.h"
 #include <functional>
+#include <initializer_list>
 
 namespace co {
+
+struct select_case;
+
+// Wait for the first case of @n cases that can be done, and do it. It must be
+// called in coroutine. Return the index of the case done, or -1 if it timed out
+// or the task group of the coroutine was cancelled. A read case on a closed
+// channel can be done, chan::done() returns false then.
+__coapi int select(const select_case* cases, size_t n, uint32 ms=(uint32)-1);
+
 namespace xx {
 
+class pipe_impl;
+
+// copy or move (@o == 1) construct a T at @dst from @src
+template<typename T>
+void chan_construct(void* dst, void* src, int o) {
+    switch (o) {
+      case 0:
+        new (dst) T(*static_cast<const T*>(src));
+        break;
+      case 1:
+        new (dst) T(std::move(*static_cast<T*>(src)));
+        break;
+    }
+}
+
+template<typename T>
+void chan_destruct(void* p) {
+    static_cast<T*>(p)->~T();
+}
+
 class __coapi pipe {
   public:
     typedef std::function<void(void*, void*, int)> C;
@@ -24,40 +54,63 @@ class __coapi pipe {
 
     void read(void* p) const;
     void write(void* p, int o) const;
+    size_t read_n(void* p, size_t n) const;
+    size_t write_n(void* p, size_t n, int o) const;
     void close() const;
     bool is_closed() const;
     bool done() const;
   
+  private:
+    friend class pipe_impl;
+    void* _p;
+};
+
+// A lock-free ring buffer for one writer and one reader.
+class __coapi spsc_pipe {
+  public:
+    spsc_pipe(uint32 cap, uint32 blk_size, uint32 ms, pipe::C&& c, pipe::D&& d);
+    ~spsc_pipe();
+
+    spsc_pipe(spsc_pipe&& p) noexcept : _p(p._p) {
+        p._p = 0;
+    }
+
+    spsc_pipe(const spsc_pipe& p);
+
+    void operator=(const spsc_pipe&) = delete;
+
+    void read(void* p) const;
+    void write(void* p, int o) const;
+    void close() const;
+    bool is_closed() const;
+    bool done() const;
+
   private:
     void* _p;
 };
 
 } // xx
 
+// a case of co::select(), created by co::read_case() or co::write_case()
+struct select_case {
+    const xx::pipe* c;
+    void* p;   // the element to read to or write from
+    uint8 op;  // 0: read, 1: write (copy), 2: write (move)
+};
+
 // Implement of channel in golang, it was improved a lot since v3.0.1:
 //   - `T` can be non-POD types (std::string, e.g.).
 //   - It can be used in coroutines and/or non-coroutines.
 //   - Channel can be closed (write disabled, read ok if not empty).
+//   - While a channel is used by coroutines in one scheduler only, it works
+//     without locking. It switches to a mutex once another thread uses it.
 template<typename T>
 class chan {
   public:
     // @cap  max capacity of the queue, 1 by default.
     // @ms   timeout in milliseconds, -1 by default.
     explicit chan(uint32 cap=1, uint32 ms=(uint32)-1)
-        : _p(cap * sizeof(T), sizeof(T), ms,
-          [](void* dst, void* src, int o) {
-              switch (o) {
-                case 0:
-                  new (dst) T(*static_cast<const T*>(src));
-                  break;
-                case 1:
-                  new (dst) T(std::move(*static_cast<T*>(src)));
-                  break;
-              }
-          },
-          [](void* p){
-              static_cast<T*>(p)->~T();
-          }) {
+        : _p(cap * sizeof(T), sizeof(T), ms, &xx::chan_construct<T>, &xx::chan_destruct<T>) {
     }
 
     ~chan() = default;
@@ -84,6 +137,27 @@ class chan {
         return (chan&)*this;
     }
 
+    // Read up to @n elements to @x, those in the buffer with a single lock. It
+    // waits only if the channel is empty, and then takes the elements buffered
+    // after the first one with another lock. Return number of elements read, 0
+    // on timeout or if the channel is closed and empty.
+    size_t read_n(T* x, size_t n) const {
+        return _p.read_n((void*)x, n);
+    }
+
+    // Write @n elements in @x to the channel (copy constructor will be used).
+    // Elements are moved to the buffer or waiting readers in batches, with one
+    // lock for each batch. It waits only if the buffer is full. Return number
+    // of elements written, less than @n on timeout or if the channel is closed.
+    size_t write_n(const T* x, size_t n) const {
+        return _p.write_n((void*)x, n, 0);
+    }
+
+    // like write_n(), but move constructor will be used
+    size_t move_n(T* x, size_t n) const {
+        return _p.write_n((void*)x, n, 1);
+    }
+
     // return true if the read or write operation was done successfully
     bool done() const { return _p.done(); }
 
@@ -95,10 +169,98 @@ class chan {
     explicit operator bool() const { return !_p.is_closed(); }
 
   private:
+    template<typename X> friend select_case read_case(const chan<X>&, X&);
+    template<typename X> friend select_case write_case(const chan<X>&, const X&);
+    template<typename X> friend select_case write_case(const chan<X>&, X&&);
     xx::pipe _p;
 };
 
 template<typename T>
 using Chan = chan<T>;
 
+// A channel for exactly one writer and one reader at a time, which may run in
+// different threads. It is a lock-free ring buffer, the writer and reader wait
+// only when it is full or empty. The capacity is rounded up to a power of 2.
+// It is not supported by co::select().
+//
+// Example:
+//   co::spsc_chan<int> ch(1024);
+//   go([ch]() { for (int i = 0; i < 100; ++i) ch << i; ch.close(); });
+//   go([ch]() { int v; while (ch >> v, ch.done()) use(v); });
+template<typename T>
+class spsc_chan {
+  public:
+    // @cap  max capacity of the queue, 64 by default.
+    // @ms   timeout in milliseconds, -1 by default.
+    explicit spsc_chan(uint32 cap=64, uint32 ms=(uint32)-1)
+        : _p(cap, sizeof(T), ms, &xx::chan_construct<T>, &xx::chan_destruct<T>) {
+    }
+
+    ~spsc_chan() = default;
+
+    spsc_chan(spsc_chan&& c) : _p(std::move(c._p)) {}
+    spsc_chan(const spsc_chan& c) : _p(c._p) {}
+    void operator=(const spsc_chan&) = delete;
+
+    // read an element from the channel to @x
+    spsc_chan& operator>>(T& x) const {
+        _p.read((void*)&x);
+        return (spsc_chan&)*this;
+    }
+
+    // write an element to the channel (copy constructor will be used)
+    spsc_chan& operator<<(const T& x) const {
+        _p.write((void*)&x, 0);
+        return (spsc_chan&)*this;
+    }
+
+    // write an element to the channel (move constructor will be used)
+    spsc_chan& operator<<(T&& x) const {
+        _p.write((void*)&x, 1);
+        return (spsc_chan&)*this;
+    }
+
+    // return true if the read or write operation was done successfully
+    bool done() const { return _p.done(); }
+
+    // close the channel, elements not read yet can still be read
+    void close() const { _p.close(); }
+
+    // check if the channel was closed (false for closed)
+    explicit operator bool() const { return !_p.is_closed(); }
+
+  private:
+    xx::spsc_pipe _p;
+};
+
+// read an element from the channel @c to @x
+template<typename T>
+inline select_case read_case(const chan<T>& c, T& x) {
+    return select_case{ &c._p, (void*)&x, 0 };
+}
+
+// write @x to the channel @c (copy constructor will be used)
+template<typename T>
+inline select_case write_case(const chan<T>& c, const T& x) {
+    return select_case{ &c._p, (void*)&x, 1 };
+}
+
+// write @x to the channel @c (move constructor will be used)
+template<typename T>
+inline select_case write_case(const chan<T>& c, T&& x) {
+    return select_case{ &c._p, (void*)&x, 2 };
+}
+
+// Example:
+//   co::chan<int> a, b;
+//   int x;
+//   switch (co::select({ co::read_case(a, x), co::write_case(b, 7) }, 100)) {
+//     case 0: /* read x from a */ break;
+//     case 1: /* wrote 7 to b */ break;
+//     default: /* timeout */ break;
+//   }
+inline int select(std::initializer_list<select_case> cases, uint32 ms=(uint32)-1) {
+    return co::select(cases.begin(), cases.size(), ms);
+}
+
 } // co
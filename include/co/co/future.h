@@ -0,0 +1,208 @@
+#pragma once
+
+#include "../def.h"
+#include "../vector.h"
+#include <assert.h>
+#include <new>
+#include <utility>
+
+namespace co {
+namespace xx {
+
+class future_base;
+
+// Create the state of a future which becomes ready when all (or any, if @any
+// is true) of the @n futures added by join_add() are ready.
+__coapi void* join_make(size_t n, bool any);
+
+// add the @i-th future to the join state @j
+__coapi void join_add(void* j, size_t i, const future_base& f);
+
+// Reference to the state shared by futures and promises. The state and the
+// value following it are allocated with co::alloc in one block.
+class __coapi future_base {
+  public:
+    future_base() noexcept : _p(0) {}
+
+    // take over a reference of the shared state @p
+    explicit future_base(void* p) noexcept : _p(p) {}
+
+    ~future_base();
+
+    future_base(future_base&& f) noexcept : _p(f._p) {
+        f._p = 0;
+    }
+
+    // copy constructor, just increment the reference count
+    future_base(const future_base& f);
+
+    void operator=(const future_base&) = delete;
+
+    // check whether the future refers to a shared state
+    bool valid() const noexcept { return _p != 0; }
+
+    // check whether the value was set, or all the promises were destroyed
+    // without setting the value (the promise is broken)
+    bool ready() const;
+
+    // check whether the value was set
+    bool has_value() const;
+
+    // Wait until the future is ready. It parks the coroutine if called in a
+    // coroutine, otherwise it blocks the thread.
+    void wait() const;
+
+    // Wait until the future is ready or timed out, or the task group of the
+    // coroutine is cancelled. Return true if the future is ready.
+    bool wait(uint32 ms) const;
+
+  protected:
+    friend void join_add(void*, size_t, const future_base&);
+    void* data() const;
+    void* _p;
+};
+
+class __coapi promise_base {
+  public:
+    // @n: size of the value, @dtor: to destroy the value, may be NULL
+    promise_base(size_t n, void (*dtor)(void*));
+
+    // The promise is broken if the last promise is destroyed without setting
+    // the value, and the futures become ready without a value.
+    ~promise_base();
+
+    promise_base(promise_base&& p) noexcept : _p(p._p) {
+        p._p = 0;
+    }
+
+    // copy constructor, just increment the reference count
+    promise_base(const promise_base& p);
+
+    void operator=(const promise_base&) = delete;
+
+  protected:
+    // get a new reference of the shared state for a future
+    void* ref() const;
+
+    // Lock the state for setting the value, return false if the value was set
+    // already. The value must be constructed in data() before calling set().
+    bool lock() const;
+    void* data() const;
+    void set() const;
+
+    void* _p;
+};
+
+} // xx
+
+// A future holds a value that will be set by a promise, maybe in another
+// scheduler or thread. Futures of the same promise share the value.
+//
+// Example:
+//   co::promise<int> p;
+//   auto f = p.get_future();
+//   go([p]() { p.set_value(compute()); });
+//   int v = f.get();
+template<typename T>
+class future : public xx::future_base {
+  public:
+    future() noexcept : future_base() {}
+    explicit future(void* p) noexcept : future_base(p) {}
+    future(future&& f) noexcept : future_base(std::move(f)) {}
+    future(const future& f) : future_base(f) {}
+    ~future() = default;
+
+    // wait until the future is ready and return the value, the promise must
+    // not be broken (check has_value() if it may be)
+    T& get() const {
+        this->wait();
+        assert(this->has_value());
+        return *static_cast<T*>(this->data());
+    }
+};
+
+template<>
+class future<void> : public xx::future_base {
+  public:
+    future() noexcept : future_base() {}
+    explicit future(void* p) noexcept : future_base(p) {}
+    future(future&& f) noexcept : future_base(std::move(f)) {}
+    future(const future& f) : future_base(f) {}
+    ~future() = default;
+
+    // wait until the future is ready
+    void get() const { this->wait(); }
+};
+
+// A promise sets the value of its futures, at most once. Copies of a promise
+// share the same state, and the first call of set_value() wins.
+template<typename T>
+class promise : public xx::promise_base {
+  public:
+    promise() : promise_base(sizeof(T), &promise::_destroy) {}
+    promise(promise&& p) noexcept : promise_base(std::move(p)) {}
+    promise(const promise& p) : promise_base(p) {}
+    ~promise() = default;
+
+    future<T> get_future() const { return future<T>(this->ref()); }
+
+    // construct the value with @x, return false if the value was set already
+    template<typename... X>
+    bool set_value(X&&... x) const {
+        if (!this->lock()) return false;
+        new (this->data()) T(std::forward<X>(x)...);
+        this->set();
+        return true;
+    }
+
+  private:
+    static void _destroy(void* p) { static_cast<T*>(p)->~T(); }
+};
+
+template<>
+class promise<void> : public xx::promise_base {
+  public:
+    promise() : promise_base(0, 0) {}
+    promise(promise&& p) noexcept : promise_base(std::move(p)) {}
+    promise(const promise& p) : promise_base(p) {}
+    ~promise() = default;
+
+    future<void> get_future() const { return future<void>(this->ref()); }
+
+    // make the futures ready, return false if it was done already
+    bool set_value() const {
+        if (!this->lock()) return false;
+        this->set();
+        return true;
+    }
+};
+
+// Return a future which becomes ready when all the @n futures are ready. It
+// needs only one allocation, no coroutine or thread waits for the futures.
+template<typename T>
+inline future<void> when_all(const future<T>* fs, size_t n) {
+    void* const j = xx::join_make(n, false);
+    for (size_t i = 0; i < n; ++i) xx::join_add(j, i, fs[i]);
+    return future<void>(j);
+}
+
+template<typename T>
+inline future<void> when_all(const co::vector<future<T>>& fs) {
+    return co::when_all(fs.data(), fs.size());
+}
+
+// Return a future of the index of the first future ready in the @n futures.
+// The promise of the future returned is broken if @n is 0.
+template<typename T>
+inline future<size_t> when_any(const future<T>* fs, size_t n) {
+    void* const j = xx::join_make(n, true);
+    for (size_t i = 0; i < n; ++i) xx::join_add(j, i, fs[i]);
+    return future<size_t>(j);
+}
+
+template<typename T>
+inline future<size_t> when_any(const co::vector<future<T>>& fs) {
+    return co::when_any(fs.data(), fs.size());
+}
+
+} // co
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "../def.h"
+#include "../mem.h"
+#include <assert.h>
+
+namespace co {
+namespace xx {
+
+// get a new key for coroutine-local values, keys are never reused
+__coapi uint32 local_key();
+
+// get the value of the key in the current coroutine, NULL if not set
+__coapi void* local_get(uint32 k);
+
+// Set the value of the key in the current coroutine, @del will be called to
+// destroy the value when the coroutine ends. The old value, if any, will be
+// destroyed here.
+__coapi void local_set(uint32 k, void* p, void (*del)(void*));
+
+} // xx
+
+/**
+ * coroutine-local storage 
+ *   - Each coroutine has its own value of type T, which is constructed on the 
+ *     first access in the coroutine, and destroyed when the coroutine ends. 
+ *   - Values are stored in an array in the coroutine, indexed by a key of this 
+ *     object. Lookup is O(1) and lock-free. 
+ *   - Keys are never reused, so objects of this class SHOULD be long-lived, 
+ *     usually global or static variables. 
+ *   - All methods MUST be called in coroutine. 
+ *
+ *   - eg. 
+ *     co::coroutine_local<fastring> g_trace_id; 
+ *     go([]() { 
+ *         *g_trace_id = "xxx";       // set the value for this coroutine 
+ *         LOG << *g_trace_id;        // get the value 
+ *     }); 
+ */
+template<typename T>
+class coroutine_local {
+  public:
+    coroutine_local() : _key(xx::local_key()) {}
+    ~coroutine_local() = default;
+
+    // get the value of the current coroutine, construct it if not exists
+    T* get() const {
+        void* p = xx::local_get(_key);
+        if (!p) {
+            p = co::make<T>();
+            xx::local_set(_key, p, &_destroy);
+        }
+        return (T*)p;
+    }
+
+    // set the value of the current coroutine, @p MUST be created by co::make<T>()
+    void set(T* p) const { xx::local_set(_key, p, &_destroy); }
+
+    // destroy the value of the current coroutine if exists
+    void reset() const {
+        if (xx::local_get(_key)) xx::local_set(_key, 0, &_destroy);
+    }
+
+    // check whether the value of the current coroutine exists
+    bool has_value() const { return xx::local_get(_key) != 0; }
+
+    T* operator->() const { return this->get(); }
+    T& operator*() const { return *this->get(); }
+
+  private:
+    static void _destroy(void* p) { co::del((T*)p); }
+    uint32 _key;
+    DISALLOW_COPY_AND_ASSIGN(coroutine_local);
+};
+
+} // co
@@ -46,6 +46,83 @@ class __coapi mutex_guard {
     DISALLOW_COPY_AND_ASSIGN(mutex_guard);
 };
 
+// Reader-writer lock for coroutines, it can be also used in non-coroutines.
+//   - Readers share the lock, writers hold it exclusively.
+//   - Writers are preferred, a reader waits if a writer is waiting. When a
+//     writer unlocks, readers waiting take the lock before other writers, so
+//     neither side starves.
+//   - Readers and writers take the lock with a single atomic operation if
+//     nobody is waiting.
+class __coapi shared_mutex {
+  public:
+    shared_mutex();
+    ~shared_mutex();
+
+    shared_mutex(shared_mutex&& m) noexcept : _p(m._p) { m._p = 0; }
+
+    // copy constructor, just increment the reference count
+    shared_mutex(const shared_mutex& m);
+
+    void operator=(const shared_mutex&) = delete;
+
+    // lock exclusively for writing
+    void lock() const;
+
+    void unlock() const;
+
+    bool try_lock() const;
+
+    // lock shared for reading
+    void lock_shared() const;
+
+    void unlock_shared() const;
+
+    bool try_lock_shared() const;
+
+  private:
+    void* _p;
+};
+
+// hold a co::shared_mutex for reading in the scope
+class __coapi shared_guard {
+  public:
+    explicit shared_guard(const co::shared_mutex& m) : _m(m) {
+        _m.lock_shared();
+    }
+
+    explicit shared_guard(const co::shared_mutex* m) : _m(*m) {
+        _m.lock_shared();
+    }
+
+    ~shared_guard() {
+        _m.unlock_shared();
+    }
+
+  private:
+    const co::shared_mutex& _m;
+    DISALLOW_COPY_AND_ASSIGN(shared_guard);
+};
+
+// hold a co::shared_mutex for writing in the scope
+class __coapi unique_guard {
+  public:
+    explicit unique_guard(const co::shared_mutex& m) : _m(m) {
+        _m.lock();
+    }
+
+    explicit unique_guard(const co::shared_mutex* m) : _m(*m) {
+        _m.lock();
+    }
+
+    ~unique_guard() {
+        _m.unlock();
+    }
+
+  private:
+    const co::shared_mutex& _m;
+    DISALLOW_COPY_AND_ASSIGN(unique_guard);
+};
+
 typedef mutex Mutex;
 typedef mutex_guard MutexGuard;
 
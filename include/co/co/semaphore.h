@@ -0,0 +1,45 @@
+#pragma once
+
+#include "../def.h"
+
+namespace co {
+
+// Counting semaphore for coroutines, it can be also used in non-coroutines.
+// A coroutine waiting for a permit is parked, not the scheduler thread.
+//
+// Example:
+//   co::semaphore sem(8); // at most 8 requests at the same time
+//   go([sem]() {
+//       sem.acquire();
+//       request();
+//       sem.release();
+//   });
+class __coapi semaphore {
+  public:
+    // initialize the number of permits as @n
+    explicit semaphore(uint32 n=0);
+    ~semaphore();
+
+    semaphore(semaphore&& s) noexcept : _p(s._p) {
+        s._p = 0;
+    }
+
+    // copy constructor, just increment the reference count
+    semaphore(const semaphore& s);
+
+    void operator=(const semaphore&) = delete;
+
+    // take a permit, wait until one is available
+    void acquire() const;
+
+    // take a permit if one is available, never wait
+    bool try_acquire() const;
+
+    // add @n permits, and wake up at most @n waiters
+    void release(uint32 n=1) const;
+
+  private:
+    void* _p;
+};
+
+} // co
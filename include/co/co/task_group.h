@@ -0,0 +1,113 @@
+#pragma once
+
+#include "../def.h"
+#include "../closure.h"
+#include <type_traits>
+
+namespace co {
+namespace xx {
+
+// Register the current coroutine in the task group @g, @pos is where the group
+// keeps the position of the coroutine. Return false if the group was cancelled.
+__coapi bool group_enter(void* g, uint32* pos);
+
+// Unregister the current coroutine from the task group @g, @ok is false if the
+// task failed. The group is cancelled on the first failure.
+__coapi void group_leave(void* g, uint32* pos, bool ok);
+
+// a task returning void never fails
+template<typename F>
+inline auto run_task(F& f) -> typename std::enable_if<std::is_void<decltype(f())>::value, bool>::type {
+    f();
+    return true;
+}
+
+// a task returning false (or something converted to false) fails
+template<typename F>
+inline auto run_task(F& f) -> typename std::enable_if<!std::is_void<decltype(f())>::value, bool>::type {
+    return f() ? true : false;
+}
+
+template<typename F>
+class GroupTask : public Closure {
+  public:
+    GroupTask(void* g, F&& f) : _g(g), _pos(0), _f(std::forward<F>(f)) {}
+    virtual ~GroupTask() = default;
+
+    virtual void run() {
+        // the task is skipped if the group was cancelled before it starts
+        const bool ok = group_enter(_g, &_pos) ? run_task(_f) : true;
+        group_leave(_g, &_pos, ok);
+        co::del(this);
+    }
+
+  private:
+    void* _g;
+    uint32 _pos;
+    typename std::remove_reference<F>::type _f;
+};
+
+} // xx
+
+// A group of child coroutines that are waited for and cancelled together.
+//   - A task is a callable with no parameter, returning void or bool. It fails
+//     if it returns false, and the group is cancelled on the first failure.
+//   - Cancelling the group wakes up children blocked in hooked socket APIs,
+//     co::sleep() or co::event::wait(), as if these calls timed out, and any
+//     further such call in the children fails at once. Hooked APIs set the
+//     error code to ECANCELED then. CPU-bound children may check co::cancelled().
+//   - The destructor cancels the children still running and waits for them.
+//
+// Example:
+//   co::task_group g;
+//   for (auto& host : hosts) {
+//       g.go([host]() { return fetch(host); });
+//   }
+//   if (!g.wait(1000)) LOG << "fetch failed: " << co::strerror(g.error());
+class __coapi task_group {
+  public:
+    task_group();
+    ~task_group();
+
+    task_group(task_group&& g) noexcept : _p(g._p) {
+        g._p = 0;
+    }
+
+    task_group(const task_group&) = delete;
+    void operator=(const task_group&) = delete;
+
+    // start a child coroutine in the group
+    template<typename F>
+    void go(F&& f) {
+        this->_go(co::make<xx::GroupTask<F>>(_p, std::forward<F>(f)));
+    }
+
+    // Cancel the children, the error code of the group is ECANCELED if no
+    // failure has occurred before.
+    void cancel() const;
+
+    // check whether the group has been cancelled
+    bool cancelled() const;
+
+    // Wait until all children are done. If it times out, or the coroutine
+    // waiting is itself cancelled, the children are cancelled and waited for.
+    // Return true if no child failed and the group was not cancelled.
+    bool wait(uint32 ms=(uint32)-1) const;
+
+    // error code of the first failure, 0 if none:
+    //   - co::error() in the failed child when it returned, or -1 if it was 0.
+    //   - ETIMEDOUT if wait(ms) timed out.
+    //   - ECANCELED if the group was cancelled by cancel() or the coroutine waiting.
+    int error() const;
+
+  private:
+    // start a child coroutine with a closure created by xx::GroupTask for this group
+    void _go(Closure* cb);
+
+    void* _p;
+};
+
+// check whether the task group of the current coroutine has been cancelled
+__coapi bool cancelled();
+
+} // co
@@ -102,6 +102,9 @@ class Array {
 __coapi void* alloc();
 __coapi char* alloc_string(const void* p, size_t n);
 
+// abort on an attempt to modify a Json parsed into a co::arena
+__coapi void fail_arena_write();
+
 } // xx
 
 class __coapi Json {
@@ -120,18 +123,19 @@ class __coapi Json {
     struct _arr_t {};
 
     struct _H {
-        _H(bool v) noexcept : type(t_bool), b(v) {}
-        _H(int64 v) noexcept : type(t_int), i(v) {}
-        _H(double v) noexcept : type(t_double), d(v) {}
-        _H(_obj_t) noexcept : type(t_object), p(0) {}
-        _H(_arr_t) noexcept : type(t_array), p(0) {}
+        _H(bool v) noexcept : type(t_bool), arena(0), b(v) {}
+        _H(int64 v) noexcept : type(t_int), arena(0), i(v) {}
+        _H(double v) noexcept : type(t_double), arena(0), d(v) {}
+        _H(_obj_t) noexcept : type(t_object), arena(0), p(0) {}
+        _H(_arr_t) noexcept : type(t_array), arena(0), p(0) {}
 
         _H(const char* p) : _H(p, strlen(p)) {}
-        _H(const void* p, size_t n) : type(t_string), size((uint32)n) {
+        _H(const void* p, size_t n) : type(t_string), arena(0), size((uint32)n) {
             s = xx::alloc_string(p, n);
         }
 
-        uint32 type;
+        uint16 type;
+        uint16 arena; // 1 if allocated from a co::arena, not freed by reset()
         uint32 size;  // size of string
         union {
             bool b;   // for bool
@@ -151,9 +155,14 @@ class __coapi Json {
     Json(const Json&) = delete;
     void operator=(const Json&) = delete;
 
+    // a node parsed into an arena can only be replaced by null or another node
+    // from an arena, reset() it before assigning other values.
     Json& operator=(Json&& v) {
         if (&v != this) {
-            if (_h) this->reset();
+            if (_h) {
+                if (unlikely(_h->arena) && v._h && !v._h->arena) xx::fail_arena_write();
+                this->reset();
+            }
             _h = v._h;
             v._h = 0;
         }
@@ -192,7 +201,7 @@ class __coapi Json {
     Json(std::initializer_list<Json> v);
 
     int type() const { return _h ? _h->type : t_null; }
-    bool is_null() const { return _h == 0; }
+    bool is_null() const { return _h == 0 || _h->type == t_null; }
     bool is_bool() const { return _h && (_h->type & t_bool); }
     bool is_int() const { return _h && (_h->type & t_int); }
     bool is_double() const { return _h && (_h->type & t_double); }
@@ -295,6 +304,7 @@ class __coapi Json {
     // push v to an array.
     // if the Json calling this method is not an array, it will be reset to an array.
     Json& push_back(Json&& v) {
+        this->_check_writable();
         if (_h && (_h->type & t_array)) {
             if (unlikely(!_h->p)) new(&_h->p) xx::Array(8);
         } else {
@@ -314,6 +324,7 @@ class __coapi Json {
     // remove the ith element from an array
     // the last element will be moved to the ith place
     void remove(uint32 i) {
+        this->_check_writable();
         if (this->is_array() && i < this->array_size()) {
             ((Json&)_array()[i]).reset();
             _array().remove(i);
@@ -325,6 +336,7 @@ class __coapi Json {
 
     // erase the ith element from an array
     void erase(uint32 i) {
+        this->_check_writable();
         if (this->is_array() && i < this->array_size()) {
             ((Json&)_array()[i]).reset();
             _array().erase(i);
@@ -403,6 +415,7 @@ class __coapi Json {
     // push key-value to the back of an object, key may be repeated.
     // if the Json calling this method is not an object, it will be reset to an object.
     Json& add_member(const char* key, Json&& v) {
+        this->_check_writable();
         if (_h && (_h->type & t_object)) {
             if (unlikely(!_h->p)) new(&_h->p) xx::Array(16);
         } else {
@@ -485,14 +498,25 @@ class __coapi Json {
     bool parse_from(const fastring& s)    { return this->parse_from(s.data(), s.size()); }
     bool parse_from(const std::string& s) { return this->parse_from(s.data(), s.size()); }
 
+    // Parse Json from string, with all the nodes allocated from the arena @a.
+    //   - The nodes are released all at once with the arena, reset() or the
+    //     destructor does not free them.
+    //   - The result is read-only, modifying it aborts the program, dup() makes
+    //     a copy that can be modified.
+    bool parse_from(const char* s, size_t n, co::arena& a);
+    bool parse_from(const char* s, co::arena& a)        { return this->parse_from(s, strlen(s), a); }
+    bool parse_from(const fastring& s, co::arena& a)    { return this->parse_from(s.data(), s.size(), a); }
+    bool parse_from(const std::string& s, co::arena& a) { return this->parse_from(s.data(), s.size(), a); }
+
     void reset();
     void swap(Json& v) noexcept { auto h = _h; _h = v._h; v._h = h; }
     void swap(Json&& v) noexcept { v.swap(*this); }
 
   private:
-    friend class Parser;
+    template<typename A> friend class Parser;
     void* _dup() const;
     xx::Array& _array() const { return (xx::Array&)_h->p; }
+    void _check_writable() const { if (unlikely(_h && _h->arena)) xx::fail_arena_write(); }
     Json& _set(uint32 i);
     Json& _set(int i) { return this->_set((uint32)i); }
     Json& _set(const char* key);
@@ -526,6 +550,18 @@ inline Json parse(const char* s)        { return parse(s, strlen(s)); }
 inline Json parse(const fastring& s)    { return parse(s.data(), s.size()); }
 inline Json parse(const std::string& s) { return parse(s.data(), s.size()); }
 
+// parse Json with the nodes allocated from the arena @a, see Json::parse_from()
+inline Json parse(const char* s, size_t n, co::arena& a) {
+    Json r;
+    if (r.parse_from(s, n, a)) return r;
+    r.reset();
+    return r;
+}
+
+inline Json parse(const char* s, co::arena& a)        { return parse(s, strlen(s), a); }
+inline Json parse(const fastring& s, co::arena& a)    { return parse(s.data(), s.size(), a); }
+inline Json parse(const std::string& s, co::arena& a) { return parse(s.data(), s.size(), a); }
+
 } // json
 
 namespace co {
@@ -61,6 +61,16 @@ struct __coapi Initializer {
 
 static Initializer g_initializer;
 
+// load what print_stack() needs, call it before print_stack() is used in a
+// signal handler
+__coapi void prepare_stack();
+
+// write @s and the stack of the calling thread to stderr, skipping @skip frames
+// of the caller. It is async-signal-safe after prepare_stack() was called, and
+// does nothing before that, or while another thread is in it. Function names
+// are not demangled, as that allocates memory.
+__coapi void print_stack(const char* s, int skip=0);
+
 enum LogLevel {
     debug = 0,
     info = 1,
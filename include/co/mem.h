@@ -51,6 +51,75 @@ __coapi void* try_realloc(void* p, size_t old_size, size_t new_size);
 
 __coapi char* strdup(const char* s);
 
+// statistics of memory allocated by co::alloc()
+struct mem_stat {
+    static const int N = 15; // size classes: 16, 32, 64, ... 128K, larger
+
+    uint64 in_use;      // bytes in use (allocated and not freed yet)
+    uint64 reserved;    // bytes of virtual memory reserved
+    uint64 committed;   // bytes of virtual memory committed
+    uint64 xfrees;      // frees of memory owned by other threads
+    uint64 span_allocs; // allocations larger than 128K, mapped in spans
+    uint64 span_bytes;  // bytes in use of allocations larger than 128K
+    uint64 span_cached; // bytes of freed spans cached for reuse
+    uint64 objects[N];  // objects in use in each size class
+    uint32 threads;     // number of thread allocators
+};
+
+// statistics of a thread allocator
+//   - A thread allocator lives as long as the process, the memory it owns may
+//     still be in use after the thread exits.
+struct mem_thread_stat {
+    uint32 id;           // id of the thread allocator
+    uint32 small_blocks; // small blocks (32K) owned, for allocations not larger than 2K
+    uint32 large_blocks; // large blocks (2M, or 1M on 32 bit) owned
+    uint64 allocs;       // number of allocations
+    uint64 frees;        // number of frees, including memory owned by other threads
+    uint64 alloc_bytes;  // bytes allocated
+    uint64 free_bytes;   // bytes freed, including memory owned by other threads
+    uint64 xfrees;       // frees of memory owned by other threads
+    uint64 span_allocs;  // allocations larger than 128K
+};
+
+// get statistics of all the thread allocators
+//   - Counters are written by each thread without locks, the result may be a
+//     little behind the threads.
+__coapi mem_stat mem_stats();
+
+// get statistics of each thread allocator
+//   - Fill at most @n items in @v, return number of the thread allocators.
+__coapi size_t mem_thread_stats(mem_thread_stat* v, size_t n);
+
+// live allocations sampled by the heap profiler from the same call stack
+struct mem_sample {
+    static const int N = 16; // max depth of the call stack
+
+    uint64 bytes;  // bytes in use of the sampled allocations
+    uint64 count;  // number of the sampled allocations in use
+    uint32 depth;  // depth of the call stack
+    void* stack[N]; // return addresses, the innermost (in co::alloc) first
+};
+
+// start the heap profiler, it records the call stack of one in @n allocations,
+// 0 to stop sampling new allocations
+//   - Multiply the numbers of samples by @n to estimate the real usage.
+//   - Frees are slower when there are samples alive.
+//   - Call stacks are recorded on linux (glibc) and windows only.
+__coapi void mem_profile(uint32 n);
+
+// get live samples grouped by call stack, the largest first
+//   - Fill at most @n items in @v, return number of the call stacks.
+__coapi size_t mem_profile_samples(mem_sample* v, size_t n);
+
+// write the @n largest call stacks of live samples to the log, with symbols if possible
+__coapi void mem_profile_log(size_t n=16);
+
+// give free memory of the calling thread back to the OS, return bytes given back
+//   - Memory is owned by the thread that allocated it. Threads give it back
+//     when they exit, and schedulers do it when they have not allocated for
+//     FLG_co_mem_trim_ms, keeping FLG_co_mem_retain_mb of empty blocks.
+__coapi size_t mem_trim();
+
 // alloc memory and construct an object on it
 //   - T* p = co::make<T>(args)
 template<typename T, typename... Args>
@@ -68,6 +137,8 @@ inline void del(T* p, size_t n=sizeof(T)) {
 // used internally by coost, do not call it
 __coapi void* _salloc(size_t n);
 __coapi void _dealloc(std::function<void()>&& f, int x);
+__coapi void _flush_xfree(); // flush frees of memory owned by other threads
+__coapi bool _trim_if_idle(); // trim if the thread has been idle, true if it will be trimmed later
 
 // used internally by coost, do not call it
 template<typename T, int N, typename... Args>
@@ -425,4 +496,121 @@ constexpr bool operator!=(const stl_allocator<T1>&, const stl_allocator<T2>&) no
     return false;
 }
 
+// Arena (monotonic) allocator. Memory is taken from blocks by bumping a pointer,
+// and is released all at once when the arena is cleared or destroyed.
+//   - It is not thread-safe.
+//   - Destructors of objects created in the arena are not called.
+//   - eg.
+//     co::arena a;
+//     int* p = (int*) a.alloc(sizeof(int) * 8);
+//     std::vector<int, co::arena_allocator<int>> v(a);
+class __coapi arena {
+  public:
+    // @block_size: size of the first block, the following blocks grow up to 1M.
+    explicit arena(size_t block_size = 4096);
+    ~arena();
+
+    arena(const arena&) = delete;
+    void operator=(const arena&) = delete;
+
+    // alloc @n bytes, 8 byte aligned
+    void* alloc(size_t n) {
+        n = (n + 7) & ~(size_t)7;
+        if (n - 1 < (size_t)(_e - _p)) { /* n == 0 goes to _alloc() */
+            void* const r = _p;
+            _p += n;
+            return r;
+        }
+        return this->_alloc(n, 8);
+    }
+
+    // alloc @n bytes, @align byte aligned (align is power of 2 and <= 1024)
+    void* alloc(size_t n, size_t align) {
+        if (align <= 8) return this->alloc(n);
+        char* const p = (char*)(((size_t)_p + align - 1) & ~(align - 1));
+        const size_t m = (n + 7) & ~(size_t)7;
+        if (_p != 0 && (size_t)(p - _p) + m <= (size_t)(_e - _p)) {
+            _p = p + m;
+            return p;
+        }
+        return this->_alloc(n, align);
+    }
+
+    // release all the memory, the last (largest) block is kept for reuse
+    void clear();
+
+    // bytes of the blocks held by the arena
+    size_t capacity() const { return _cap; }
+
+  private:
+    struct _B { _B* next; size_t size; };
+    void* _alloc(size_t n, size_t align);
+
+    char* _p;
+    char* _e;
+    _B* _b;
+    size_t _bs;
+    size_t _cap;
+};
+
+// allocator for STL, allocating memory from an arena
+//   - deallocate() does nothing, the memory is released with the arena.
+//   - eg.
+//     co::arena a;
+//     std::vector<int, co::arena_allocator<int>> v(a);
+template<class T>
+struct arena_allocator {
+    using value_type = T;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+    using is_always_equal = std::false_type;
+
+    typedef value_type* pointer;
+    typedef value_type const* const_pointer;
+    typedef value_type& reference;
+    typedef value_type const& const_reference;
+
+    arena_allocator(arena& a) noexcept : _a(&a) {}
+    arena_allocator(const arena_allocator&) noexcept = default;
+    template<class U> arena_allocator(const arena_allocator<U>& x) noexcept : _a(x._a) {}
+
+    T* allocate(size_type n) {
+        return static_cast<T*>(_a->alloc(n * sizeof(T), alignof(T)));
+    }
+    T* allocate(size_type n, const void*) { return allocate(n); }
+
+    void deallocate(T*, size_type) noexcept {}
+
+    template<class U, class ...Args>
+    void construct(U* p, Args&& ...args) {
+        ::new(p) U(std::forward<Args>(args)...);
+    }
+
+    template<class U>
+    void destroy(U* p) noexcept { p->~U(); }
+
+    template<class U> struct rebind { using other = arena_allocator<U>; };
+    pointer address(reference x) const noexcept { return &x; }
+    const_pointer address(const_reference x) const noexcept { return &x; }
+
+    size_type max_size() const noexcept {
+        return static_cast<size_t>(-1) / sizeof(value_type);
+    }
+
+    arena* _a;
+};
+
+template<class T1, class T2>
+inline bool operator==(const arena_allocator<T1>& x, const arena_allocator<T2>& y) noexcept {
+    return x._a == y._a;
+}
+
+template<class T1, class T2>
+inline bool operator!=(const arena_allocator<T1>& x, const arena_allocator<T2>& y) noexcept {
+    return x._a != y._a;
+}
+
 } // co
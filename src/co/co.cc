@@ -1,5 +1,7 @@
 #include "sched.h"
 #include "co/stl.h"
+#include "co/os.h"
+#include <thread>
 
 #ifndef _WIN32
 #ifdef __linux__
@@ -14,6 +16,9 @@
 #endif
 #endif
 
+DEF_uint32(co_mutex_spin, 200, ">>#1 max number of spins for a co::mutex held in another thread, "
+           "before the coroutine or thread parks, 0 for no spinning");
+
 namespace co {
 namespace xx {
 
@@ -203,75 +208,376 @@ class mutex_impl {
         };
     };
 
-    mutex_impl() : _refn(1), _lock(0), _has_cv(false) {}
+    static const uint32 L = 1; // locked
+    static const uint32 P = 2; // there are waiters
+
+    mutex_impl() : _st(0), _refn(1), _spin(0), _owner(0), _tg(0), _has_cv(false) {}
     ~mutex_impl() { if (_has_cv) xx::cv_free(&_cv); }
 
     void lock();
     void unlock();
-    bool try_lock();
+    bool try_lock() { return atomic_bool_cas(&_st, 0, L, mo_acquire, mo_relaxed); }
 
     void ref() { atomic_inc(&_refn, mo_relaxed); }
     uint32 unref() { return atomic_dec(&_refn, mo_acq_rel); }
 
   private:
+    bool _spin_lock(Sched* sched);
+
+  private:
+    uint32 _st;
+    uint32 _refn;
+    uint32 _spin;  // average number of spins that took the lock
+    Sched* _owner; // scheduler of the holder, NULL for non-coroutine threads
     xx::mutex _m;
     xx::cv_t _cv;
     queue _wq;
-    uint32 _refn;
-    uint8 _lock;
+    uint32 _tg; // number of times the lock was handed over to non-coroutine threads
     bool _has_cv;
 };
 
-inline bool mutex_impl::try_lock() {
-    xx::mutex_guard g(_m);
-    return _lock ? false : (_lock = 1);
+inline void cpu_relax() {
+#if defined(_MSC_VER)
+    YieldProcessor();
+#elif defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+// Spin for the lock before parking, if the holder runs in another thread.
+// Parking costs a round trip through the scheduler, much more than a short
+// critical section. Like the adaptive mutex of glibc, the limit of spins is
+// adjusted by the number of spins it took to get the lock recently. It never
+// spins on a single cpu, as the holder can't run while we are spinning.
+bool mutex_impl::_spin_lock(Sched* sched) {
+    static const bool mp = os::cpunum() > 1;
+    const uint32 max = FLG_co_mutex_spin;
+    if (max == 0 || !mp || (sched && atomic_load(&_owner, mo_relaxed) == sched)) return false;
+
+    const uint32 spin = atomic_load(&_spin, mo_relaxed);
+    const uint32 n = spin * 2 + 10 < max ? spin * 2 + 10 : max;
+    uint32 i = 0;
+    for (; i < n; ++i) {
+        cpu_relax();
+        const uint32 s = atomic_load(&_st, mo_relaxed);
+        if (s == 0) {
+            if (atomic_bool_cas(&_st, 0, L, mo_acquire, mo_relaxed)) break;
+        } else if (s & P) {
+            return false; // the lock will be handed over to the waiters
+        }
+    }
+    atomic_store(&_spin, spin + ((int32)(i - spin) / 8), mo_relaxed);
+    return i < n;
 }
 
 void mutex_impl::lock() {
     const auto sched = xx::gSched;
-    if (sched) { /* in coroutine */
-        _m.lock();
-        if (!_lock) {
-            _lock = 1;
-            _m.unlock();
+    if (this->try_lock() || this->_spin_lock(sched)) {
+        atomic_store(&_owner, sched, mo_relaxed);
+        return;
+    }
+
+    _m.lock();
+    uint32 s = atomic_load(&_st, mo_relaxed);
+    for (;;) {
+        if (s == 0) {
+            s = atomic_cas(&_st, 0, L, mo_acquire, mo_relaxed);
+            if (s == 0) {
+                _m.unlock();
+                atomic_store(&_owner, sched, mo_relaxed);
+                return;
+            }
+        } else if (s & P) {
+            break;
         } else {
-            Coroutine* const co = sched->running();
-            _wq.push_back(co);
-            _m.unlock();
-            sched->yield();
+            // set P, so that the holder will come here to hand over the lock
+            s = atomic_cas(&_st, L, L | P, mo_relaxed, mo_relaxed);
+            if (s == L) break;
         }
+    }
+
+    if (sched) { /* in coroutine */
+        Coroutine* const co = sched->running();
+        _wq.push_back(co);
+        _m.unlock();
+        sched->yield();
 
     } else { /* non-coroutine */
-        xx::mutex_guard g(_m);
-        if (!_lock) {
-            _lock = 1;
+        _wq.push_back(nullptr);
+        if (!_has_cv) { xx::cv_init(&_cv); _has_cv = true; }
+        while (_tg == 0) xx::cv_wait(&_cv, _m.native_handle());
+        --_tg;
+        _m.unlock();
+    }
+    atomic_store(&_owner, sched, mo_relaxed);
+}
+
+void mutex_impl::unlock() {
+    if (atomic_bool_cas(&_st, L, 0, mo_release, mo_relaxed)) return;
+
+    // hand over the lock to the first waiter
+    _m.lock();
+    Coroutine* const co = (Coroutine*) _wq.pop_front();
+    atomic_store(&_st, _wq.empty() ? L : (L | P), mo_release);
+    if (co) {
+        _m.unlock();
+        co->sched->add_ready_task(co);
+    } else {
+        ++_tg;
+        _m.unlock();
+        xx::cv_notify_one(&_cv);
+    }
+}
+
+// Readers and writers take the lock with a CAS on _st if nobody waits. The
+// bits of _st other than the reader count are changed only with _m locked,
+// and the lock is handed over directly to the waiters.
+class shared_mutex_impl {
+  public:
+    static const uint32 W = 1u << 31; // a writer holds the lock
+    static const uint32 P = 1u << 30; // there are waiters
+    static const uint32 R = P - 1;    // mask of the reader count
+
+    shared_mutex_impl()
+        : _st(0), _refn(1), _rg(0), _wg(0), _has_cv(false) {}
+    ~shared_mutex_impl() { if (_has_cv) xx::cv_free(&_cv); }
+
+    void lock();
+    void unlock();
+    bool try_lock();
+    void lock_shared();
+    void unlock_shared();
+    bool try_lock_shared();
+
+    void ref() { atomic_inc(&_refn, mo_relaxed); }
+    uint32 unref() { return atomic_dec(&_refn, mo_acq_rel); }
+
+  private:
+    void _wait(mutex_impl::queue& q, uint32* g);
+    void _wake_writer();
+    void _wake_readers();
+
+  private:
+    uint32 _st;
+    uint32 _refn;
+    xx::mutex _m;
+    xx::cv_t _cv;
+    mutex_impl::queue _rq; // readers waiting
+    mutex_impl::queue _wq; // writers waiting
+    uint32 _rg; // number of times the lock was handed over to reader threads
+    uint32 _wg; // number of times the lock was handed over to writer threads
+    bool _has_cv;
+};
+
+// Wait in the queue @q until the lock is handed over, called with _m locked,
+// and _m will be unlocked. @g counts the handovers to non-coroutine threads.
+void shared_mutex_impl::_wait(mutex_impl::queue& q, uint32* g) {
+    const auto sched = xx::gSched;
+    if (sched) {
+        q.push_back(sched->running());
+        _m.unlock();
+        sched->yield();
+    } else {
+        q.push_back(nullptr);
+        if (!_has_cv) { xx::cv_init(&_cv); _has_cv = true; }
+        while (*g == 0) xx::cv_wait(&_cv, _m.native_handle());
+        --*g;
+        _m.unlock();
+    }
+}
+
+// hand the lock over to the first writer waiting, called with _m locked
+void shared_mutex_impl::_wake_writer() {
+    Coroutine* const co = (Coroutine*) _wq.pop_front();
+    atomic_store(&_st, W | (_wq.empty() && _rq.empty() ? 0 : P), mo_release);
+    if (co) {
+        co->sched->add_ready_task(co);
+    } else {
+        ++_wg;
+        xx::cv_notify_all(&_cv);
+    }
+}
+
+// hand the lock over to all the readers waiting, called with _m locked
+void shared_mutex_impl::_wake_readers() {
+    const uint32 n = (uint32)_rq.size();
+    atomic_store(&_st, n | (_wq.empty() ? 0 : P), mo_release);
+    bool notify = false;
+    for (uint32 i = 0; i < n; ++i) {
+        Coroutine* const co = (Coroutine*) _rq.pop_front();
+        if (co) {
+            co->sched->add_ready_task(co);
         } else {
-            _wq.push_back(nullptr);
-            if (!_has_cv) { xx::cv_init(&_cv); _has_cv = true; }
-            for (;;) {
-                xx::cv_wait(&_cv, _m.native_handle());
-                if (_lock == 2) { _lock = 1; break; }
-            }
+            ++_rg;
+            notify = true;
         }
     }
+    if (notify) xx::cv_notify_all(&_cv);
 }
 
-void mutex_impl::unlock() {
+inline bool shared_mutex_impl::try_lock() {
+    return atomic_bool_cas(&_st, 0, W, mo_acquire, mo_relaxed);
+}
+
+void shared_mutex_impl::lock() {
+    if (this->try_lock()) return;
+    _m.lock();
+    uint32 s = atomic_load(&_st, mo_relaxed);
+    for (;;) {
+        if (s == 0) {
+            if (atomic_bool_cas(&_st, 0, W, mo_acquire, mo_relaxed)) { _m.unlock(); return; }
+        } else if (s & P) {
+            break;
+        } else {
+            // set P, so that the holders will come here to hand over the lock
+            const uint32 x = atomic_cas(&_st, s, s | P, mo_relaxed, mo_relaxed);
+            if (x == s) break;
+            s = x;
+            continue;
+        }
+        s = atomic_load(&_st, mo_relaxed);
+    }
+    this->_wait(_wq, &_wg);
+}
+
+void shared_mutex_impl::unlock() {
+    if (atomic_bool_cas(&_st, W, 0, mo_release, mo_relaxed)) return;
+    xx::mutex_guard g(_m);
+    // Readers waiting go first, so that they will not starve. New readers
+    // still wait if a writer is waiting.
+    if (!_rq.empty()) {
+        this->_wake_readers();
+    } else if (!_wq.empty()) {
+        this->_wake_writer();
+    } else {
+        atomic_store(&_st, 0, mo_release);
+    }
+}
+
+inline bool shared_mutex_impl::try_lock_shared() {
+    uint32 s = atomic_load(&_st, mo_relaxed);
+    while (!(s & (W | P))) {
+        const uint32 x = atomic_cas(&_st, s, s + 1, mo_acquire, mo_relaxed);
+        if (x == s) return true;
+        s = x;
+    }
+    return false;
+}
+
+void shared_mutex_impl::lock_shared() {
+    if (this->try_lock_shared()) return;
     _m.lock();
-    if (_wq.empty()) {
-        _lock = 0;
+    uint32 s = atomic_load(&_st, mo_relaxed);
+    for (;;) {
+        if (!(s & (W | P))) {
+            const uint32 x = atomic_cas(&_st, s, s + 1, mo_acquire, mo_relaxed);
+            if (x == s) { _m.unlock(); return; }
+            s = x;
+        } else if (s & P) {
+            break;
+        } else {
+            const uint32 x = atomic_cas(&_st, s, s | P, mo_relaxed, mo_relaxed);
+            if (x == s) break;
+            s = x;
+        }
+    }
+    this->_wait(_rq, &_rg);
+}
+
+void shared_mutex_impl::unlock_shared() {
+    const uint32 s = atomic_fetch_sub(&_st, 1, mo_release);
+    if (!(s & P) || (s & R) != 1) return;
+
+    // the last reader hands the lock over to a writer waiting
+    xx::mutex_guard g(_m);
+    if (atomic_load(&_st, mo_relaxed) == P) {
+        if (!_wq.empty()) {
+            this->_wake_writer();
+        } else if (!_rq.empty()) {
+            this->_wake_readers();
+        } else {
+            atomic_store(&_st, 0, mo_release);
+        }
+    }
+}
+
+// The counter _n is the number of permits left, or minus number of waiters if
+// it is negative. A permit released before the waiter is queued is saved in _g.
+class semaphore_impl {
+  public:
+    explicit semaphore_impl(uint32 n)
+        : _n((int32)n), _refn(1), _g(0), _tg(0), _has_cv(false) {}
+    ~semaphore_impl() { if (_has_cv) xx::cv_free(&_cv); }
+
+    void acquire();
+    bool try_acquire();
+    void release(uint32 n);
+
+    void ref() { atomic_inc(&_refn, mo_relaxed); }
+    uint32 unref() { return atomic_dec(&_refn, mo_acq_rel); }
+
+  private:
+    int32 _n;
+    uint32 _refn;
+    xx::mutex _m;
+    xx::cv_t _cv;
+    mutex_impl::queue _wq;
+    uint32 _g;  // permits released to waiters not queued yet
+    uint32 _tg; // permits handed over to non-coroutine threads
+    bool _has_cv;
+};
+
+void semaphore_impl::acquire() {
+    if (atomic_dec(&_n, mo_acquire) >= 0) return;
+
+    _m.lock();
+    if (_g > 0) { --_g; _m.unlock(); return; }
+
+    const auto sched = xx::gSched;
+    if (sched) {
+        _wq.push_back(sched->running());
         _m.unlock();
+        sched->yield();
     } else {
+        _wq.push_back(nullptr);
+        if (!_has_cv) { xx::cv_init(&_cv); _has_cv = true; }
+        while (_tg == 0) xx::cv_wait(&_cv, _m.native_handle());
+        --_tg;
+        _m.unlock();
+    }
+}
+
+bool semaphore_impl::try_acquire() {
+    int32 n = atomic_load(&_n, mo_relaxed);
+    while (n > 0) {
+        const int32 x = atomic_cas(&_n, n, n - 1, mo_acquire, mo_relaxed);
+        if (x == n) return true;
+        n = x;
+    }
+    return false;
+}
+
+void semaphore_impl::release(uint32 n) {
+    const int32 x = atomic_fetch_add(&_n, (int32)n, mo_release);
+    if (x >= 0) return;
+
+    // wake up min(n, -x) waiters
+    uint32 m = (uint32)-x < n ? (uint32)-x : n;
+    bool notify = false;
+    xx::mutex_guard g(_m);
+    for (; m > 0; --m) {
+        if (_wq.empty()) { _g += m; break; } // the waiters are not queued yet
         Coroutine* const co = (Coroutine*) _wq.pop_front();
         if (co) {
-            _m.unlock();
             co->sched->add_ready_task(co);
         } else {
-            _lock = 2;
-            _m.unlock();
-            xx::cv_notify_one(&_cv);
+            ++_tg;
+            notify = true;
         }
     }
+    if (notify) xx::cv_notify_all(&_cv);
 }
 
 class event_impl {
@@ -281,7 +587,8 @@ class event_impl {
     }
     ~event_impl() { if (_has_cv) xx::cv_free(&_cv); }
 
-    bool wait(uint32 ms);
+    // @cancelable: the wait in coroutine ends on cancellation of its task group
+    bool wait(uint32 ms, bool cancelable=false);
     void signal();
     void reset();
 
@@ -302,7 +609,7 @@ class event_impl {
     bool _has_cv;
 };
 
-bool event_impl::wait(uint32 ms) {
+bool event_impl::wait(uint32 ms, bool cancelable) {
     const auto sched = gSched;
     if (sched) { /* in coroutine */
         Coroutine* co = sched->running();
@@ -327,10 +634,16 @@ bool event_impl::wait(uint32 ms) {
         }
 
         if (ms != (uint32)-1) sched->add_timer(ms);
-        sched->yield();
-        if (!sched->timeout()) co::free(co->waitx, sizeof(waitx_t));
+        bool r;
+        if (cancelable) {
+            r = sched->yield_cancelable();
+        } else {
+            sched->yield();
+            r = !sched->timeout();
+        }
+        if (r) co::free(co->waitx, sizeof(waitx_t));
         co->waitx = nullptr;
-        return !sched->timeout();
+        return r;
 
     } else { /* not in coroutine */
         xx::mutex_guard g(_m);
@@ -469,12 +782,14 @@ class sync_event_impl {
 };
 
 __thread bool g_done = false;
+__thread uint32 g_sel = 0; // for the first case to try in select
 
 class pipe_impl {
   public:
     pipe_impl(uint32 buf_size, uint32 blk_size, uint32 ms, pipe::C&& c, pipe::D&& d)
         : _buf_size(buf_size), _blk_size(blk_size), _ms(ms), _has_cv(false),
-          _c(std::move(c)), _d(std::move(d)), _rx(0), _wx(0), _refn(1), _full(0), _closed(0) {
+          _c(std::move(c)), _d(std::move(d)), _owner(0), _busy(0), _nolock(false),
+          _rx(0), _wx(0), _refn(1), _full(0), _closed(0) {
         _buf = (char*) co::alloc(_buf_size);
     }
 
@@ -485,13 +800,17 @@ class pipe_impl {
 
     void read(void* p);
     void write(void* p, int v);
+    size_t read_n(char* p, size_t n);
+    size_t write_n(char* p, size_t n, int v);
     bool done() const { return g_done; }
+    static int select(const select_case* cs, size_t n, uint32 ms);
     void close();
     bool is_closed() const { return atomic_load(&_closed, mo_relaxed); }
 
     void ref() { atomic_inc(&_refn, mo_relaxed); }
     uint32 unref() { return atomic_dec(&_refn, mo_acq_rel); }
 
+    // the layout must begin as waitx_t, the scheduler changes the state on timeout
     struct waitx : co::clink {
         Coroutine* co;
         union {
@@ -503,6 +822,7 @@ class pipe_impl {
             } x;
             void* dummy;
         };
+        waitx_t* sel; // shared state of the select this waiter belongs to
         void* buf;
         size_t len; // total length of the memory
     };
@@ -519,15 +839,44 @@ class pipe_impl {
             w->len = sizeof(waitx);
         }
         w->co = co;
+        w->sel = 0;
         w->state = st_wait;
-        w->x.done = 0;
+        w->x.done = 0; // 1: done, 2: channel closed, 3: dropped (select only)
         return w;
     }
 
   private:
+    // Lock the channel for the scheduler @s (NULL for non-scheduler threads).
+    // The first scheduler using the channel owns it, and marks it busy instead
+    // of locking the mutex, until another thread uses the channel.
+    void _lock(Sched* s) {
+        if (s && atomic_load(&_owner, mo_relaxed) == s) {
+            atomic_store(&_busy, 1);
+            if (atomic_load(&_owner) == s) { _nolock = true; return; }
+            atomic_store(&_busy, 0, mo_release);
+        }
+        this->_lock_slow(s);
+    }
+
+    void _lock_slow(Sched* s);
+
+    void _unlock() {
+        _nolock ? atomic_store(&_busy, 0, mo_release) : _m.unlock();
+    }
+
     void _read_block(void* p);
     void _write_block(void* p, int v);
 
+    // check whether read or write can be done without waiting, called with _m locked
+    bool _can_read() const { return _rx != _wx || _full || this->is_closed(); }
+    bool _can_write() const { return !_full || this->is_closed(); }
+    void _read_one(void* p);
+    void _write_one(void* p, int v);
+    void _read_now(void* p);
+    void _write_now(void* p, int v);
+    bool _take(waitx* w);
+    void _drop(waitx* w, bool d);
+
   private:
     char* _buf;       // buffer
     uint32 _buf_size; // buffer size
@@ -536,6 +885,9 @@ class pipe_impl {
     bool _has_cv;
     xx::pipe::C _c;
     xx::pipe::D _d;
+    Sched* _owner; // the scheduler owning the channel, or shared_owner
+    uint8 _busy;   // the owner is working on the channel without the mutex
+    bool _nolock;  // the holder of the channel did not lock the mutex
 
     xx::mutex _m;
     xx::cv_t _cv;
@@ -547,6 +899,33 @@ class pipe_impl {
     uint8 _closed;
 };
 
+// the channel is used by more than one thread
+static Sched* const shared_owner = (Sched*)1;
+
+void pipe_impl::_lock_slow(Sched* s) {
+    Sched* o = atomic_load(&_owner, mo_relaxed);
+    if (o == 0 && s) {
+        o = atomic_cas(&_owner, (Sched*)0, s);
+        if (o == 0) { this->_lock(s); return; }
+    }
+
+    // Make the channel shared, and wait for the owner to leave it. The owner
+    // checks _owner after setting _busy, the seq_cst operations here ensure
+    // that either it sees the channel shared, or we see it busy.
+    //
+    // The owner never blocks with _busy set, it only moves elements in or out
+    // of the buffer, so the wait is as short as a critical section of _m, and
+    // happens only while the channel turns shared, as it stays shared. A
+    // scheduler thread just pauses the cpu, yielding the thread would stall
+    // all its coroutines.
+    if (o != shared_owner) atomic_store(&_owner, shared_owner);
+    for (int i = 0; atomic_load(&_busy); ++i) {
+        (s || i < 64) ? cpu_relax() : std::this_thread::yield();
+    }
+    _m.lock();
+    _nolock = false;
+}
+
 inline void pipe_impl::_read_block(void* p) {
     _d(p);
     _c(p, _buf + _rx, 1);
@@ -561,55 +940,75 @@ inline void pipe_impl::_write_block(void* p, int v) {
     if (_wx == _buf_size) _wx = 0;
 }
 
-void pipe_impl::read(void* p) {
-    auto sched = gSched;
-    _m.lock();
-
-    // buffer is neither empty nor full
-    if (_rx != _wx) {
-        this->_read_block(p);
-        _m.unlock();
-        goto done;
-    }
-
-    // buffer is full
-    if (_full) {
-        this->_read_block(p);
+// Take a waiter out of the queue, return false if it has timed out, or another
+// case of the select it belongs to has been done.
+inline bool pipe_impl::_take(waitx* w) {
+    if (w->sel) return atomic_bool_cas(&w->sel->state, st_wait, st_ready, mo_relaxed, mo_relaxed);
+    return _ms == (uint32)-1 || atomic_bool_cas(&w->state, st_wait, st_ready, mo_relaxed, mo_relaxed);
+}
 
-        while (!_wq.empty()) {
-            waitx* w = (waitx*) _wq.pop_front(); // wait for write
-            if (_ms == (uint32)-1 || atomic_bool_cas(&w->state, st_wait, st_ready, mo_relaxed, mo_relaxed)) {
-                this->_write_block(w->buf, w->x.v & 1);
-                if (w->x.v & 2) _d(w->buf);
-                w->x.done = 1;
-                if (w->co) {
-                    _m.unlock();
-                    w->co->sched->add_ready_task(w->co);
-                } else {
-                    xx::cv_notify_all(&_cv);
-                    _m.unlock();
-                }
-                goto done;
+// Drop a waiter that can't be taken, destroy the object in its buffer if @d is
+// true. A waiter of select is marked and left to the select to free.
+inline void pipe_impl::_drop(waitx* w, bool d) {
+    if (w->sel) { w->x.done = 3; return; }
+    if (d && (w->x.v & 2)) _d(w->buf);
+    co::free(w, w->len);
+}
 
-            } else { /* timeout */
-                if (w->x.v & 2) _d(w->buf);
-                co::free(w, w->len);
+// read an element when the buffer is not empty, called with the channel locked
+void pipe_impl::_read_one(void* p) {
+    this->_read_block(p);
+    if (!_full) return; // buffer was neither empty nor full
+
+    // buffer was full, move the element of a waiting writer into it
+    while (!_wq.empty()) {
+        waitx* w = (waitx*) _wq.pop_front(); // wait for write
+        if (this->_take(w)) {
+            this->_write_block(w->buf, w->x.v & 1);
+            if (w->x.v & 2) _d(w->buf);
+            w->x.done = 1;
+            if (w->co) {
+                w->co->sched->add_ready_task(w->co);
+            } else {
+                xx::cv_notify_all(&_cv);
             }
+            return;
+
+        } else { /* timeout */
+            this->_drop(w, true);
         }
+    }
+    _full = 0;
+}
 
-        _full = 0;
-        _m.unlock();
-        goto done;
+// read when _can_read() is true, called with the channel locked, and it will be unlocked
+void pipe_impl::_read_now(void* p) {
+    // buffer is empty and the channel is closed
+    if (_rx == _wx && !_full) {
+        this->_unlock();
+        g_done = false;
+        return;
+    }
+    this->_read_one(p);
+    this->_unlock();
+    g_done = true;
+}
+
+void pipe_impl::read(void* p) {
+    auto sched = gSched;
+    this->_lock(sched);
+    if (this->_can_read()) {
+        this->_read_now(p);
+        return;
     }
 
     // buffer is empty
-    if (this->is_closed()) { _m.unlock(); goto enod; }
     if (sched) {
         auto co = sched->running();
         waitx* w = this->create_waitx(co, p);
         w->x.v = (w->buf != p ? 0 : 2);
         _wq.push_back(w);
-        _m.unlock();
+        this->_unlock();
 
         co->waitx = (waitx_t*)w;
         if (_ms != (uint32)-1) sched->add_timer(_ms);
@@ -648,13 +1047,13 @@ void pipe_impl::read(void* p) {
             if (r || !atomic_bool_cas(&w->state, st_wait, st_timeout, mo_relaxed, mo_relaxed)) {
                 const auto x = w->x.done;
                 if (x) {
-                    _m.unlock();
+                    this->_unlock();
                     co::free(w, w->len);
                     if (x == 1) goto done;
                     goto enod; // x == 2, channel closed
                 }
             } else {
-                _m.unlock();
+                this->_unlock();
                 goto enod;
             }
         }
@@ -667,47 +1066,53 @@ void pipe_impl::read(void* p) {
     g_done = true;
 }
 
-void pipe_impl::write(void* p, int v) {
-    auto sched = gSched;
-    _m.lock();
-    if (this->is_closed()) { _m.unlock(); goto enod; }
-
-    // buffer is neither empty nor full
-    if (_rx != _wx) {
-        this->_write_block(p, v);
-        if (_rx == _wx) _full = 1;
-        _m.unlock();
-        goto done;
-    } 
-
-    // buffer is empty
-    if (!_full) {
+// write an element when the buffer is not full, called with the channel locked
+void pipe_impl::_write_one(void* p, int v) {
+    // buffer is empty, give the element to a waiting reader
+    if (_rx == _wx) {
         while (!_wq.empty()) {
             waitx* w = (waitx*) _wq.pop_front(); // wait for read
-            if (_ms == (uint32)-1 || atomic_bool_cas(&w->state, st_wait, st_ready, mo_relaxed, mo_relaxed)) {
+            if (this->_take(w)) {
                 w->x.done = 1;
                 if (w->co) {
                     if (w->x.v & 2) _d(w->buf);
                     _c(w->buf, p, v);
-                    _m.unlock();
                     w->co->sched->add_ready_task(w->co);
                 } else {
                     _d(w->buf);
                     _c(w->buf, p, v);
                     xx::cv_notify_all(&_cv);
-                    _m.unlock();
                 }
-                goto done;
+                return;
 
             } else { /* timeout */
-                co::free(w, w->len);
+                this->_drop(w, false);
             }
         }
+    }
 
-        this->_write_block(p, v);
-        if (_rx == _wx) _full = 1;
-        _m.unlock();
-        goto done;
+    this->_write_block(p, v);
+    if (_rx == _wx) _full = 1;
+}
+
+// write when _can_write() is true, called with the channel locked, and it will be unlocked
+void pipe_impl::_write_now(void* p, int v) {
+    if (this->is_closed()) {
+        this->_unlock();
+        g_done = false;
+        return;
+    }
+    this->_write_one(p, v);
+    this->_unlock();
+    g_done = true;
+}
+
+void pipe_impl::write(void* p, int v) {
+    auto sched = gSched;
+    this->_lock(sched);
+    if (this->_can_write()) {
+        this->_write_now(p, v);
+        return;
     }
     
     // buffer is full
@@ -721,7 +1126,7 @@ void pipe_impl::write(void* p, int v) {
             w->x.v = (uint8)v;
         }
         _wq.push_back(w);
-        _m.unlock();
+        this->_unlock();
 
         co->waitx = (waitx_t*)w;
         if (_ms != (uint32)-1) sched->add_timer(_ms);
@@ -750,12 +1155,12 @@ void pipe_impl::write(void* p, int v) {
             if (r || !atomic_bool_cas(&w->state, st_wait, st_timeout, mo_relaxed, mo_relaxed)) {
                 if (w->x.done) {
                     assert(w->x.done == 1);
-                    _m.unlock();
+                    this->_unlock();
                     co::free(w, w->len);
                     goto done;
                 }
             } else {
-                _m.unlock();
+                this->_unlock();
                 goto enod;
             }
         }
@@ -768,14 +1173,59 @@ void pipe_impl::write(void* p, int v) {
     g_done = true;
 }
 
+// Take the elements in the buffer with a single lock. If it is empty, wait for
+// the first element like read(), and then take those buffered since.
+size_t pipe_impl::read_n(char* p, size_t n) {
+    if (n == 0) { g_done = false; return 0; }
+    const auto sched = gSched;
+    size_t k = 0;
+    this->_lock(sched);
+    if (_rx == _wx && !_full) {
+        if (!this->is_closed()) {
+            this->_unlock();
+            this->read(p);
+            if (!g_done) return 0;
+            k = 1;
+            if (k == n) return k;
+            this->_lock(sched);
+        }
+    }
+    for (; k < n && (_rx != _wx || _full); ++k) this->_read_one(p + k * _blk_size);
+    this->_unlock();
+    g_done = k > 0;
+    return k;
+}
+
+// Write as many elements as the buffer can hold with a single lock, and wait
+// like write() only when the buffer is full.
+size_t pipe_impl::write_n(char* p, size_t n, int v) {
+    const auto sched = gSched;
+    size_t k = 0;
+    while (k < n) {
+        this->_lock(sched);
+        if (!this->is_closed()) {
+            for (; k < n && !_full; ++k) this->_write_one(p + k * _blk_size, v);
+        }
+        this->_unlock();
+        if (k == n) break;
+
+        // buffer is full, or the channel is closed
+        this->write(p + k * _blk_size, v);
+        if (!g_done) break;
+        ++k;
+    }
+    g_done = k == n;
+    return k;
+}
+
 void pipe_impl::close() {
     const auto x = atomic_cas(&_closed, 0, 1, mo_relaxed, mo_relaxed);
     if (x == 0) {
-        xx::mutex_guard g(_m);
+        this->_lock(gSched);
         if (_rx == _wx && !_full) { /* empty */
             while (!_wq.empty()) {
                 waitx* w = (waitx*) _wq.pop_front(); // wait for read
-                if (atomic_bool_cas(&w->state, st_wait, st_ready, mo_relaxed, mo_relaxed)) {
+                if (w->sel ? this->_take(w) : atomic_bool_cas(&w->state, st_wait, st_ready, mo_relaxed, mo_relaxed)) {
                     w->x.done = 2; // channel closed
                     if (w->co) {
                         w->co->sched->add_ready_task(w->co);
@@ -783,10 +1233,11 @@ void pipe_impl::close() {
                         xx::cv_notify_all(&_cv);
                     }
                 } else {
-                    co::free(w, w->len);
+                    this->_drop(w, false);
                 }
             }
         }
+        this->_unlock();
         atomic_store(&_closed, 2, mo_relaxed);
 
     } else if (x == 1) {
@@ -794,6 +1245,104 @@ void pipe_impl::close() {
     }
 }
 
+// The select waits in the queues of all the channels, with a waiter for each
+// case. The waiters share the state of the waitx_t of the coroutine, only the
+// one that changes it from st_wait to st_ready is done. The other waiters are
+// removed from the queues by the select, or marked as dropped by the channels.
+int pipe_impl::select(const select_case* cs, size_t n, uint32 ms) {
+    const auto sched = gSched;
+    CHECK(sched) << "must be called in coroutine..";
+    if (n == 0) return -1;
+
+    // start from a different case each time, so that no case starves
+    const size_t o = g_sel++ % n;
+    for (size_t k = 0; k < n; ++k) {
+        const size_t i = o + k < n ? o + k : o + k - n;
+        auto c = (pipe_impl*) cs[i].c->_p;
+        c->_lock(sched);
+        if (cs[i].op == 0 ? c->_can_read() : c->_can_write()) {
+            cs[i].op == 0 ? c->_read_now(cs[i].p) : c->_write_now(cs[i].p, cs[i].op - 1);
+            return (int)i;
+        }
+        c->_unlock();
+    }
+    if (ms == 0) return -1;
+
+    auto co = sched->running();
+    waitx_t* const x = make_waitx(co);
+    waitx* b[8];
+    waitx** const ws = n <= 8 ? b : (waitx**) co::alloc(n * sizeof(waitx*));
+    memset(ws, 0, n * sizeof(waitx*));
+    int r = -1;
+    bool wait = true;
+
+    for (size_t k = 0; k < n; ++k) {
+        const size_t i = o + k < n ? o + k : o + k - n;
+        auto c = (pipe_impl*) cs[i].c->_p;
+        void* const p = cs[i].p;
+        c->_lock(sched);
+        if (cs[i].op == 0 ? c->_can_read() : c->_can_write()) {
+            // it can be done now, unless another case has been done
+            if (atomic_bool_cas(&x->state, st_wait, st_ready, mo_relaxed, mo_relaxed)) {
+                cs[i].op == 0 ? c->_read_now(p) : c->_write_now(p, cs[i].op - 1);
+                r = (int)i;
+                wait = false;
+            } else {
+                c->_unlock();
+            }
+            break;
+        }
+
+        waitx* w = c->create_waitx(co, p);
+        w->sel = x;
+        if (cs[i].op == 0) {
+            w->x.v = (w->buf != p ? 0 : 2);
+        } else if (w->buf != p) { /* p is on the coroutine stack */
+            c->_c(w->buf, p, cs[i].op - 1);
+            w->x.v = 1 | 2;
+        } else {
+            w->x.v = (uint8)(cs[i].op - 1);
+        }
+        c->_wq.push_back(w);
+        c->_unlock();
+        ws[i] = w;
+    }
+
+    if (wait) {
+        co->waitx = x;
+        if (ms != (uint32)-1) sched->add_timer(ms);
+        const bool ok = sched->yield_cancelable();
+        co->waitx = 0;
+        if (!ok) r = -2; // timeout or cancelled
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        waitx* const w = ws[i];
+        if (!w) continue;
+        auto c = (pipe_impl*) cs[i].c->_p;
+        const uint8 done = atomic_load(&w->x.done, mo_relaxed);
+        if (r == -1 && (done == 1 || done == 2)) {
+            r = (int)i;
+            if (cs[i].op == 0 && w->x.done == 1 && w->buf != cs[i].p) {
+                c->_d(cs[i].p);
+                c->_c(cs[i].p, w->buf, 1); // mv
+                c->_d(w->buf);
+            }
+            g_done = w->x.done == 1;
+        } else {
+            c->_lock(sched);
+            if (w->x.done == 0) c->_wq.erase(w);
+            c->_unlock();
+            if (cs[i].op != 0 && (w->x.v & 2)) c->_d(w->buf);
+        }
+        co::free(w, w->len);
+    }
+
+    if (ws != b) co::free(ws, n * sizeof(waitx*));
+    co::free(x, sizeof(waitx_t));
+    return r >= 0 ? r : -1;
+}
+
 pipe::pipe(uint32 buf_size, uint32 blk_size, uint32 ms, pipe::C&& c, pipe::D&& d) {
     _p = co::alloc(sizeof(pipe_impl), co::cache_line_size);
     new (_p) pipe_impl(buf_size, blk_size, ms, std::move(c), std::move(d));
@@ -820,6 +1369,14 @@ void pipe::write(void* p, int v) const {
     god::cast<pipe_impl*>(_p)->write(p, v);
 }
 
+size_t pipe::read_n(void* p, size_t n) const {
+    return god::cast<pipe_impl*>(_p)->read_n((char*)p, n);
+}
+
+size_t pipe::write_n(void* p, size_t n, int v) const {
+    return god::cast<pipe_impl*>(_p)->write_n((char*)p, n, v);
+}
+
 bool pipe::done() const {
     return god::cast<pipe_impl*>(_p)->done();
 }
@@ -832,6 +1389,212 @@ bool pipe::is_closed() const {
     return god::cast<pipe_impl*>(_p)->is_closed();
 }
 
+// A ring buffer for one writer and one reader. The write and read positions
+// increase forever, and each of them is written only by one side. A side that
+// has to wait parks a waiter in _ww or _rw, and the other side wakes it up
+// after moving its position. The seq_cst operations on both sides ensure that
+// either the waiter sees the new position, or the other side sees the waiter.
+class spsc_pipe_impl {
+  public:
+    spsc_pipe_impl(uint32 cap, uint32 blk_size, uint32 ms, pipe::C&& c, pipe::D&& d)
+        : _cap(1), _blk_size(blk_size), _ms(ms), _c(std::move(c)), _d(std::move(d)),
+          _rw(0), _ww(0), _refn(1), _closed(0), _wx(0), _rxc(0), _rx(0), _wxc(0) {
+        while (_cap < cap) _cap <<= 1;
+        _buf = (char*) co::alloc(_cap * _blk_size);
+    }
+
+    ~spsc_pipe_impl() {
+        for (uint32 x = _rx; x != _wx; ++x) _d(this->_slot(x));
+        co::free(_buf, _cap * _blk_size);
+    }
+
+    void read(void* p);
+    void write(void* p, int v);
+    bool done() const { return g_done; }
+    void close();
+    bool is_closed() const { return atomic_load(&_closed, mo_relaxed) != 0; }
+
+    void ref() { atomic_inc(&_refn, mo_relaxed); }
+    uint32 unref() { return atomic_dec(&_refn, mo_acq_rel); }
+
+  private:
+    // a waiter in non-coroutine threads
+    struct thread_waitx : waitx_t {
+        sync_event_impl ev;
+    };
+
+    char* _slot(uint32 x) const { return _buf + (x & (_cap - 1)) * _blk_size; }
+    bool _wait(waitx_t** q, uint32* pos, uint32 x);
+    static void _wake(waitx_t** q);
+
+  private:
+    char* _buf;
+    uint32 _cap;      // capacity, power of 2
+    uint32 _blk_size; // block size
+    uint32 _ms;       // timeout in milliseconds
+    xx::pipe::C _c;
+    xx::pipe::D _d;
+    waitx_t* _rw; // the reader waiting for an element
+    waitx_t* _ww; // the writer waiting for space
+    uint32 _refn;
+    uint8 _closed;
+
+    // the writer side
+    alignas(64) uint32 _wx; // write pos
+    uint32 _rxc;            // read pos cached by the writer
+    // the reader side
+    alignas(64) uint32 _rx; // read pos
+    uint32 _wxc;            // write pos cached by the reader
+};
+
+// Park a waiter in @q until the position @pos is not @x, or the channel is
+// closed. Return false on timeout.
+bool spsc_pipe_impl::_wait(waitx_t** q, uint32* pos, uint32 x) {
+    const auto sched = gSched;
+    if (sched) {
+        auto co = sched->running();
+        waitx_t* w = make_waitx(co);
+        atomic_store(q, w);
+        if (atomic_load(pos) != x || atomic_load(&_closed)) {
+            if (atomic_bool_cas(q, w, (waitx_t*)0)) { co::free(w, sizeof(*w)); return true; }
+            // the other side has taken the waiter, and will wake us up soon
+        }
+
+        co->waitx = w;
+        if (_ms != (uint32)-1) sched->add_timer(_ms);
+        sched->yield();
+        co->waitx = 0;
+        if (sched->timeout()) {
+            // the waiter will be freed by the other side if it has been taken
+            if (atomic_bool_cas(q, w, (waitx_t*)0)) co::free(w, sizeof(*w));
+            return false;
+        }
+        co::free(w, sizeof(*w));
+        return true;
+
+    } else {
+        thread_waitx* w = (thread_waitx*) make_waitx(0, sizeof(thread_waitx));
+        new (&w->ev) sync_event_impl(false, false);
+        bool r = false; // signaled
+        atomic_store(q, (waitx_t*)w);
+        if (atomic_load(pos) == x && !atomic_load(&_closed)) {
+            if (_ms == (uint32)-1) {
+                w->ev.wait();
+                r = true;
+            } else {
+                r = w->ev.wait(_ms);
+            }
+        }
+        if (!r && !atomic_bool_cas(q, (waitx_t*)w, (waitx_t*)0)) {
+            // the other side has taken the waiter, wait for the signal before freeing it
+            w->ev.wait();
+            r = true;
+        }
+        w->ev.~sync_event_impl();
+        co::free(w, sizeof(*w));
+        return r || atomic_load(pos) != x || this->is_closed();
+    }
+}
+
+void spsc_pipe_impl::_wake(waitx_t** q) {
+    waitx_t* const w = atomic_swap(q, (waitx_t*)0);
+    if (!w) return;
+    if (w->co) {
+        if (atomic_bool_cas(&w->state, st_wait, st_ready, mo_relaxed, mo_relaxed)) {
+            w->co->sched->add_ready_task(w->co);
+        } else { /* timeout */
+            co::free(w, sizeof(*w));
+        }
+    } else {
+        ((thread_waitx*)w)->ev.signal();
+    }
+}
+
+void spsc_pipe_impl::read(void* p) {
+    const uint32 x = _rx;
+    while (_wxc == x) {
+        _wxc = atomic_load(&_wx, mo_acquire);
+        if (_wxc != x) break;
+        if (this->is_closed()) {
+            // an element may be written before the channel was closed
+            _wxc = atomic_load(&_wx, mo_acquire);
+            if (_wxc != x) break;
+            g_done = false;
+            return;
+        }
+        if (!this->_wait(&_rw, &_wx, x)) { g_done = false; return; }
+    }
+
+    char* const b = this->_slot(x);
+    _d(p);
+    _c(p, b, 1);
+    _d(b);
+    atomic_store(&_rx, x + 1);
+    if (atomic_load(&_ww)) _wake(&_ww);
+    g_done = true;
+}
+
+void spsc_pipe_impl::write(void* p, int v) {
+    const uint32 x = _wx;
+    while (x - _rxc == _cap) {
+        _rxc = atomic_load(&_rx, mo_acquire);
+        if (x - _rxc != _cap) break;
+        if (this->is_closed()) { g_done = false; return; }
+        if (!this->_wait(&_ww, &_rx, _rxc)) { g_done = false; return; }
+    }
+    if (this->is_closed()) { g_done = false; return; }
+
+    _c(this->_slot(x), p, v);
+    atomic_store(&_wx, x + 1);
+    if (atomic_load(&_rw)) _wake(&_rw);
+    g_done = true;
+}
+
+void spsc_pipe_impl::close() {
+    if (atomic_swap(&_closed, (uint8)1) == 0) {
+        _wake(&_rw);
+        _wake(&_ww);
+    }
+}
+
+spsc_pipe::spsc_pipe(uint32 cap, uint32 blk_size, uint32 ms, pipe::C&& c, pipe::D&& d) {
+    _p = co::alloc(sizeof(spsc_pipe_impl), co::cache_line_size);
+    new (_p) spsc_pipe_impl(cap, blk_size, ms, std::move(c), std::move(d));
+}
+
+spsc_pipe::spsc_pipe(const spsc_pipe& p) : _p(p._p) {
+    if (_p) god::cast<spsc_pipe_impl*>(_p)->ref();
+}
+
+spsc_pipe::~spsc_pipe() {
+    const auto p = (spsc_pipe_impl*)_p;
+    if (p && p->unref() == 0) {
+        p->~spsc_pipe_impl();
+        co::free(_p, sizeof(spsc_pipe_impl));
+        _p = 0;
+    }
+}
+
+void spsc_pipe::read(void* p) const {
+    god::cast<spsc_pipe_impl*>(_p)->read(p);
+}
+
+void spsc_pipe::write(void* p, int v) const {
+    god::cast<spsc_pipe_impl*>(_p)->write(p, v);
+}
+
+bool spsc_pipe::done() const {
+    return god::cast<spsc_pipe_impl*>(_p)->done();
+}
+
+void spsc_pipe::close() const {
+    god::cast<spsc_pipe_impl*>(_p)->close();
+}
+
+bool spsc_pipe::is_closed() const {
+    return god::cast<spsc_pipe_impl*>(_p)->is_closed();
+}
+
 class pool_impl {
   public:
     typedef co::vector<void*> V;
@@ -924,6 +1687,202 @@ inline size_t pool_impl::size() const {
     return _pools[s->id()].size();
 }
 
+// State of a task group, shared by the task_group and its children. Children
+// running are registered here, so that they can be cancelled. Each child keeps
+// its position in @cos, and a child removed is replaced by the last one.
+struct group_t {
+    struct child_t {
+        Coroutine* co;
+        uint32* pos; // position of the child in cos
+    };
+
+    group_t() : ev(false, false), refn(1), n(0), err(0), cancelled(false) {}
+    ~group_t() = default;
+
+    void ref() { atomic_inc(&refn, mo_relaxed); }
+
+    // cancel the children running, @e is the error code if no error before
+    void cancel(int e);
+
+    xx::mutex m;
+    co::vector<child_t> cos; // children running
+    event_impl ev;           // signaled when the last child is done
+    uint32 refn;
+    uint32 n;                // number of children not done
+    int err;                 // error code of the first failure
+    bool cancelled;
+};
+
+void group_t::cancel(int e) {
+    xx::mutex_guard g(m);
+    if (err == 0) atomic_store(&err, e, mo_relaxed);
+    if (cancelled) return;
+    atomic_store(&cancelled, true, mo_relaxed);
+    for (size_t i = 0; i < cos.size(); ++i) {
+        Coroutine* const co = cos[i].co;
+        this->ref();
+        co->sched->cancel(co, this);
+    }
+}
+
+void unref_group(group_t* g) {
+    if (atomic_dec(&g->refn, mo_acq_rel) == 0) {
+        g->~group_t();
+        co::free(g, sizeof(group_t));
+    }
+}
+
+bool group_enter(void* p, uint32* pos) {
+    const auto g = (group_t*)p;
+    const auto sched = gSched;
+    CHECK(sched) << "must be called in coroutine..";
+    Coroutine* const co = sched->running();
+    xx::mutex_guard l(g->m);
+    if (g->cancelled) return false;
+    *pos = (uint32)g->cos.size();
+    g->cos.push_back(group_t::child_t{ co, pos });
+    co->group = g;
+    return true;
+}
+
+struct fnode_t;
+
+// State shared by futures and promises, the value follows it at offset H.
+struct fstate_t {
+    enum : uint8 { pending = 0, setting = 1, done = 2, broken = 3 };
+
+    fstate_t(uint32 n, void (*dtor)(void*))
+        : ev(true, false), nodes(0), refn(1), pn(1), n(n), st(pending), dtor(dtor) {
+    }
+    ~fstate_t() = default;
+
+    void* data() { return (char*)this + H; }
+    static const size_t H;
+
+    event_impl ev;      // manual-reset, signaled when the state is ready
+    fnode_t* nodes;     // nodes of join states waiting for this one, R if ready
+    uint32 refn;        // references of futures and promises
+    uint32 pn;          // references of promises
+    uint32 n;           // size of the value
+    uint8 st;
+    void (*dtor)(void*); // to destroy the value
+};
+
+const size_t fstate_t::H = god::align_up<16>(sizeof(fstate_t));
+
+// A join state is that of a future<void> (all) or future<size_t> (any), it
+// keeps a node for each future joined in the same block after the value.
+struct fnode_t {
+    fnode_t* next;
+    fstate_t* j; // the join state
+    size_t i;    // index of the future joined
+};
+
+struct join_t {
+    uint32 left; // futures not ready yet
+    bool any;
+    fnode_t nodes[];
+};
+
+static fnode_t* const R = (fnode_t*)1;
+
+inline join_t* join_of(fstate_t* j) {
+    return (join_t*)((char*)j->data() + 16);
+}
+
+inline fstate_t* make_fstate(size_t n, void (*dtor)(void*)) {
+    void* p = co::alloc(fstate_t::H + n, co::cache_line_size);
+    return new (p) fstate_t((uint32)n, dtor);
+}
+
+void unref_fstate(fstate_t* s) {
+    if (atomic_dec(&s->refn, mo_acq_rel) == 0) {
+        if (s->st == fstate_t::done && s->dtor) s->dtor(s->data());
+        const size_t n = fstate_t::H + s->n;
+        s->~fstate_t();
+        co::free(s, n);
+    }
+}
+
+void run_node(fnode_t* x);
+
+// make the state ready, wake up the waiters and run the nodes of join states
+void finish_fstate(fstate_t* s, uint8 st) {
+    atomic_store(&s->st, st, mo_release);
+    s->ev.signal();
+    fnode_t* x = atomic_swap(&s->nodes, R, mo_acq_rel);
+    while (x) {
+        fnode_t* const next = x->next;
+        run_node(x);
+        x = next;
+    }
+}
+
+// a future joined is ready, each node holds a reference of the join state
+void run_node(fnode_t* x) {
+    fstate_t* const j = x->j;
+    join_t* const o = join_of(j);
+    if (o->any) {
+        if (atomic_bool_cas(&j->st, fstate_t::pending, fstate_t::setting, mo_acquire, mo_relaxed)) {
+            *(size_t*)j->data() = x->i;
+            finish_fstate(j, fstate_t::done);
+        }
+    } else if (atomic_dec(&o->left, mo_acq_rel) == 0) {
+        atomic_store(&j->st, fstate_t::setting, mo_relaxed);
+        finish_fstate(j, fstate_t::done);
+    }
+    unref_fstate(j);
+}
+
+void* join_make(size_t n, bool any) {
+    fstate_t* const j = make_fstate(16 + sizeof(join_t) + n * sizeof(fnode_t), 0);
+    join_t* const o = join_of(j);
+    o->left = (uint32)n;
+    o->any = any;
+    j->refn += (uint32)n;
+    if (n == 0) finish_fstate(j, any ? fstate_t::broken : fstate_t::done);
+    return j;
+}
+
+void join_add(void* p, size_t i, const future_base& f) {
+    fstate_t* const j = (fstate_t*)p;
+    fnode_t* const x = &join_of(j)->nodes[i];
+    x->j = j;
+    x->i = i;
+
+    fstate_t* const s = (fstate_t*)f._p;
+    assert(s);
+    fnode_t* h = atomic_load(&s->nodes, mo_acquire);
+    while (h != R) {
+        x->next = h;
+        fnode_t* const o = h;
+        h = atomic_cas(&s->nodes, h, x, mo_acq_rel, mo_acquire);
+        if (h == o) return;
+    }
+    run_node(x);
+}
+
+void group_leave(void* p, uint32* pos, bool ok) {
+    const auto g = (group_t*)p;
+    Coroutine* const co = gSched->running();
+    const int e = ok ? 0 : co::error();
+    if (co->group) {
+        xx::mutex_guard l(g->m);
+        auto& v = g->cos;
+        const uint32 i = *pos;
+        if (i + 1 < v.size()) {
+            v[i] = v.back();
+            *v[i].pos = i;
+        }
+        v.pop_back();
+        co->group = 0;
+        co->cancelled = 0;
+    }
+    if (!ok) g->cancel(e ? e : -1);
+    if (atomic_dec(&g->n, mo_acq_rel) == 0) g->ev.signal();
+    unref_group(g);
+}
+
 } // xx
 
 mutex::mutex() {
@@ -957,6 +1916,80 @@ bool mutex::try_lock() const {
 }
 
 
+shared_mutex::shared_mutex() {
+    _p = co::alloc(sizeof(xx::shared_mutex_impl), co::cache_line_size);
+    new (_p) xx::shared_mutex_impl();
+}
+
+shared_mutex::shared_mutex(const shared_mutex& m) : _p(m._p) {
+    if (_p) god::cast<xx::shared_mutex_impl*>(_p)->ref();
+}
+
+shared_mutex::~shared_mutex() {
+    const auto p = (xx::shared_mutex_impl*)_p;
+    if (p && p->unref() == 0) {
+        p->~shared_mutex_impl();
+        co::free(_p, sizeof(xx::shared_mutex_impl));
+        _p = 0;
+    }
+}
+
+void shared_mutex::lock() const {
+    god::cast<xx::shared_mutex_impl*>(_p)->lock();
+}
+
+void shared_mutex::unlock() const {
+    god::cast<xx::shared_mutex_impl*>(_p)->unlock();
+}
+
+bool shared_mutex::try_lock() const {
+    return god::cast<xx::shared_mutex_impl*>(_p)->try_lock();
+}
+
+void shared_mutex::lock_shared() const {
+    god::cast<xx::shared_mutex_impl*>(_p)->lock_shared();
+}
+
+void shared_mutex::unlock_shared() const {
+    god::cast<xx::shared_mutex_impl*>(_p)->unlock_shared();
+}
+
+bool shared_mutex::try_lock_shared() const {
+    return god::cast<xx::shared_mutex_impl*>(_p)->try_lock_shared();
+}
+
+
+semaphore::semaphore(uint32 n) {
+    _p = co::alloc(sizeof(xx::semaphore_impl), co::cache_line_size);
+    new (_p) xx::semaphore_impl(n);
+}
+
+semaphore::semaphore(const semaphore& s) : _p(s._p) {
+    if (_p) god::cast<xx::semaphore_impl*>(_p)->ref();
+}
+
+semaphore::~semaphore() {
+    const auto p = (xx::semaphore_impl*)_p;
+    if (p && p->unref() == 0) {
+        p->~semaphore_impl();
+        co::free(_p, sizeof(xx::semaphore_impl));
+        _p = 0;
+    }
+}
+
+void semaphore::acquire() const {
+    god::cast<xx::semaphore_impl*>(_p)->acquire();
+}
+
+bool semaphore::try_acquire() const {
+    return god::cast<xx::semaphore_impl*>(_p)->try_acquire();
+}
+
+void semaphore::release(uint32 n) const {
+    god::cast<xx::semaphore_impl*>(_p)->release(n);
+}
+
+
 event::event(bool manual_reset, bool signaled) {
     _p = co::alloc(sizeof(xx::event_impl), co::cache_line_size);
     new (_p) xx::event_impl(manual_reset, signaled);
@@ -976,7 +2009,7 @@ event::~event() {
 }
 
 bool event::wait(uint32 ms) const {
-    return god::cast<xx::event_impl*>(_p)->wait(ms);
+    return god::cast<xx::event_impl*>(_p)->wait(ms, true);
 }
 
 void event::signal() const {
@@ -1052,6 +2085,151 @@ void wait_group::wait() const {
 }
 
 
+task_group::task_group() {
+    _p = co::alloc(sizeof(xx::group_t), co::cache_line_size);
+    new (_p) xx::group_t();
+}
+
+task_group::~task_group() {
+    const auto g = (xx::group_t*)_p;
+    if (g) {
+        if (atomic_load(&g->n, mo_acquire) != 0) {
+            g->cancel(ECANCELED);
+            this->wait();
+        }
+        xx::unref_group(g);
+        _p = 0;
+    }
+}
+
+void task_group::_go(Closure* cb) {
+    const auto g = (xx::group_t*)_p;
+    g->ref();
+    atomic_inc(&g->n, mo_relaxed);
+    co::go(cb);
+}
+
+void task_group::cancel() const {
+    ((xx::group_t*)_p)->cancel(ECANCELED);
+}
+
+bool task_group::cancelled() const {
+    return atomic_load(&((xx::group_t*)_p)->cancelled, mo_relaxed);
+}
+
+bool task_group::wait(uint32 ms) const {
+    const auto g = (xx::group_t*)_p;
+    const int64 end = ms != (uint32)-1 ? now::ms() + ms : 0;
+    bool r = true;
+    while (atomic_load(&g->n, mo_acquire) != 0) {
+        uint32 t = (uint32)-1;
+        if (ms != (uint32)-1) {
+            const int64 x = end - now::ms();
+            if (x <= 0) { r = false; break; }
+            t = (uint32)x;
+        }
+        if (!g->ev.wait(t, true)) { r = false; break; }
+    }
+
+    if (!r) {
+        g->cancel(co::cancelled() ? ECANCELED : ETIMEDOUT);
+        while (atomic_load(&g->n, mo_acquire) != 0) g->ev.wait((uint32)-1);
+    }
+    return atomic_load(&g->err, mo_acquire) == 0;
+}
+
+int task_group::error() const {
+    return atomic_load(&((xx::group_t*)_p)->err, mo_acquire);
+}
+
+namespace xx {
+
+future_base::~future_base() {
+    if (_p) {
+        unref_fstate((fstate_t*)_p);
+        _p = 0;
+    }
+}
+
+future_base::future_base(const future_base& f) : _p(f._p) {
+    if (_p) atomic_inc(&((fstate_t*)_p)->refn, mo_relaxed);
+}
+
+bool future_base::ready() const {
+    return atomic_load(&((fstate_t*)_p)->st, mo_acquire) >= fstate_t::done;
+}
+
+bool future_base::has_value() const {
+    return atomic_load(&((fstate_t*)_p)->st, mo_acquire) == fstate_t::done;
+}
+
+void future_base::wait() const {
+    if (!this->ready()) ((fstate_t*)_p)->ev.wait((uint32)-1);
+}
+
+bool future_base::wait(uint32 ms) const {
+    return this->ready() || ((fstate_t*)_p)->ev.wait(ms, true);
+}
+
+void* future_base::data() const {
+    return ((fstate_t*)_p)->data();
+}
+
+promise_base::promise_base(size_t n, void (*dtor)(void*)) {
+    _p = make_fstate(n, dtor);
+}
+
+promise_base::~promise_base() {
+    const auto s = (fstate_t*)_p;
+    if (s) {
+        if (atomic_dec(&s->pn, mo_acq_rel) == 0 &&
+            atomic_bool_cas(&s->st, fstate_t::pending, fstate_t::setting, mo_acquire, mo_relaxed)) {
+            finish_fstate(s, fstate_t::broken);
+        }
+        unref_fstate(s);
+        _p = 0;
+    }
+}
+
+promise_base::promise_base(const promise_base& p) : _p(p._p) {
+    if (_p) {
+        atomic_inc(&((fstate_t*)_p)->refn, mo_relaxed);
+        atomic_inc(&((fstate_t*)_p)->pn, mo_relaxed);
+    }
+}
+
+void* promise_base::ref() const {
+    atomic_inc(&((fstate_t*)_p)->refn, mo_relaxed);
+    return _p;
+}
+
+bool promise_base::lock() const {
+    const auto s = (fstate_t*)_p;
+    return atomic_bool_cas(&s->st, fstate_t::pending, fstate_t::setting, mo_acquire, mo_relaxed);
+}
+
+void* promise_base::data() const {
+    return ((fstate_t*)_p)->data();
+}
+
+void promise_base::set() const {
+    finish_fstate((fstate_t*)_p, fstate_t::done);
+}
+
+} // xx
+
+bool cancelled() {
+    const auto s = xx::gSched;
+    const auto co = s ? s->running() : 0;
+    return co && co->group && atomic_load(&co->group->cancelled, mo_relaxed);
+}
+
+
+int select(const select_case* cases, size_t n, uint32 ms) {
+    return xx::pipe_impl::select(cases, n, ms);
+}
+
+
 pool::pool() {
     _p = co::alloc(sizeof(xx::pool_impl), co::cache_line_size);
     new (_p) xx::pool_impl();
@@ -9,13 +9,10 @@ Epoll::Epoll(int sched_id) : _signaled(0), _sched_id(sched_id) {
     CHECK_NE(_ep, -1) << "epoll create error: " << co::strerror();
     co::set_cloexec(_ep);
 
-    CHECK_NE(__sys_api(pipe)(_pipe_fds), -1) << "create pipe error: " << co::strerror();
-    co::set_cloexec(_pipe_fds[0]);
-    co::set_cloexec(_pipe_fds[1]);
-
-    // register ev_read for _pipe_fds[0] to this epoll.
-    co::set_nonblock(_pipe_fds[0]);
-    CHECK(this->add_ev_read(_pipe_fds[0], 0));
+    // a single eventfd replaces the pipe, register ev_read for it to this epoll.
+    _efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    CHECK_NE(_efd, -1) << "create eventfd error: " << co::strerror();
+    CHECK(this->add_ev_read(_efd, 0));
 
     _ev = (epoll_event*) ::calloc(1024, sizeof(epoll_event));
 }
@@ -126,23 +123,18 @@ inline void closesocket(int& fd) {
 
 void Epoll::close() {
     co::closesocket(_ep);
-    co::closesocket(_pipe_fds[0]);
-    co::closesocket(_pipe_fds[1]);
+    co::closesocket(_efd);
 }
 
 void Epoll::handle_ev_pipe() {
-    int32 dummy;
+    uint64 v;
     while (true) {
-        int r = __sys_api(read)(_pipe_fds[0], &dummy, 4);
-        if (r != -1) {
-            if (r < 4) break;
-            continue;
-        } else {
-            if (errno == EWOULDBLOCK || errno == EAGAIN) break;
-            if (errno == EINTR) continue;
-            ELOG << "pipe read error: " << co::strerror() << ", fd: " << _pipe_fds[0];
-            break;
-        }
+        const int r = (int) __sys_api(read)(_efd, &v, sizeof(v));
+        if (r != -1) break; // the counter of eventfd is reset to 0 by one read
+        if (errno == EWOULDBLOCK || errno == EAGAIN) break;
+        if (errno == EINTR) continue;
+        ELOG << "eventfd read error: " << co::strerror() << ", fd: " << _efd;
+        break;
     }
     atomic_store(&_signaled, 0, mo_release);
 }
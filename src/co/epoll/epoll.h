@@ -6,6 +6,7 @@
 #include "../hook.h"
 #include "../sock_ctx.h"
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 
 namespace co {
 
@@ -36,23 +37,24 @@ class Epoll {
         return __sys_api(epoll_wait)(_ep, _ev, 1024, ms);
     }
 
-    // write one byte to the pipe to wake up the epoll.
-    void signal(char c = 'x') {
+    // write to the eventfd to wake up the epoll.
+    void signal() {
         if (atomic_bool_cas(&_signaled, 0, 1, mo_acq_rel, mo_acquire)) {
-            const int r = (int) __sys_api(write)(_pipe_fds[1], &c, 1);
-            ELOG_IF(r != 1) << "pipe write error..";
+            const uint64 v = 1;
+            const int r = (int) __sys_api(write)(_efd, &v, sizeof(v));
+            ELOG_IF(r != sizeof(v)) << "eventfd write error: " << co::strerror();
         }
     }
 
     const epoll_event& operator[](int i)   const { return _ev[i]; }
     int user_data(const epoll_event& ev)         { return ev.data.fd; }
-    bool is_ev_pipe(const epoll_event& ev) const { return ev.data.fd == _pipe_fds[0]; }
+    bool is_ev_pipe(const epoll_event& ev) const { return ev.data.fd == _efd; }
     void handle_ev_pipe();
     void close();
 
   private:
     int _ep;
-    int _pipe_fds[2];
+    int _efd; // eventfd for waking up the epoll
     int _signaled;
     int _sched_id;
     epoll_event* _ev;
@@ -503,7 +503,7 @@ int _hook(accept)(int fd, struct sockaddr* addr, socklen_t* addrlen) {
             if (r != -1) goto end;
 
             if (errno == EWOULDBLOCK || errno == EAGAIN) {
-                ev.wait();
+                if (!ev.wait()) { r = -1; goto end; }
             } else if (errno != EINTR) {
                 goto end;
             }
@@ -757,9 +757,12 @@ int _hook(poll)(struct pollfd* fds, nfds_t nfds, int ms) {
             }
 
             if (ms > 0) sched->add_timer(ms);
-            sched->yield();
+            const bool ok = sched->yield_cancelable();
             sched->del_io_event(fd);
-            if (ms > 0 && sched->timeout()) { r = 0; goto end; }
+            if (!ok) {
+                if (sched->running()->cancelled) { r = -1; errno = ECANCELED; }
+                goto end;
+            }
 
             fds[0].revents = fds[0].events;
             r = 1; goto end;
@@ -767,7 +770,7 @@ int _hook(poll)(struct pollfd* fds, nfds_t nfds, int ms) {
     } while (0);
 
     if (nfds == 0 && t != -1) {
-        sched->sleep(t);
+        if (!sched->sleep_cancelable(t)) { r = -1; errno = ECANCELED; }
         goto end;
     }
 
@@ -775,7 +778,7 @@ int _hook(poll)(struct pollfd* fds, nfds_t nfds, int ms) {
     do {
         r = __sys_api(poll)(fds, nfds, 0);
         if (r != 0 || t == 0) goto end;
-        sched->sleep(t > x ? x : t);
+        if (!sched->sleep_cancelable(t > x ? x : t)) { r = -1; errno = ECANCELED; goto end; }
         if (t != -1) t = (t > x ? t - x : 0);
         if (x < 16) x <<= 1;
     } while (true);
@@ -814,8 +817,8 @@ int _hook(select)(int nfds, fd_set* rs, fd_set* ws, fd_set* es, struct timeval*
     }
 
     if ((nfds == 0 || (!rs && !ws && !es)) && ms > 0) {
-        sched->sleep(ms);
-        r = 0;
+        r = sched->sleep_cancelable(ms) ? 0 : -1;
+        if (r != 0) errno = ECANCELED;
         goto end;
     }
 
@@ -831,7 +834,7 @@ int _hook(select)(int nfds, fd_set* rs, fd_set* ws, fd_set* es, struct timeval*
         do {
             r = __sys_api(select)(nfds, rs, ws, es, &o);
             if (r != 0 || t == 0) goto end;
-            sched->sleep(t > x ? x : t);
+            if (!sched->sleep_cancelable(t > x ? x : t)) { r = -1; errno = ECANCELED; goto end; }
             if (t != -1) t = (t > x ? t - x : 0);
             if (x < 16) x <<= 1;
             if (rs) *rs = s[0];
@@ -856,8 +859,7 @@ unsigned int _hook(sleep)(unsigned int n) {
         goto end;
     }
 
-    sched->sleep(n * 1000);
-    r = 0;
+    r = sched->sleep_cancelable(n * 1000) ? 0 : n;
 
   end:
     HOOKLOG << "hook sleep, sec: " << n << ", r: " << r;
@@ -876,8 +878,8 @@ int _hook(usleep)(useconds_t us) {
         goto end;
     }
 
-    sched->sleep(us <= 0 ? 0 : (us <= 1000 ? 1 : us / 1000));
-    r = 0;
+    r = sched->sleep_cancelable(us <= 0 ? 0 : (us <= 1000 ? 1 : us / 1000)) ? 0 : -1;
+    if (r != 0) errno = ECANCELED;
 
   end:
     HOOKLOG << "hook usleep, us: " << us << ", r: " << r;
@@ -911,8 +913,8 @@ int _hook(nanosleep)(const struct timespec* req, struct timespec* rem) {
         goto end;
     }
 
-    sched->sleep(ms);
-    r = 0;
+    r = sched->sleep_cancelable(ms) ? 0 : -1;
+    if (r != 0) errno = ECANCELED;
 
   end:
     HOOKLOG << "hook nanosleep, ms: " << ms << ", r: " << r;
@@ -932,7 +934,7 @@ int _hook(epoll_wait)(int epfd, struct epoll_event* events, int n, int ms) {
 
     {
         co::io_event ev(epfd, co::ev_read);
-        if (!ev.wait(ms)) { r = 0; goto end; } // timeout
+        if (!ev.wait(ms)) { r = errno == ECANCELED ? -1 : 0; goto end; } // timeout or cancelled
         r = __sys_api(epoll_wait)(epfd, events, n, 0);
     }
 
@@ -961,7 +963,7 @@ int _hook(accept4)(int fd, struct sockaddr* addr, socklen_t* addrlen, int flags)
             if (r != -1) goto end;
 
             if (errno == EWOULDBLOCK || errno == EAGAIN) {
-                ev.wait();
+                if (!ev.wait()) { r = -1; goto end; }
             } else if (errno != EINTR) {
                 goto end;
             }
@@ -1083,7 +1085,7 @@ int _hook(kevent)(int kq, const struct kevent* c, int nc, struct kevent* e, int
 
         {
             co::io_event ev(kq, co::ev_read);
-            if (!ev.wait(ms)) { r = 0; goto end; }
+            if (!ev.wait(ms)) { r = errno == ECANCELED ? -1 : 0; goto end; }
             r = __sys_api(kevent)(kq, c, nc, e, ne, 0);
         }
     }
@@ -620,7 +620,7 @@ int WINAPI hook_recv(
 
         r = __sys_api(WSARecv)(a0, &ev->buf, 1, &ev->n, &ev->flags, &ev->ol, 0);
         if (r == 0) {
-            if (!co::can_skip_iocp_on_success) ev.wait();
+            if (!co::can_skip_iocp_on_success && !ev.wait()) { r = -1; goto end; }
         } else if (WSAGetLastError() == WSA_IO_PENDING) {
             if (!ev.wait(ctx->recv_timeout())) goto end; // r = -1
         } else {
@@ -666,7 +666,7 @@ int WINAPI hook_WSARecv(
 
         r = __sys_api(WSARecv)(a0, x, a2, &ev->n, &ev->flags, &ev->ol, a6);
         if (r == 0) {
-            if (!co::can_skip_iocp_on_success) ev.wait();
+            if (!co::can_skip_iocp_on_success && !ev.wait()) r = -1;
         } else if (WSAGetLastError() == WSA_IO_PENDING) {
             if (ev.wait(ctx->recv_timeout())) r = 0;
         }
@@ -724,7 +724,7 @@ int WINAPI hook_recvfrom(
         }
 
         if (r == 0) {
-            if (!co::can_skip_iocp_on_success) ev.wait();
+            if (!co::can_skip_iocp_on_success && !ev.wait()) { r = -1; goto end; }
         } else if (WSAGetLastError() == WSA_IO_PENDING) {
             if (!ev.wait(ctx->recv_timeout())) goto end;
         } else {
@@ -787,7 +787,7 @@ int WINAPI hook_WSARecvFrom(
         }
 
         if (r == 0) {
-            if (!co::can_skip_iocp_on_success) ev.wait();
+            if (!co::can_skip_iocp_on_success && !ev.wait()) r = -1;
         } else if (WSAGetLastError() == WSA_IO_PENDING) {
             if (ev.wait(ctx->recv_timeout())) r = 0;
         }
@@ -838,7 +838,7 @@ int WINAPI hook_send(
 
         r = __sys_api(WSASend)(a0, &ev->buf, 1, &ev->n, a3, &ev->ol, 0);
         if (r == 0) {
-            if (!co::can_skip_iocp_on_success) ev.wait();
+            if (!co::can_skip_iocp_on_success && !ev.wait()) { r = -1; goto end; }
         } else if (WSAGetLastError() == WSA_IO_PENDING) {
             if (!ev.wait(ctx->send_timeout())) goto end;
         } else {
@@ -883,7 +883,7 @@ int WINAPI hook_WSASend(
 
         r = __sys_api(WSASend)(a0, x, a2, &ev->n, a4, &ev->ol, a6);
         if (r == 0) {
-            if (!co::can_skip_iocp_on_success) ev.wait();
+            if (!co::can_skip_iocp_on_success && !ev.wait()) r = -1;
         } else if (WSAGetLastError() == WSA_IO_PENDING) {
             if (ev.wait(ctx->send_timeout())) r = 0;
         }
@@ -924,7 +924,7 @@ int WINAPI hook_sendto(
 
         r = __sys_api(WSASendTo)(a0, &ev->buf, 1, &ev->n, a3, a4, a5, &ev->ol, 0);
         if (r == 0) {
-            if (!co::can_skip_iocp_on_success) ev.wait();
+            if (!co::can_skip_iocp_on_success && !ev.wait()) { r = -1; goto end; }
         } else if (WSAGetLastError() == WSA_IO_PENDING) {
             if (!ev.wait(ctx->send_timeout())) goto end;
         } else {
@@ -971,7 +971,7 @@ int WINAPI hook_WSASendTo(
 
         r = __sys_api(WSASendTo)(a0, x, a2, &ev->n, a4, a5, a6, &ev->ol, a8);
         if (r == 0) {
-            if (!co::can_skip_iocp_on_success) ev.wait();
+            if (!co::can_skip_iocp_on_success && !ev.wait()) r = -1;
         } else if (WSAGetLastError() == WSA_IO_PENDING) {
             if (ev.wait(ctx->send_timeout())) r = 0;
         }
@@ -1061,7 +1061,7 @@ int WINAPI hook_WSARecvMsg(
 
         r = __sys_api(WSARecvMsg)(a0, x, &ev->n, &ev->ol, a4);
         if (r == 0) {
-            if (!co::can_skip_iocp_on_success) ev.wait();
+            if (!co::can_skip_iocp_on_success && !ev.wait()) r = -1;
         } else if (WSAGetLastError() == WSA_IO_PENDING) {
             if (ev.wait(ctx->recv_timeout())) r = 0;
         }
@@ -1112,7 +1112,7 @@ int WINAPI hook_WSASendMsg(
 
         r = __sys_api(WSASendMsg)(a0, x, a2, &ev->n, &ev->ol, a5);
         if (r == 0) {
-            if (!co::can_skip_iocp_on_success) ev.wait();
+            if (!co::can_skip_iocp_on_success && !ev.wait()) r = -1;
         } else if (WSAGetLastError() == WSA_IO_PENDING) {
             if (ev.wait(ctx->recv_timeout())) r = 0;
         }
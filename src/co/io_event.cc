@@ -16,16 +16,10 @@ bool io_event::wait(uint32 ms) {
         if (!_added) return false;
     }
 
-    if (ms != (uint32)-1) {
-        sched->add_timer(ms);
-        sched->yield();
-        if (!sched->timeout()) return true;
-        errno = ETIMEDOUT;
-        return false;
-    } else {
-        sched->yield();
-        return true;
-    }
+    if (ms != (uint32)-1) sched->add_timer(ms);
+    if (sched->yield_cancelable()) return true;
+    errno = sched->running()->cancelled ? ECANCELED : ETIMEDOUT;
+    return false;
 }
 
 #else
@@ -116,20 +110,19 @@ bool io_event::wait(uint32 ms) {
         }
     }
 
-    if (ms != (uint32)-1) {
-        sched->add_timer(ms);
-        sched->yield();
-        _timeout = sched->timeout();
-        if (!_timeout) return true;
+    if (ms != (uint32)-1) sched->add_timer(ms);
+    _timeout = !sched->yield_cancelable();
+    if (!_timeout) return true;
 
-        CancelIo((HANDLE)_fd);
+    CancelIo((HANDLE)_fd);
+    if (sched->running()->cancelled) {
+        co::error(ECANCELED);
+        WSASetLastError(WSAECANCELLED);
+    } else {
         co::error(ETIMEDOUT);
         WSASetLastError(WSAETIMEDOUT);
-        return false;
-    } else {
-        sched->yield();
-        return true;
     }
+    return false;
 
   err:
     co::error(e);
@@ -147,6 +140,11 @@ bool io_event::wait(uint32 ms) {
             r = co::getsockopt(_fd, SOL_SOCKET, SO_CONNECT_TIME, &sec, &len);
             if (r != 0) return false;
             if (sec >= 0) return true; // connect ok
+            if (sched->running()->cancelled) {
+                co::error(ECANCELED);
+                WSASetLastError(WSAECANCELLED);
+                return false;
+            }
             if (ms == 0) {
                 co::error(ETIMEDOUT);
                 WSASetLastError(WSAETIMEDOUT);
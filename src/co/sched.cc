@@ -1,12 +1,39 @@
 #include "sched.h"
 #include "co/os.h"
 #include "co/rand.h"
+#include "co/str.h"
 #include <mutex>
+#include <stdio.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
 
 DEF_uint32(co_sched_num, os::cpunum(), ">>#1 number of coroutine schedulers");
 DEF_uint32(co_stack_num, 8, ">>#1 number of stacks per scheduler, must be power of 2");
 DEF_uint32(co_stack_size, 1024 * 1024, ">>#1 size of the stack shared by coroutines");
 DEF_bool(co_sched_log, false, ">>#1 print logs for coroutine schedulers");
+DEF_bool(co_steal, false, ">>#1 idle schedulers steal coroutines not yet started from busy ones");
+DEF_bool(co_timer_wheel, false, ">>#1 use a hierarchical timer wheel instead of a multimap for timers");
+DEF_bool(co_dedicated_stack, false, ">>#1 each coroutine runs on a dedicated stack of co_stack_size bytes");
+DEF_uint32(co_stats_log_ms, 0, ">>#1 interval in ms to log statistics of schedulers, 0 for never");
+DEF_string(co_sched_cpus, "", ">>#1 cpus to pin scheduler threads to, e.g. 0,2,4-7, or core for "
+           "one scheduler per physical core, empty for no pinning");
+DEF_uint32(co_prio_quota, 64, ">>#1 max number of high priority tasks resumed in a row, before a "
+           "task in the normal lane");
+DEF_uint32(co_watchdog_ms, 0, ">>#1 log coroutines running longer than this without yielding, with "
+           "a backtrace on linux, 0 for no watchdog");
+DEF_int32(co_watchdog_signal, 0, ">>#1 signal sent to a scheduler thread by the watchdog to print "
+          "the backtrace on linux, SIGRTMIN+3 if 0, -1 for no backtrace");
+DEF_uint32(co_pool_idle_blocks, 2, ">>#1 max number of idle blocks (4096 coroutines per block) kept "
+           "in the coroutine pool, more idle blocks are returned to the OS");
+DEF_uint32(co_time_slice_ms, 10, ">>#1 time slice of coroutines, co::maybe_yield() yields after it "
+           "is used up, 0 for never");
 
 #ifdef _MSC_VER
 extern LONG WINAPI _co_on_exception(PEXCEPTION_POINTERS p);
@@ -28,28 +55,241 @@ namespace xx {
 
 __thread Sched* gSched = 0;
 
-Sched::Sched(uint32 id, uint32 sched_num, uint32 stack_num, uint32 stack_size)
+Sched::Sched(uint32 id, uint32 sched_num, uint32 stack_num, uint32 stack_size, int cpu)
     : _cputime(0), _task_mgr(), _timer_mgr(), _wait_ms(-1), _timeout(false),
-      _bufs(128), _co_pool(), _running(0), _id(id), _sched_num(sched_num),
-      _stack_num(stack_num), _stack_size(stack_size) {
+      _bufs(), _co_pool(), _running(0), _main_co(0), _id(id), _sched_num(sched_num),
+      _stack_num(stack_num), _stack_size(stack_size), _stack(0), _prio_pos(0), _cpu(cpu) {
+    memset(&_stat, 0, sizeof(_stat));
     new(&_x.ev) co::sync_event();
-    _x.epoll = co::make<Epoll>(id);
+    _x.epoll = 0;
     _x.stopped = false;
-    _main_co = _co_pool.pop(); // id 0 is reserved for _main_co
-    _main_co->sched = this;
-    _stack = (Stack*) co::zalloc(stack_num * sizeof(Stack));
+    _x.waiting = false;
+    _x.preempt = (uint64)-1;
 }
 
 Sched::~Sched() {
     this->stop();
-    co::del(_x.epoll);
+    if (_x.epoll) co::del(_x.epoll);
     _x.ev.~sync_event();
-    for (size_t i = 0; i < _bufs.size(); ++i) {
-        void* p = _bufs[i];
-        god::cast<Buffer*>(&p)->reset();
+    if (_stack) co::free(_stack, _stack_num * sizeof(Stack));
+}
+
+#if defined(_WIN32)
+inline bool _set_cpu_affinity(int cpu) {
+    return cpu < 64 && SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) != 0;
+}
+#elif defined(__linux__)
+inline bool _set_cpu_affinity(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+#else
+inline bool _set_cpu_affinity(int) {
+    return false; // not supported
+}
+#endif
+
+void Sched::init() {
+    if (_cpu >= 0 && !_set_cpu_affinity(_cpu)) {
+        WLOG << "failed to pin sched " << _id << " to cpu " << _cpu;
+    }
+  #ifndef _WIN32
+    _tid = pthread_self();
+  #endif
+    _x.epoll = co::make<Epoll>(_id);
+    _main_co = _co_pool.pop(); // id 0 is reserved for _main_co
+    _main_co->sched = this;
+    _stack = (Stack*) co::zalloc(_stack_num * sizeof(Stack));
+}
+
+void Sched::start() {
+    co::sync_event ev;
+    std::thread([this, &ev]() {
+        this->init();
+        ev.signal();
+        this->loop();
+    }).detach();
+    ev.wait();
+}
+
+#ifdef _WIN32
+inline char* _alloc_stack(size_t n, size_t g) {
+    char* p = (char*) VirtualAlloc(NULL, n + g, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    CHECK(p != NULL) << "alloc stack failed: " << co::strerror();
+    DWORD x;
+    CHECK(VirtualProtect(p, g, PAGE_NOACCESS, &x)) << "protect stack failed: " << co::strerror();
+    return p + g;
+}
+
+inline void _free_stack(char* p, size_t, size_t g) {
+    VirtualFree(p - g, 0, MEM_RELEASE);
+}
+
+#else
+inline char* _alloc_stack(size_t n, size_t g) {
+    void* p = ::mmap(
+        NULL, n + g, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0
+    );
+    CHECK(p != MAP_FAILED) << "alloc stack failed: " << co::strerror();
+    CHECK_EQ(::mprotect(p, g, PROT_NONE), 0) << "protect stack failed: " << co::strerror();
+    return (char*)p + g;
+}
+
+inline void _free_stack(char* p, size_t n, size_t g) {
+    ::munmap(p - g, n + g);
+}
+#endif
+
+BufferPool::BufferPool() : _n(0) {
+    for (uint32 i = 0; i < C; ++i) {
+        _c[i].used = 0;
+        _c[i].hw = 0;
+    }
+}
+
+BufferPool::~BufferPool() {
+    for (uint32 i = 0; i < C; ++i) {
+        auto& v = _c[i].bufs;
+        for (size_t k = 0; k < v.size(); ++k) co::free(v[k], (size_t)1 << (i + B));
+    }
+}
+
+#ifdef _MSC_VER
+inline uint32 _find_msb(uint32 x) { /* x != 0 */
+    unsigned long r;
+    _BitScanReverse(&r, x);
+    return r;
+}
+#else
+inline uint32 _find_msb(uint32 x) { /* x != 0 */
+    return 31 - __builtin_clz(x);
+}
+#endif
+
+bool BufferPool::pop(size_t n, void** p) {
+    const size_t x = n + sizeof(Buffer::H);
+    const uint32 k = x <= ((size_t)1 << B) ? B : _find_msb((uint32)(x - 1)) + 1;
+    Buffer::H* h;
+    if (x > ((size_t)1 << (B + C - 1))) {
+        h = (Buffer::H*) co::alloc(x); assert(h);
+        h->cap = (uint32)n;
+        h->size = 0;
+        *p = h;
+        return false;
+    }
+
+    auto& c = _c[k - B];
+    if (++c.used > c.hw) c.hw = c.used;
+    if (!c.bufs.empty()) {
+        --_n;
+        h = (Buffer::H*) c.bufs.pop_back();
+        h->size = 0;
+        *p = h;
+        return true;
+    }
+
+    h = (Buffer::H*) co::alloc((size_t)1 << k); assert(h);
+    h->cap = (uint32)(((size_t)1 << k) - sizeof(Buffer::H));
+    h->size = 0;
+    *p = h;
+    return false;
+}
+
+void BufferPool::push(void* p) {
+    Buffer::H* const h = (Buffer::H*)p;
+    const size_t x = h->cap + sizeof(Buffer::H);
+    if ((x & (x - 1)) == 0 && x >= ((size_t)1 << B) && x <= ((size_t)1 << (B + C - 1))) {
+        auto& c = _c[_find_msb((uint32)x) - B];
+        --c.used;
+        c.bufs.push_back(p);
+        ++_n;
+    } else {
+        co::free(h, x);
+    }
+}
+
+void BufferPool::trim() {
+    for (uint32 i = 0; i < C; ++i) {
+        auto& c = _c[i];
+        const size_t keep = c.hw - c.used;
+        while (c.bufs.size() > keep) {
+            co::free(c.bufs.pop_back(), (size_t)1 << (i + B));
+            --_n;
+        }
+        c.hw = c.used;
+    }
+}
+
+CoroutinePool::~CoroutinePool() {
+    for (size_t i = 0; i < _blks.size(); ++i) {
+        if (_blks[i].p) this->del_block(_blks[i].p);
+    }
+}
+
+#ifdef _WIN32
+Coroutine* CoroutinePool::new_block() {
+    void* p = VirtualAlloc(NULL, N * sizeof(Coroutine), MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    CHECK(p != NULL) << "alloc coroutine block failed: " << co::strerror();
+    return (Coroutine*)p;
+}
+
+void CoroutinePool::del_block(Coroutine* p) {
+    VirtualFree(p, 0, MEM_RELEASE);
+}
+
+#else
+Coroutine* CoroutinePool::new_block() {
+    void* p = ::mmap(NULL, N * sizeof(Coroutine), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    CHECK(p != MAP_FAILED) << "alloc coroutine block failed: " << co::strerror();
+    return (Coroutine*)p;
+}
+
+void CoroutinePool::del_block(Coroutine* p) {
+    ::munmap(p, N * sizeof(Coroutine));
+}
+#endif
+
+Stack* StackPool::pop(uint32 size) {
+    const uint32 g = (uint32) os::pagesize();
+    const uint32 n = god::align_up(size < 16 * 1024 ? 16 * 1024 : size, g);
+    for (size_t i = _stacks.size(); i > 0; --i) {
+        Stack* const s = _stacks[i - 1];
+        if (s->size == n) {
+            _stacks[i - 1] = _stacks.back();
+            _stacks.pop_back();
+            return s;
+        }
+    }
+
+    Stack* const s = co::make<Stack>();
+    s->p = _alloc_stack(n, g);
+    s->top = s->p + n;
+    s->co = 0;
+    s->size = n;
+    return s;
+}
+
+void StackPool::push(Stack* s) {
+    s->co = 0;
+    if (_stacks.size() < N) {
+        _stacks.push_back(s);
+    } else {
+        _free_stack(s->p, s->size, os::pagesize());
+        co::del(s);
+    }
+}
+
+StackPool::~StackPool() {
+    const size_t g = os::pagesize();
+    for (size_t i = 0; i < _stacks.size(); ++i) {
+        Stack* const s = _stacks[i];
+        _free_stack(s->p, s->size, g);
+        co::del(s);
     }
-    _bufs.clear();
-    co::free(_stack, _stack_num * sizeof(Stack));
+    _stacks.clear();
 }
 
 static int g_cnt = 0;
@@ -72,15 +312,20 @@ void Sched::stop() {
 
 void Sched::main_func(tb_context_from_t from) {
     ((Coroutine*)from.priv)->ctx = from.ctx;
+    Coroutine* const co = ((Coroutine*)from.priv)->sched->running();
   #ifdef _MSC_VER
     __try {
-        ((Coroutine*)from.priv)->sched->running()->cb->run();
+        co->cb->run();
     } __except(_co_on_exception(GetExceptionInformation())) {
     }
   #else
-    ((Coroutine*)from.priv)->sched->running()->cb->run();
+    co->cb->run();
   #endif // _WIN32
-    tb_context_jump(from.ctx, 0); // jump back to the from context
+    if (co->locals) del_locals(co);
+
+    // jump back to the latest context of the scheduler, which may be different
+    // from @from.ctx if the coroutine has yielded
+    tb_context_jump(((Coroutine*)from.priv)->ctx, 0);
 }
 
 /*
@@ -99,6 +344,7 @@ void Sched::resume(Coroutine* co) {
     tb_context_from_t from;
     Stack* const s = co->stack;
     _running = co;
+    stat_add(_stat.switches, 1);
     if (s->p == 0) {
         s->p = (char*) co::alloc(_stack_size);
         s->top = s->p + _stack_size;
@@ -108,17 +354,13 @@ void Sched::resume(Coroutine* co) {
     if (co->ctx == 0) {
         // resume new coroutine
         if (s->co != co) { this->save_stack(s->co); s->co = co; }
-        co->ctx = tb_context_make(s->p, _stack_size, main_func);
+        co->ctx = tb_context_make(s->p, s->top - s->p, main_func);
         SCHEDLOG << "resume new co: " << co << " id: " << co->id;
         from = tb_context_jump(co->ctx, _main_co); // jump to main_func(from):  from.priv == _main_co
 
     } else {
         // remove timer before resume the coroutine
-        if (co->it != _timer_mgr.end()) {
-            SCHEDLOG << "del timer: " << co->it;
-            _timer_mgr.del_timer(co->it);
-            co->it = _timer_mgr.end();
-        }
+        _timer_mgr.del_timer(co);
 
         // resume suspended coroutine
         SCHEDLOG << "resume co: " << co << " id: " <<  co->id << " stack: " << co->buf.size();
@@ -145,20 +387,33 @@ void Sched::resume(Coroutine* co) {
 
 void Sched::loop() {
     gSched = this;
-    co::vector<Closure*> new_tasks(512);
+    co::vector<task_t> new_tasks(512);
     co::vector<Coroutine*> ready_tasks(512);
-    co::Timer timer;
+    int64 log_us = now::us();
+    int64 trim_us = log_us;
 
     while (!_x.stopped) {
-        int n = _x.epoll->wait(_wait_ms);
+        const int64 t0 = now::us();
+        // check the tasks after marking the scheduler waiting, see wakeup()
+        atomic_store(&_x.waiting, true);
+        const uint32 ms = _task_mgr.empty() && !this->has_prio_tasks() ? _wait_ms : 0;
+        if (ms != 0) co::_flush_xfree(); // give memory freed back to the owners before idle
+        int n = _x.epoll->wait(ms);
+        atomic_store(&_x.waiting, false, mo_relaxed);
         if (_x.stopped) break;
 
+        const int64 t1 = now::us();
+        stat_add(_stat.wait_us, t1 - t0);
         if (unlikely(n == -1)) {
             if (co::error() != EINTR) ELOG << "epoll wait error: " << co::strerror();
             continue;
         }
 
-        if (_sched_num > 1) timer.restart();
+        if (this->has_prio_tasks()) {
+            SCHEDLOG << "> resume high priority tasks..";
+            this->resume_prio_tasks();
+        }
+
         SCHEDLOG << "> check I/O tasks ready to resume, num: " << n;
 
         for (int i = 0; i < n; ++i) {
@@ -167,6 +422,7 @@ void Sched::loop() {
                 _x.epoll->handle_ev_pipe();
                 continue;
             }
+            stat_add(_stat.io_events, 1);
 
           #if defined(_WIN32)
             auto info = xx::per_io_info(ev.lpOverlapped);
@@ -174,7 +430,7 @@ void Sched::loop() {
             if (atomic_bool_cas(&info->state, st_wait, st_ready, mo_relaxed, mo_relaxed)) {
                 info->n = ev.dwNumberOfBytesTransferred;
                 if (co->sched == this) {
-                    this->resume(co);
+                    this->resume_normal(co);
                 } else {
                     co->sched->add_ready_task(co);
                 }
@@ -186,26 +442,27 @@ void Sched::loop() {
             auto& ctx = co::get_sock_ctx(_x.epoll->user_data(ev));
             if ((ev.events & EPOLLIN)  || !(ev.events & EPOLLOUT)) rco = ctx.get_ev_read(this->id());
             if ((ev.events & EPOLLOUT) || !(ev.events & EPOLLIN))  wco = ctx.get_ev_write(this->id());
-            if (rco) this->resume(&_co_pool[rco]);
-            if (wco) this->resume(&_co_pool[wco]);
+            if (rco) this->resume_normal(&_co_pool[rco]);
+            if (wco) this->resume_normal(&_co_pool[wco]);
           #else
-            this->resume((Coroutine*)_x.epoll->user_data(ev));
+            this->resume_normal((Coroutine*)_x.epoll->user_data(ev));
           #endif
         }
 
         SCHEDLOG << "> check tasks ready to resume..";
         do {
             _task_mgr.get_all_tasks(new_tasks, ready_tasks);
+            atomic_store(&_stat.ready, new_tasks.size() + ready_tasks.size(), mo_relaxed);
 
             if (!new_tasks.empty()) {
                 const size_t c = new_tasks.capacity();
                 const size_t s = new_tasks.size();
                 SCHEDLOG << ">> resume new tasks, num: " << s;
                 for (size_t i = 0; i < s; ++i) {
-                    this->resume(this->new_coroutine(new_tasks[i]));
+                    this->resume_normal(this->new_coroutine(new_tasks[i]));
                 }
                 if (c >= 8192 && s <= (c >> 1)) {
-                    co::vector<Closure*>(s).swap(new_tasks);
+                    co::vector<task_t>(s).swap(new_tasks);
                 }
                 new_tasks.clear();
             }
@@ -215,7 +472,7 @@ void Sched::loop() {
                 const size_t s = ready_tasks.size();
                 SCHEDLOG << ">> resume ready tasks, num: " << s;
                 for (size_t i = 0; i < s; ++i) {
-                    this->resume(ready_tasks[i]);
+                    this->resume_normal(ready_tasks[i]);
                 }
                 if (c >= 8192 && s <= (c >> 1)) {
                     co::vector<Coroutine*>(s).swap(ready_tasks);
@@ -224,9 +481,15 @@ void Sched::loop() {
             }
         } while (0);
 
+        if (_task_mgr.has_cancels()) {
+            SCHEDLOG << "> cancel tasks..";
+            this->cancel_tasks();
+        }
+
         SCHEDLOG << "> check timedout tasks..";
         do {
             _wait_ms = _timer_mgr.check_timeout(ready_tasks);
+            atomic_store(&_stat.timers, _timer_mgr.size(), mo_relaxed);
 
             if (!ready_tasks.empty()) {
                 SCHEDLOG << ">> resume timedout tasks, num: " << ready_tasks.size();
@@ -236,17 +499,271 @@ void Sched::loop() {
                 }
                 _timeout = false;
                 ready_tasks.clear();
+                if (this->has_prio_tasks()) this->resume_prio_tasks();
             }
         } while (0);
 
+        if (FLG_co_steal && _sched_num > 1) {
+            SCHEDLOG << "> steal tasks from other schedulers..";
+            const size_t s = this->steal_tasks(new_tasks);
+            if (s > 0) {
+                SCHEDLOG << ">> resume stolen tasks, num: " << s;
+                for (size_t i = 0; i < s; ++i) {
+                    this->resume_normal(this->new_coroutine(new_tasks[i]));
+                }
+                new_tasks.clear();
+                _wait_ms = 0; // try to steal again before waiting
+            }
+        }
+
         if (_running) _running = 0;
-        if (_sched_num > 1) atomic_add(&_cputime, timer.us(), mo_relaxed);
+        const int64 t2 = now::us();
+        stat_add(_stat.run_us, t2 - t1);
+        if (_sched_num > 1) atomic_add(&_cputime, t2 - t1, mo_relaxed);
+
+        // trim the buffers cached every second, and wake up for it if any is
+        // left, or if memory is to be given back to the OS when idle
+        if (t2 - trim_us >= 1000000) {
+            _bufs.trim();
+            trim_us = t2;
+        }
+        const bool mem_pending = co::_trim_if_idle();
+        if ((_bufs.size() > 0 || mem_pending) && _wait_ms > 1000) _wait_ms = 1000;
+
+        if (FLG_co_stats_log_ms > 0) {
+            const int64 ms = FLG_co_stats_log_ms;
+            if (t2 - log_us >= ms * 1000) {
+                this->log_stat();
+                log_us = t2;
+            }
+            if (_wait_ms > ms) _wait_ms = (uint32)ms;
+        }
     }
 
+    // free the memory before signaling, as the allocator may be destroyed then
+    new_tasks.reset();
+    ready_tasks.reset();
     _x.ev.signal();
 }
 
+inline bool is_timedout(Coroutine* co) {
+    if (!co->waitx) return true;
+    // TODO: is mo_relaxed safe here?
+    return atomic_bool_cas(&co->waitx->state, st_wait, st_timeout, mo_relaxed, mo_relaxed);
+}
+
+void Sched::resume_prio_tasks() {
+    for (uint32 n = FLG_co_prio_quota > 0 ? FLG_co_prio_quota : 1; n > 0; --n) {
+        if (_prio_pos == _prio_cos.size()) {
+            _prio_cos.clear();
+            _prio_pos = 0;
+            if (!_task_mgr.has_prio_tasks()) break;
+            _task_mgr.get_prio_tasks(_prio_new, _prio_cos);
+            for (size_t i = 0; i < _prio_new.size(); ++i) {
+                _prio_cos.push_back(this->new_coroutine(_prio_new[i]));
+            }
+            _prio_new.clear();
+        }
+        this->resume(_prio_cos[_prio_pos++]);
+    }
+}
+
+void Sched::cancel(Coroutine* co, group_t* g) {
+    auto x = co::make<cancel_t>();
+    x->co = co;
+    x->g = g;
+    atomic_inc(&co->cancels, mo_relaxed);
+    if (_task_mgr.add_cancel(x)) this->wakeup();
+}
+
+bool Sched::cancel_wait(Coroutine* co) {
+    if (co->waitx && !is_timedout(co)) return false;
+    _timer_mgr.del_timer(co);
+    return true;
+}
+
+void Sched::cancel_tasks() {
+    for (auto x = _task_mgr.get_cancels(); x;) {
+        cancel_t* const c = x;
+        x = x->next;
+        Coroutine* const co = c->co;
+        if (co->group == c->g) {
+            co->cancelled = 1;
+            if (co->cancelable && this->cancel_wait(co)) {
+                _timeout = true;
+                this->resume(co);
+                _timeout = false;
+            }
+        }
+        unref_group(c->g);
+        co::del(c);
+        if (atomic_dec(&co->cancels, mo_acq_rel) == 0 && !co->cb) _co_pool.push(co);
+    }
+    if (this->has_prio_tasks()) this->resume_prio_tasks();
+}
+
+// The values are detached from the coroutine before they are destroyed, as a
+// destructor may set values again, which go to a new array then.
+void Sched::del_locals(Coroutine* co) {
+    while (co->locals) {
+        Locals* const l = co->locals;
+        co->locals = 0;
+        for (uint32 i = 0; i < l->n; ++i) {
+            auto& x = l->v[i];
+            if (x.p) x.del(x.p);
+        }
+        co::free(l, Locals::bytes(l->n));
+    }
+}
+
+void Sched::log_stat() {
+    co::sched_stat s;
+    this->get_stat(s);
+    LOG << "sched " << s.id << " stats, coroutines: " << s.coroutines
+        << " switches: " << s.switches << " stack_bytes: " << s.stack_bytes
+        << " ready: " << s.ready << " timers: " << s.timers
+        << " wait_us: " << s.wait_us << " run_us: " << s.run_us
+        << " io_events: " << s.io_events << " overruns: " << s.overruns
+        << " buf_hits: " << s.buf_hits << " buf_misses: " << s.buf_misses;
+}
+
+#if defined(__linux__) && defined(__GLIBC__)
+static int g_watchdog_sig; // signal for backtraces of overrun coroutines, 0 if not installed
+#endif
+
+void Sched::overrun(int64 ms) {
+    stat_add(_stat.overruns, 1);
+    Coroutine* const co = atomic_load(&_running, mo_relaxed);
+    WLOG << "sched " << _id << ": coroutine " << (co ? (int)(_sched_num * (co->id - 1) + _id) : -1)
+         << " has been running for " << ms << " ms without yielding";
+  #if defined(__linux__) && defined(__GLIBC__)
+    if (g_watchdog_sig > 0) pthread_kill(_tid, g_watchdog_sig);
+  #endif
+}
+
+#if defined(__linux__) && defined(__GLIBC__)
+// print backtrace of the scheduler thread to stderr, the signal is sent by the watchdog
+static void on_watchdog_signal(int) {
+    log::xx::print_stack("backtrace of the coroutine running too long:\n", 1);
+}
+#endif
+
+uint32 local_key() {
+    static uint32 g_key = 0;
+    return atomic_fetch_inc(&g_key, mo_relaxed);
+}
+
+void* local_get(uint32 k) {
+    const auto s = gSched;
+    CHECK(s) << "MUST be called in coroutine..";
+    Locals* const l = s->running()->locals;
+    return (l && k < l->n) ? l->v[k].p : 0;
+}
+
+void local_set(uint32 k, void* p, void (*del)(void*)) {
+    const auto s = gSched;
+    CHECK(s) << "MUST be called in coroutine..";
+    Coroutine* const co = s->running();
+    Locals* l = co->locals;
+    if (!l || k >= l->n) {
+        const uint32 o = l ? l->n : 0;
+        uint32 n = o ? o : 8;
+        while (n <= k) n <<= 1;
+        l = (Locals*) co::realloc(l, Locals::bytes(o), Locals::bytes(n));
+        assert(l);
+        memset(l->v + o, 0, (n - o) * sizeof(Locals::value_t));
+        l->n = n;
+        co->locals = l;
+    }
+
+    auto& x = l->v[k];
+    void* const old = x.p;
+    void (*const d)(void*) = x.del;
+    x.p = p;
+    x.del = del;
+    if (old && old != p) d(old);
+}
+
+void Watchdog::start(const co::vector<Sched*>& scheds) {
+    if (FLG_co_watchdog_ms == 0 && FLG_co_time_slice_ms == 0) return;
+    if (!atomic_bool_cas(&_state, 0, 1)) return;
+  #if defined(__linux__) && defined(__GLIBC__)
+    const int sig = FLG_co_watchdog_signal == 0 ? SIGRTMIN + 3 : FLG_co_watchdog_signal;
+    if (FLG_co_watchdog_ms > 0 && sig > 0) {
+        // do not take over a signal the application handles
+        struct sigaction sa;
+        sigaction(sig, 0, &sa);
+        if (sa.sa_handler == SIG_DFL) {
+            log::xx::prepare_stack();
+            memset(&sa, 0, sizeof(sa));
+            sigemptyset(&sa.sa_mask);
+            sa.sa_handler = on_watchdog_signal;
+            sa.sa_flags = SA_RESTART;
+            if (sigaction(sig, &sa, 0) == 0) g_watchdog_sig = sig;
+        } else {
+            WLOG << "co_watchdog_signal " << sig << " is in use, no backtrace for overruns";
+        }
+    }
+  #endif
+    std::thread([this, &scheds]() { this->loop(scheds); }).detach();
+}
+
+void Watchdog::stop() {
+    if (atomic_bool_cas(&_state, 1, 2)) {
+        _ev.signal();
+        _done.wait();
+    }
+}
+
+void Watchdog::loop(const co::vector<Sched*>& scheds) {
+    struct state_t {
+        uint64 switches; // context switches at the last check
+        int64 ms;        // time when the current coroutine was found running
+        bool reported;   // whether the overrun has been reported
+    };
+
+    const uint32 slice = FLG_co_time_slice_ms;
+    const uint32 limit = FLG_co_watchdog_ms;
+    uint32 tick = (slice > 0 && (limit == 0 || slice < limit)) ? slice : limit;
+    tick = tick > 1 ? (tick >> 1) : 1;
+
+    co::vector<state_t> st(scheds.size(), state_t{ 0, 0, false });
+    while (!_ev.wait(tick)) {
+        const int64 now_ms = now::ms();
+        for (size_t i = 0; i < scheds.size(); ++i) {
+            Sched* const s = scheds[i];
+            auto& x = st[i];
+            const uint64 sw = s->switches();
+            if (!s->busy() || sw != x.switches) {
+                x.switches = sw;
+                x.ms = now_ms;
+                x.reported = false;
+                continue;
+            }
+
+            const int64 t = now_ms - x.ms;
+            if (slice > 0 && t >= slice) s->preempt(sw);
+            if (limit > 0 && t >= limit && !x.reported) {
+                x.reported = true;
+                s->overrun(t);
+            }
+        }
+    }
+    _done.signal();
+}
+
 uint32 TimerManager::check_timeout(co::vector<Coroutine*>& res) {
+    if (_wheel) {
+        const size_t n = res.size();
+        const uint32 ms = _wheel->expire(now::ms(), res);
+        size_t k = n;
+        for (size_t i = n; i < res.size(); ++i) {
+            if (is_timedout(res[i])) res[k++] = res[i];
+        }
+        res.resize(k);
+        return ms;
+    }
+
     if (_timer.empty()) return (uint32)-1;
 
     int64 now_ms = now::ms();
@@ -255,15 +772,7 @@ uint32 TimerManager::check_timeout(co::vector<Coroutine*>& res) {
         if (it->first > now_ms) break;
         Coroutine* co = it->second;
         if (co->it != _timer.end()) co->it = _timer.end();
-        if (!co->waitx) {
-            res.push_back(co);
-        } else {
-            auto w = co->waitx;
-            // TODO: is mo_relaxed safe here?
-            if (atomic_bool_cas(&w->state, st_wait, st_timeout, mo_relaxed, mo_relaxed)) {
-                res.push_back(co);
-            }
-        }
+        if (is_timedout(co)) res.push_back(co);
     }
 
     if (it != _timer.begin()) {
@@ -274,6 +783,88 @@ uint32 TimerManager::check_timeout(co::vector<Coroutine*>& res) {
     return _timer.empty() ? (uint32)-1 : (uint32)(_timer.begin()->first - now_ms);
 }
 
+void TimerWheel::add(timer_node_t* n, int64 expire) {
+    const int64 d = expire - _jiffies;
+    uint32 slot;
+    if (d < (int64)N0) {
+        // timers already expired are put in the slot to be processed next
+        slot = (uint32)((d < 0 ? _jiffies : expire) & (N0 - 1));
+        _bits[slot >> 5] |= 1u << (slot & 31);
+    } else if (d < (1 << 14)) {
+        slot = N0 + (uint32)((expire >> 8) & (N - 1));
+    } else if (d < (1 << 20)) {
+        slot = N0 + N + (uint32)((expire >> 14) & (N - 1));
+    } else if (d < (1 << 26)) {
+        slot = N0 + N * 2 + (uint32)((expire >> 20) & (N - 1));
+    } else {
+        if (d > 0xffffffffLL) expire = _jiffies + 0xffffffffLL;
+        slot = N0 + N * 3 + (uint32)((expire >> 26) & (N - 1));
+    }
+    n->expire = expire;
+    n->slot = slot;
+    _slots[slot].push_back(n);
+    ++_size;
+}
+
+uint32 TimerWheel::cascade(uint32 l, uint32 i) {
+    co::clist x;
+    x.swap(_slots[N0 + N * (l - 1) + i]);
+    while (!x.empty()) {
+        auto n = (timer_node_t*) x.pop_front();
+        --_size;
+        this->add(n, n->expire);
+    }
+    return i;
+}
+
+int TimerWheel::next_slot(uint32 i) const {
+    for (uint32 k = i >> 5; k < N0 / 32; ++k) {
+        uint32 b = _bits[k];
+        if (k == (i >> 5)) b &= ~0u << (i & 31);
+        if (b) return (int)((k << 5) + _find_lsb(b));
+    }
+    return -1;
+}
+
+uint32 TimerWheel::expire(int64 now_ms, co::vector<Coroutine*>& res) {
+    while (_size > 0 && _jiffies <= now_ms) {
+        const uint32 i = (uint32)(_jiffies & (N0 - 1));
+        if (i == 0 &&
+            cascade(1, (_jiffies >> 8) & (N - 1)) == 0 &&
+            cascade(2, (_jiffies >> 14) & (N - 1)) == 0 &&
+            cascade(3, (_jiffies >> 20) & (N - 1)) == 0) {
+            cascade(4, (_jiffies >> 26) & (N - 1));
+        }
+
+        auto& l = _slots[i];
+        if (!l.empty()) {
+            do {
+                auto n = (timer_node_t*) l.pop_front();
+                n->slot = (uint32)-1;
+                --_size;
+                res.push_back(n->co);
+            } while (!l.empty());
+            _bits[i >> 5] &= ~(1u << (i & 31));
+        }
+
+        // skip empty slots, but stop at the end of the first level for cascading
+        const int k = i + 1 < N0 ? this->next_slot(i + 1) : (int)N0;
+        const int64 x = _jiffies + ((k >= 0 ? k : (int)N0) - (int)i);
+        _jiffies = x <= now_ms + 1 ? x : now_ms + 1;
+    }
+
+    if (_size == 0) {
+        if (_jiffies <= now_ms) _jiffies = now_ms + 1;
+        return (uint32)-1;
+    }
+
+    // time of the next slot to process, it is the end of the first level if
+    // there are no timers in the first level.
+    const uint32 i = (uint32)(_jiffies & (N0 - 1));
+    const int k = this->next_slot(i);
+    return (uint32)(_jiffies + ((k >= 0 ? k : (int)N0) - (int)i) - now_ms);
+}
+
 struct SchedInfo {
     SchedInfo() : cputime(co::sched_num(), 0), seed(co::rand()) {}
     co::vector<int64> cputime;
@@ -286,6 +877,64 @@ inline SchedInfo& sched_info() {
     return g_si ? *g_si : *(g_si = co::_make_static<SchedInfo>());
 }
 
+// first cpu of each physical core
+static co::vector<int> physical_cores() {
+    co::vector<int> v;
+  #if defined(_WIN32)
+    DWORD n = 0;
+    GetLogicalProcessorInformation(NULL, &n);
+    auto p = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION*) ::malloc(n);
+    if (p && GetLogicalProcessorInformation(p, &n)) {
+        const size_t c = n / sizeof(*p);
+        for (size_t i = 0; i < c; ++i) {
+            if (p[i].Relationship != RelationProcessorCore) continue;
+            const ULONG_PTR m = p[i].ProcessorMask;
+            for (int k = 0; k < (int)sizeof(m) * 8; ++k) {
+                if (m & ((ULONG_PTR)1 << k)) { v.push_back(k); break; }
+            }
+        }
+    }
+    if (p) ::free(p);
+  #else
+    // cpus in the same core are listed in thread_siblings_list, e.g. 0,8 or 0-1
+    const int ncpu = os::cpunum();
+    for (int i = 0; i < ncpu; ++i) {
+        char path[96];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", i);
+        int first = i;
+        FILE* f = fopen(path, "r");
+        if (f) {
+            if (fscanf(f, "%d", &first) != 1) first = i;
+            fclose(f);
+        }
+        if (first == i) v.push_back(i);
+    }
+  #endif
+    return v;
+}
+
+// cpus to pin scheduler threads to, parsed from co_sched_cpus
+static co::vector<int> sched_cpus() {
+    const fastring& s = FLG_co_sched_cpus;
+    if (s.empty()) return co::vector<int>();
+    if (s == "core") return physical_cores();
+
+    co::vector<int> v;
+    auto l = str::split(s, ',');
+    for (size_t i = 0; i < l.size(); ++i) {
+        fastring& x = l[i].strip();
+        if (x.empty()) continue;
+        const size_t p = x.find('-');
+        if (p == x.npos) {
+            v.push_back(atoi(x.c_str()));
+        } else {
+            const int b = atoi(x.c_str() + p + 1);
+            for (int k = atoi(x.substr(0, p).c_str()); k <= b; ++k) v.push_back(k);
+        }
+    }
+    return v;
+}
+
 static uint32 g_nco = 0;
 static bool g_main_thread_as_sched;
 
@@ -334,12 +983,20 @@ SchedManager::SchedManager() {
         _next = [](const co::vector<Sched*>& v) { return v[0]; };
     }
 
+    const auto cpus = sched_cpus();
     for (uint32 i = 0; i < n; ++i) {
-        Sched* sched = co::_make_static<Sched>(i, n, m, s);
-        if (i != 0 || !g_main_thread_as_sched) sched->start();
+        const int cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
+        Sched* sched = co::_make_static<Sched>(i, n, m, s, cpu);
+        if (i != 0 || !g_main_thread_as_sched) {
+            sched->start();
+        } else {
+            sched->init(); // the main thread runs as the scheduler
+        }
         _scheds.push_back(sched);
     }
 
+    if (FLG_co_watchdog_ms > 0) _watchdog.start(_scheds);
+
     is_active() = true;
 }
 
@@ -358,6 +1015,51 @@ inline SchedManager* sched_man() {
     return g_sched_man;
 }
 
+void SchedManager::wake_idle_sched(Sched* s) {
+    const uint32 n = (uint32)_scheds.size();
+    uint32 i = s->id();
+    for (uint32 k = 1; k < n; ++k) {
+        if (++i == n) i = 0;
+        if (_scheds[i]->waiting()) {
+            _scheds[i]->signal();
+            return;
+        }
+    }
+}
+
+void Sched::add_steal_task(Closure* cb) {
+    const size_t n = _task_mgr.add_steal_task(cb);
+    this->wakeup();
+
+    // tasks added before have not been picked up yet, this scheduler may be
+    // busy, wake up an idle one to steal tasks from it.
+    if (n > 0) sched_man()->wake_idle_sched(this);
+}
+
+void Sched::add_new_tasks(Closure* const* cbs, size_t n) {
+    if (!FLG_co_steal) {
+        if (_task_mgr.add_new_tasks(cbs, n)) this->wakeup();
+        return;
+    }
+    const size_t m = _task_mgr.add_steal_tasks(cbs, n);
+    this->wakeup();
+    if (m + n > 1) sched_man()->wake_idle_sched(this);
+}
+
+size_t Sched::steal_tasks(co::vector<task_t>& tasks) {
+    auto& scheds = sched_man()->scheds();
+    uint32 i = _id;
+    for (uint32 k = 1; k < _sched_num; ++k) {
+        if (++i == _sched_num) i = 0;
+        auto& tm = scheds[i]->_task_mgr;
+        if (tm.has_steal_tasks()) {
+            const size_t n = tm.steal_tasks(tasks);
+            if (n > 0) return n;
+        }
+    }
+    return 0;
+}
+
 static int g_sched_nifty;
 SchedInitializer::SchedInitializer() {
     if (g_sched_nifty++ == 0) {
@@ -369,6 +1071,7 @@ SchedInitializer::~SchedInitializer() {
 }
 
 void SchedManager::stop() {
+    _watchdog.stop();
     for (size_t i = 0; i < _scheds.size(); ++i) {
         _scheds[i]->stop();
     }
@@ -378,7 +1081,28 @@ void SchedManager::stop() {
 } // xx
 
 void go(Closure* cb) {
-    xx::sched_man()->next_sched()->add_new_task(cb);
+    const auto s = xx::sched_man()->next_sched();
+    FLG_co_steal ? s->add_steal_task(cb) : s->add_new_task(cb);
+}
+
+void go_stack(uint32 stack_size, Closure* cb) {
+    const auto s = xx::sched_man()->next_sched();
+    s->add_new_task(cb, stack_size ? stack_size : FLG_co_stack_size);
+}
+
+void go_batch(Closure* const* cbs, size_t n) {
+    auto& s = xx::sched_man()->scheds();
+    const size_t k = s.size();
+    const size_t o = xx::sched_man()->next_sched()->id();
+    for (size_t i = 0; i < k; ++i) {
+        const size_t b = i * n / k;
+        const size_t e = (i + 1) * n / k;
+        if (b < e) s[(o + i) % k]->add_new_tasks(cbs + b, e - b);
+    }
+}
+
+void go_prio(Closure* cb) {
+    xx::sched_man()->next_sched()->add_new_task(cb, 0, 1);
 }
 
 void co::Sched::go(Closure* cb) {
@@ -393,6 +1117,14 @@ const co::vector<co::Sched*>& scheds() {
     return (co::vector<co::Sched*>&) xx::sched_man()->scheds();
 }
 
+co::vector<sched_stat> sched_stats() {
+    auto& s = xx::sched_man()->scheds();
+    co::vector<sched_stat> v(s.size());
+    v.resize(s.size());
+    for (size_t i = 0; i < s.size(); ++i) s[i]->get_stat(v[i]);
+    return v;
+}
+
 int sched_num() {
     return xx::is_active() ? (int)xx::sched_man()->scheds().size() : os::cpunum();
 }
@@ -453,6 +1185,18 @@ void yield() {
     s->yield();
 }
 
+void maybe_yield() {
+    const auto s = xx::gSched;
+    if (s) {
+        if (s->slice_expired()) {
+            s->add_ready_task(s->running());
+            s->yield();
+        } else if (unlikely(!xx::g_sched_man->watchdog().started())) {
+            xx::g_sched_man->watchdog().start(xx::g_sched_man->scheds());
+        }
+    }
+}
+
 void resume(void* p) {
     const auto co = (xx::Coroutine*)p;
     co->sched->add_ready_task(co);
@@ -460,7 +1204,7 @@ void resume(void* p) {
 
 void sleep(uint32 ms) {
     const auto s = xx::gSched;
-    s ? s->sleep(ms) : sleep::ms(ms);
+    s ? (void)s->sleep_cancelable(ms) : sleep::ms(ms);
 }
 
 bool timeout() {
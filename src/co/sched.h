@@ -12,6 +12,7 @@
 #include "co/stl.h"
 #include "co/time.h"
 #include "co/closure.h"
+#include "co/clist.h"
 #include "co/fastream.h"
 #include "context/context.h"
 
@@ -23,10 +24,23 @@
 #include "epoll/kqueue.h"
 #endif
 
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
 DEC_uint32(co_sched_num);
 DEC_uint32(co_stack_num);
 DEC_uint32(co_stack_size);
 DEC_bool(co_sched_log);
+DEC_bool(co_steal);
+DEC_bool(co_timer_wheel);
+DEC_bool(co_dedicated_stack);
+DEC_uint32(co_stats_log_ms);
+DEC_string(co_sched_cpus);
+DEC_uint32(co_prio_quota);
+DEC_uint32(co_watchdog_ms);
+DEC_uint32(co_time_slice_ms);
+DEC_uint32(co_pool_idle_blocks);
 
 #define SCHEDLOG DLOG_IF(FLG_co_sched_log)
 
@@ -42,6 +56,7 @@ static SchedInitializer g_sched_initializer;
 
 class Sched;
 struct Coroutine;
+struct group_t;
 typedef co::multimap<int64, Coroutine*>::iterator timer_id_t;
 
 enum state_t : uint8 {
@@ -68,6 +83,26 @@ struct Stack {
     char* p;       // stack pointer 
     char* top;     // stack top
     Coroutine* co; // coroutine owns this stack
+    uint32 size;   // size of a dedicated stack, 0 for a shared stack
+};
+
+// Pool of dedicated stacks. Each stack is mmaped with a guard page below it,
+// and it is cached here for reuse when the coroutine terminates.
+class StackPool {
+  public:
+    static const uint32 N = 64; // max stacks cached
+
+    StackPool() : _stacks() {}
+    ~StackPool();
+
+    // pop a stack of @size bytes (page aligned) from the pool
+    Stack* pop(uint32 size);
+
+    // push a stack back to the pool, free it if the pool is full
+    void push(Stack* s);
+
+  private:
+    co::vector<Stack*> _stacks; // cached stacks
 };
 
 struct Buffer {
@@ -116,11 +151,70 @@ struct Buffer {
     H* _h;
 };
 
+// Cache of buffers for saving stack data, in size classes of power of 2 from
+// 256B to 1MB. A buffer is owned by a coroutine until the coroutine ends, or it
+// needs a larger one. Free buffers in a class are trimmed to the high-water mark
+// of buffers in use since the last trim, those larger than 1MB are not cached.
+class BufferPool {
+  public:
+    static const uint32 B = 8;  // the smallest class is 1 << B bytes
+    static const uint32 C = 13; // number of classes
+
+    BufferPool();
+    ~BufferPool();
+
+    // Get an empty buffer (Buffer::H) with capacity at least @n, and store it in @p.
+    // Return true if the buffer was taken from the cache.
+    bool pop(size_t n, void** p);
+
+    // give back a buffer got from pop()
+    void push(void* p);
+
+    // free buffers more than needed to reach the high-water mark of each class
+    void trim();
+
+    // number of free buffers in the cache
+    size_t size() const { return _n; }
+
+  private:
+    struct class_t {
+        co::vector<void*> bufs; // free buffers
+        uint32 used;            // buffers in use
+        uint32 hw;              // max buffers in use since the last trim
+    };
+    class_t _c[C];
+    size_t _n; // number of free buffers
+};
+
+// timer node in the timer wheel
+struct timer_node_t : co::clink {
+    Coroutine* co; // coroutine waiting for the timer
+    int64 expire;  // expire time in ms
+    uint32 slot;   // slot in the wheel, -1 if the timer is not in the wheel
+};
+
+// values of co::coroutine_local in a coroutine, indexed by the keys
+struct Locals {
+    struct value_t {
+        void* p;             // the value, null if not set
+        void (*del)(void*);  // to destroy the value
+    };
+    // size of Locals with room for @n values
+    static size_t bytes(uint32 n) { return offsetof(Locals, v) + n * sizeof(value_t); }
+
+    uint32 n;     // capacity of v
+    value_t v[1]; // n values actually
+};
+
 struct Coroutine {
     Coroutine() = delete;
     ~Coroutine() = delete;
 
     uint32 id;        // coroutine id
+    uint8 prio;       // 1 if the coroutine is in the high priority lane
+    uint8 cancelled;  // 1 if the task group of the coroutine was cancelled
+    uint8 cancelable; // 1 if the coroutine is in a wait that can be cancelled
+    uint32 cancels;   // requests to cancel the coroutine not handled yet
     tb_context_t ctx; // coroutine context, points to the stack bottom
     Closure* cb;      // coroutine function
     Sched* sched;     // scheduler this coroutine runs in
@@ -130,169 +224,434 @@ struct Coroutine {
         void* pbuf;
     };
     waitx_t* waitx;   // waiting context
-    union { timer_id_t it;  char _dummy2[sizeof(timer_id_t)]; };
+    Locals* locals;   // coroutine-local values
+    group_t* group;   // task group this coroutine runs in
+    Coroutine* next;  // for the queue of ready coroutines
+    union {
+        timer_id_t it;  // timer in the multimap
+        timer_node_t tn; // timer in the timer wheel
+    };
 };
 
+#ifdef _MSC_VER
+inline uint32 _find_lsb(uint32 x) { /* x != 0 */
+    unsigned long r;
+    _BitScanForward(&r, x);
+    return r;
+}
+#else
+inline uint32 _find_lsb(uint32 x) { /* x != 0 */
+    return __builtin_ctz(x);
+}
+#endif
+
+// Coroutines are allocated in blocks of N, and the id of a coroutine is its
+// index in the pool. Each block has an intrusive free list linked by
+// Coroutine::next, and a bitmap marks the blocks that have free slots.
+// Coroutines are taken from the lowest such block, so that blocks at the top
+// drain under churn. Idle blocks more than co_pool_idle_blocks are returned
+// to the OS.
 class CoroutinePool {
   public:
     static const int E = 12;
     static const int N = 1 << E; // max coroutines per block
-    static const int M = 256;
+    static const int M = 64;     // number of blocks added each time the pool grows
 
-    CoroutinePool()
-        : _c(0), _o(0), _v(M), _use_count(M) {
-        _v.resize(M);
-        _use_count.resize(M);
+    CoroutinePool() : _idle(0) {
+        this->grow();
     }
 
-    ~CoroutinePool() {
-        for (size_t i = 0; i < _v.size(); ++i) {
-            if (_v[i]) ::free(_v[i]);
+    ~CoroutinePool();
+
+    Coroutine* pop() {
+        const uint32 q = this->find_block();
+        blk_t& b = _blks[q];
+        if (!b.p) {
+            b.p = this->new_block();
+        } else if (b.used == 0 && q != 0) {
+            --_idle;
+        }
+
+        Coroutine* co;
+        if (b.free) {
+            co = b.free;
+            b.free = co->next;
+            co->ctx = 0;
+        } else {
+            co = &b.p[b.o];
+            co->id = (q << E) + b.o++;
         }
-        _v.clear();
+        if (++b.used == N) _bits[q >> 5] &= ~(1u << (q & 31));
+        return co;
     }
 
-    Coroutine* pop() {
-        int id = 0;
-        if (!_v0.empty()) { id = _v0.pop_back(); goto reuse; }
-        if (!_vc.empty()) { id = _vc.pop_back(); goto reuse; }
-        if (_o < N) goto newco;
-        _c = !_blks.empty() ? *_blks.begin() : _c + 1;
-        if (!_blks.empty()) _blks.erase(_blks.begin());
-        _o = 0;
-
-      newco:
-        {
-            if (_c < _v.size()) {
-                if (!_v[_c]) _v[_c] = (Coroutine*) ::calloc(N, sizeof(Coroutine));
+    void push(Coroutine* co) {
+        const uint32 q = co->id >> E;
+        blk_t& b = _blks[q];
+        co->next = b.free;
+        b.free = co;
+        if (b.used-- == N) _bits[q >> 5] |= 1u << (q & 31);
+        if (b.used == 0 && q != 0) {
+            if (_idle < FLG_co_pool_idle_blocks) {
+                ++_idle;
             } else {
-                const int c = god::align_up<M>(_c + 1);
-                _v.resize(c);
-                _use_count.resize(c);
-                _v[_c] = (Coroutine*) ::calloc(N, sizeof(Coroutine));
+                this->del_block(b.p);
+                b.p = 0;
+                b.free = 0;
+                b.o = 0;
             }
-
-            auto& co = _v[_c][_o];
-            co.id = (_c << E) + _o++;
-            _use_count[_c]++;
-            return &co;
         }
+    }
 
-      reuse:
-        {
-            const int q = id >> E;
-            const int r = id & (N - 1);
-            auto& co = _v[q][r];
-            co.ctx = 0;
-            _use_count[q]++;
-            return &co;
-        }
+    Coroutine& operator[](int i) const {
+        return _blks[i >> E].p[i & (N - 1)];
     }
 
-    void push(Coroutine* co) {
-        const int id = co->id;
-        const int q = id >> E;
-        if (q == 0) {
-            if (_v0.capacity() == 0) _v0.reserve(N);
-            _v0.push_back(id);
-            goto end;
+  private:
+    struct blk_t {
+        Coroutine* p;    // N coroutines, null if the memory was not allocated
+        Coroutine* free; // free list of coroutines in this block
+        uint32 used;     // number of coroutines in use
+        uint32 o;        // coroutines in [o, N) have never been used
+    };
+
+    // find the lowest block with free slots, grow the pool if there is none
+    uint32 find_block() {
+        for (size_t i = 0; i < _bits.size(); ++i) {
+            if (_bits[i]) return (uint32)(i << 5) + _find_lsb(_bits[i]);
         }
-        if (q == _c) {
-            if (_vc.capacity() == 0) _vc.reserve(N);
-            _vc.push_back(id);
-            goto end;
+        const uint32 q = (uint32)_blks.size();
+        this->grow();
+        return q;
+    }
+
+    void grow() {
+        _blks.append(M, blk_t{ 0, 0, 0, 0 });
+        _bits.append(M / 32, ~0u);
+    }
+
+    // memory of blocks is mapped from the OS directly, so that it can be returned
+    Coroutine* new_block();
+    void del_block(Coroutine* p);
+
+    co::vector<blk_t> _blks;
+    co::vector<uint32> _bits; // bit set for blocks with free slots
+    uint32 _idle;             // number of allocated blocks with no coroutine in use
+};
+
+// Lock-free multi-producer single-consumer queue. T must have a member `T* next`.
+// Producers push nodes to the head of a singly linked list, and the consumer
+// takes the whole list at once and reverses it, so nodes come out in FIFO order.
+template<typename T>
+class mpsc_queue {
+  public:
+    mpsc_queue() : _head(0) {}
+    ~mpsc_queue() = default;
+
+    // push a node to the queue, return true if the queue was empty before (thread-safe)
+    bool push(T* x) {
+        T* h = atomic_load(&_head, mo_relaxed);
+        while (true) {
+            x->next = h;
+            const T* const o = h;
+            h = atomic_cas(&_head, h, x, mo_seq_cst, mo_relaxed);
+            if (h == o) return h == 0;
         }
+    }
 
-      end:
-        if (--_use_count[q] == 0) {
-            ::free(_v[q]);
-            _v[q] = 0;
-            if (q != _c) {
-                _blks.insert(q);
-            } else {
-                _vc.clear();
-                _o = 0;
-                if (!_blks.empty() && *_blks.begin() < _c) {
-                    _blks.insert(_c);
-                    _c = *_blks.begin();
-                    _blks.erase(_blks.begin());
-                }
-            }
+    // push a list of nodes linked by next, from @first (the newest) to @last (the
+    // oldest), return true if the queue was empty before (thread-safe)
+    bool push_list(T* first, T* last) {
+        T* h = atomic_load(&_head, mo_relaxed);
+        while (true) {
+            last->next = h;
+            const T* const o = h;
+            h = atomic_cas(&_head, h, first, mo_seq_cst, mo_relaxed);
+            if (h == o) return h == 0;
         }
     }
 
-    Coroutine& operator[](int i) const {
-        const int q = i >> E;
-        const int r = i & (N - 1);
-        return _v[q][r];
+    bool empty() const { return atomic_load(&_head) == 0; }
+
+    // pop all nodes in FIFO order, called only by the consumer
+    T* pop_all() {
+        if (atomic_load(&_head, mo_relaxed) == 0) return 0;
+        T* h = atomic_swap(&_head, (T*)0, mo_acquire);
+        T* r = 0;
+        while (h) {
+            T* const next = h->next;
+            h->next = r;
+            r = h;
+            h = next;
+        }
+        return r;
     }
 
   private:
-    int _c; // current block
-    int _o; // offset in the current block [0, S)
-    co::vector<Coroutine*> _v;
-    co::vector<int> _use_count;
-    co::vector<int> _v0; // id of coroutine in _v[0]
-    co::vector<int> _vc; // id of coroutine in _v[_c]
-    co::set<int> _blks; // blocks available
+    T* _head;
+};
+
+// a request to cancel a coroutine in the task group @g
+struct cancel_t {
+    cancel_t* next;
+    Coroutine* co;
+    group_t* g;
+};
+
+// release a reference of the task group, defined in co.cc
+void unref_group(group_t* g);
+
+// a new task, with the size of its dedicated stack
+struct task_t {
+    Closure* cb;
+    uint32 stack_size; // 0 if the coroutine runs on a shared stack
+    uint8 prio;        // 1 for the high priority lane
 };
 
-// Task may be added from any thread. We need a mutex here.
+// Task may be added from any thread. New tasks and ready tasks are pushed to
+// lock-free queues, and the mutex is used only for tasks that may be stolen.
+// Tasks in the high priority lane have their own queues, they are never stolen.
 class alignas(co::cache_line_size) TaskManager {
   public:
-    TaskManager() : _mtx(), _new_tasks(512), _ready_tasks(512) {}
+    TaskManager() : _mtx(), _steal_tasks(512), _nsteal(0) {}
     ~TaskManager() = default;
 
-    void add_new_task(Closure* cb) {
+    // return true if the queue was empty before
+    bool add_new_task(Closure* cb, uint32 stack_size, uint8 prio) {
+        cb->stack_size = stack_size;
+        return prio ? _prio_new_tasks.push(cb) : _new_tasks.push(cb);
+    }
+
+    // add @n (> 0) new tasks in one push, return true if the queue was empty before
+    bool add_new_tasks(Closure* const* cbs, size_t n) {
+        Closure* first = 0;
+        for (size_t i = 0; i < n; ++i) {
+            cbs[i]->next = first;
+            cbs[i]->stack_size = 0;
+            first = cbs[i];
+        }
+        return _new_tasks.push_list(first, cbs[0]);
+    }
+
+    // add a new task that is not bound to this scheduler, it may be stolen by 
+    // other schedulers. Return number of such tasks before this one was added.
+    size_t add_steal_task(Closure* cb) {
         std::lock_guard<std::mutex> g(_mtx);
-        _new_tasks.push_back(cb);
+        _steal_tasks.push_back(cb);
+        atomic_store(&_nsteal, _steal_tasks.size());
+        return _steal_tasks.size() - 1;
     }
 
-    void add_ready_task(Coroutine* co) {
+    // add @n stealable tasks with a single lock, return number of such tasks before
+    size_t add_steal_tasks(Closure* const* cbs, size_t n) {
+        std::lock_guard<std::mutex> g(_mtx);
+        const size_t s = _steal_tasks.size();
+        _steal_tasks.append(cbs, n);
+        atomic_store(&_nsteal, _steal_tasks.size());
+        return s;
+    }
+
+    // check whether there are tasks to steal, no lock here
+    bool has_steal_tasks() const {
+        return atomic_load(&_nsteal, mo_relaxed) != 0;
+    }
+
+    // steal half of the stealable tasks (the oldest ones), return number of tasks stolen
+    size_t steal_tasks(co::vector<task_t>& tasks) {
         std::lock_guard<std::mutex> g(_mtx);
-        _ready_tasks.push_back(co);
+        const size_t s = _steal_tasks.size();
+        const size_t n = (s + 1) >> 1;
+        if (n > 0) {
+            Closure** const p = _steal_tasks.data();
+            for (size_t i = 0; i < n; ++i) tasks.push_back(task_t{ p[i], 0, 0 });
+            memmove(p, p + n, (s - n) * sizeof(Closure*));
+            _steal_tasks.resize(s - n);
+            atomic_store(&_nsteal, s - n, mo_relaxed);
+        }
+        return n;
+    }
+
+    // return true if the queue was empty before
+    bool add_ready_task(Coroutine* co) {
+        return co->prio ? _prio_ready_tasks.push(co) : _ready_tasks.push(co);
+    }
+
+    // return true if the queue was empty before
+    bool add_cancel(cancel_t* x) {
+        return _cancels.push(x);
+    }
+
+    // check whether there are tasks in the high priority lane
+    bool has_prio_tasks() const {
+        return !_prio_new_tasks.empty() || !_prio_ready_tasks.empty();
+    }
+
+    // check whether there are requests to cancel coroutines
+    bool has_cancels() const { return !_cancels.empty(); }
+
+    // check whether there are no tasks, called only in the scheduler thread
+    bool empty() const {
+        return _new_tasks.empty() && _ready_tasks.empty() && !has_prio_tasks() &&
+               !has_steal_tasks() && !has_cancels();
+    }
+
+    // get requests to cancel coroutines in FIFO order, called only in the scheduler thread
+    cancel_t* get_cancels() { return _cancels.pop_all(); }
+
+    // get tasks in the high priority lane, called only in the scheduler thread
+    void get_prio_tasks(
+        co::vector<task_t>& new_tasks,
+        co::vector<Coroutine*>& ready_tasks
+    ) {
+        this->pop_new_tasks(_prio_new_tasks, new_tasks, 1);
+        for (auto x = _prio_ready_tasks.pop_all(); x;) {
+            auto co = x;
+            x = x->next;
+            ready_tasks.push_back(co);
+        }
     }
 
+    // called only in the scheduler thread
     void get_all_tasks(
-        co::vector<Closure*>& new_tasks,
+        co::vector<task_t>& new_tasks,
         co::vector<Coroutine*>& ready_tasks
     ) {
-        std::lock_guard<std::mutex> g(_mtx);
-        if (!_new_tasks.empty()) _new_tasks.swap(new_tasks);
-        if (!_ready_tasks.empty()) _ready_tasks.swap(ready_tasks);
+        this->pop_new_tasks(_new_tasks, new_tasks, 0);
+        for (auto x = _ready_tasks.pop_all(); x;) {
+            auto co = x;
+            x = x->next;
+            ready_tasks.push_back(co);
+        }
+        if (this->has_steal_tasks()) {
+            std::lock_guard<std::mutex> g(_mtx);
+            for (size_t i = 0; i < _steal_tasks.size(); ++i) {
+                new_tasks.push_back(task_t{ _steal_tasks[i], 0, 0 });
+            }
+            _steal_tasks.clear();
+            atomic_store(&_nsteal, 0, mo_relaxed);
+        }
     }
- 
+
   private:
-    std::mutex _mtx;
-    co::vector<Closure*> _new_tasks;
-    co::vector<Coroutine*> _ready_tasks;
+    static void pop_new_tasks(mpsc_queue<Closure>& q, co::vector<task_t>& tasks, uint8 prio) {
+        for (auto x = q.pop_all(); x;) {
+            auto cb = x;
+            x = x->next;
+            tasks.push_back(task_t{ cb, cb->stack_size, prio });
+        }
+    }
+
+    mpsc_queue<Closure> _new_tasks;
+    mpsc_queue<Coroutine> _ready_tasks;
+    mpsc_queue<Closure> _prio_new_tasks;
+    mpsc_queue<Coroutine> _prio_ready_tasks;
+    mpsc_queue<cancel_t> _cancels;
+    std::mutex _mtx; // for _steal_tasks
+    co::vector<Closure*> _steal_tasks; // tasks that may be stolen by other schedulers
+    size_t _nsteal; // size of _steal_tasks
 };
 
-inline fastream& operator<<(fastream& fs, const timer_id_t& id) {
-    return fs << *(void**)(&id);
-}
+// Hierarchical timer wheel like that in the Linux kernel, with a precision of 1ms.
+// The first level has 256 slots of 1ms, and each of the other 4 levels has 64
+// slots, covering 2^14, 2^20, 2^26 and 2^32 ms. Timers in a higher level are
+// cascaded down to the lower level when its time comes. Nodes of timers are
+// embedded in the coroutines, adding or deleting a timer is O(1) and needs no
+// memory allocation.
+class TimerWheel {
+  public:
+    static const uint32 N0 = 256; // number of slots in the first level
+    static const uint32 N = 64;   // number of slots in the higher levels
+
+    TimerWheel() : _jiffies(now::ms()), _size(0) {
+        memset(_bits, 0, sizeof(_bits));
+    }
+    ~TimerWheel() = default;
+
+    void add(timer_node_t* n, int64 expire);
+
+    void del(timer_node_t* n) {
+        const uint32 slot = n->slot;
+        _slots[slot].erase(n);
+        if (slot < N0 && _slots[slot].empty()) _bits[slot >> 5] &= ~(1u << (slot & 31));
+        n->slot = (uint32)-1;
+        --_size;
+    }
+
+    // get expired timers, return time(ms) to wait for the next timeout
+    uint32 expire(int64 now_ms, co::vector<Coroutine*>& res);
+
+    bool empty() const { return _size == 0; }
+    size_t size() const { return _size; }
+
+    // move the wheel to the current time when it is empty
+    void reset(int64 now_ms) { _jiffies = now_ms; }
+
+  private:
+    // move timers in slot @i of level @l down to the lower levels, return @i
+    uint32 cascade(uint32 l, uint32 i);
+
+    // find the first non-empty slot in [i, N0) of the first level, -1 if not found
+    int next_slot(uint32 i) const;
+
+  private:
+    int64 _jiffies; // time(ms) of the next slot to process
+    size_t _size;   // number of timers
+    uint32 _bits[N0 / 32]; // bitmap of non-empty slots in the first level
+    co::clist _slots[N0 + 4 * N];
+};
 
 // Timer must be added in the scheduler thread. We need no lock here.
+// Timers are kept in a multimap, or in a timer wheel if co_timer_wheel is true.
 class TimerManager {
   public:
-    TimerManager() : _timer(), _it(_timer.end()) {}
-    ~TimerManager() = default;
+    TimerManager()
+        : _wheel(FLG_co_timer_wheel ? co::make<TimerWheel>() : 0), _timer(), _it(_timer.end()) {
+    }
+
+    ~TimerManager() {
+        if (_wheel) co::del(_wheel);
+    }
 
-    timer_id_t add_timer(uint32 ms, Coroutine* co) {
-        return _it = _timer.emplace_hint(_it, now::ms() + ms, co);
+    // initialize the timer for a new coroutine
+    void init_timer(Coroutine* co) {
+        if (_wheel) {
+            co->tn.co = co;
+            co->tn.slot = (uint32)-1;
+        } else {
+            new(&co->it) timer_id_t(_timer.end());
+        }
     }
 
-    void del_timer(const timer_id_t& it) {
-        if (_it == it) ++_it;
-        _timer.erase(it);
+    // add a timer for the coroutine, a coroutine has at most one timer
+    void add_timer(uint32 ms, Coroutine* co) {
+        if (_wheel) {
+            const int64 now_ms = now::ms();
+            if (_wheel->empty()) _wheel->reset(now_ms);
+            _wheel->add(&co->tn, now_ms + ms);
+        } else {
+            co->it = _it = _timer.emplace_hint(_it, now::ms() + ms, co);
+        }
     }
 
-    timer_id_t end() { return _timer.end(); }
+    // delete the timer of the coroutine if it exists
+    void del_timer(Coroutine* co) {
+        if (_wheel) {
+            if (co->tn.slot != (uint32)-1) _wheel->del(&co->tn);
+        } else if (co->it != _timer.end()) {
+            if (_it == co->it) ++_it;
+            _timer.erase(co->it);
+            co->it = _timer.end();
+        }
+    }
 
     // get timedout coroutines, return time(ms) to wait for the next timeout
     uint32 check_timeout(co::vector<Coroutine*>& res);
 
+    // number of pending timers
+    size_t size() const { return _wheel ? _wheel->size() : _timer.size(); }
+
   private:
+    TimerWheel* _wheel;
     co::multimap<int64, Coroutine*> _timer;        // timed-wait tasks: <time_ms, co>
     co::multimap<int64, Coroutine*>::iterator _it; // make insert faster with this hint
 };
@@ -300,9 +659,15 @@ class TimerManager {
 // coroutine scheduler, loop in a single thread
 class Sched {
   public:
-    Sched(uint32 id, uint32 sched_num, uint32 stack_num, uint32 stack_size);
+    // @cpu: cpu to pin the scheduler thread to, -1 for no pinning
+    Sched(uint32 id, uint32 sched_num, uint32 stack_num, uint32 stack_size, int cpu);
     ~Sched();
 
+    // Pin the current thread to the cpu, and allocate resources of the scheduler.
+    // It is called in the scheduler thread, so that memory used by the scheduler
+    // is first touched and allocated in the local NUMA node.
+    void init();
+
     // id of this scheduler
     uint32 id() const { return _id; }
 
@@ -323,35 +688,106 @@ class Sched {
     // resume a coroutine
     void resume(Coroutine* co);
 
-    // suspend the current coroutine
+    // Suspend the current coroutine. The context of the scheduler is updated
+    // when the coroutine is resumed, as resume() may be called at different
+    // stack depths in the scheduler thread.
     void yield() {
-        tb_context_jump(_main_co->ctx, _running);
+        _main_co->ctx = tb_context_jump(_main_co->ctx, _running).ctx;
     }
 
+    // Suspend the current coroutine in a wait that handles timeouts. If the task
+    // group of the coroutine is cancelled, the wait ends as if it has timed out.
+    // Return false on timeout or cancellation.
+    bool yield_cancelable() {
+        Coroutine* const co = _running;
+        if (co->cancelled && this->cancel_wait(co)) return false;
+        co->cancelable = 1;
+        this->yield();
+        co->cancelable = 0;
+        return !_timeout;
+    }
+
+    // cancel the coroutine if it still runs in the task group @g (thread-safe)
+    void cancel(Coroutine* co, group_t* g);
+
     // add a new task to run as a coroutine later (thread-safe)
-    void add_new_task(Closure* cb) {
-        _task_mgr.add_new_task(cb);
-        _x.epoll->signal();
+    //   - @stack_size: size of the dedicated stack, 0 for a shared stack.
+    //   - @prio: 1 for the high priority lane, 0 for the normal lane.
+    void add_new_task(Closure* cb, uint32 stack_size=0, uint8 prio=0) {
+        if (_task_mgr.add_new_task(cb, stack_size, prio)) this->wakeup();
+    }
+
+    // add a new task which may be stolen by an idle scheduler (thread-safe)
+    void add_steal_task(Closure* cb);
+
+    // add @n new tasks with a single enqueue and at most one wakeup (thread-safe)
+    void add_new_tasks(Closure* const* cbs, size_t n);
+
+    // steal new tasks from other schedulers, return number of tasks stolen
+    size_t steal_tasks(co::vector<task_t>& tasks);
+
+    // check whether the scheduler is waiting for events (idle)
+    bool waiting() const { return atomic_load(&_x.waiting, mo_relaxed); }
+
+    // check whether a coroutine is running, may be called from other threads
+    bool busy() const {
+        return !this->waiting() && atomic_load(&_running, mo_relaxed) != 0;
+    }
+
+    // number of context switches, may be called from other threads
+    uint64 switches() const { return atomic_load(&_stat.switches, mo_relaxed); }
+
+    // The time slice of the current coroutine is used up, called by the watchdog.
+    // @sw is the number of context switches when the coroutine was resumed.
+    void preempt(uint64 sw) { atomic_store(&_x.preempt, sw, mo_relaxed); }
+
+    // check whether the time slice of the current coroutine is used up
+    bool slice_expired() const {
+        return atomic_load(&_x.preempt, mo_relaxed) == _stat.switches;
+    }
+
+    // The current coroutine has run for @ms without yielding, called by the
+    // watchdog. Log it and dump the backtrace of the scheduler thread if we can.
+    void overrun(int64 ms);
+
+    // wake up the scheduler (thread-safe)
+    void signal() { _x.epoll->signal(); }
+
+    // Wake up the scheduler after a task was added (thread-safe). We needn't
+    // signal the epoll if the scheduler is running, as it will check the tasks
+    // before waiting. The seq_cst operations here and in loop() ensure that
+    // either the scheduler sees the task, or we see it waiting.
+    void wakeup() {
+        if (atomic_load(&_x.waiting)) _x.epoll->signal();
     }
 
     // add a coroutine ready to resume (thread-safe)
     void add_ready_task(Coroutine* co) {
-        _task_mgr.add_ready_task(co);
-        _x.epoll->signal();
+        if (_task_mgr.add_ready_task(co)) this->wakeup();
     }
 
     // sleep for milliseconds in the current coroutine 
     void sleep(uint32 ms) {
         if (_wait_ms > ms) _wait_ms = ms;
-        (void) _timer_mgr.add_timer(ms, _running);
+        _timer_mgr.add_timer(ms, _running);
         this->yield();
     }
 
+    // Like sleep(), but return at once if the task group of the coroutine is
+    // cancelled. Return false on cancellation.
+    bool sleep_cancelable(uint32 ms) {
+        if (_running->cancelled) return false;
+        if (_wait_ms > ms) _wait_ms = ms;
+        _timer_mgr.add_timer(ms, _running);
+        this->yield_cancelable();
+        return !_running->cancelled;
+    }
+
     // add a timer for the current coroutine
     void add_timer(uint32 ms) {
         if (_wait_ms > ms) _wait_ms = ms;
-        _running->it = _timer_mgr.add_timer(ms, _running);
-        SCHEDLOG << "co(" << _running << ") add timer " << _running->it << " (" << ms << " ms)" ;
+        _timer_mgr.add_timer(ms, _running);
+        SCHEDLOG << "co(" << _running << ") add timer (" << ms << " ms)" ;
     }
 
     // check whether the current coroutine has timed out
@@ -387,8 +823,24 @@ class Sched {
         return atomic_load(&_cputime, mo_relaxed);
     }
 
-    // start the scheduler thread
-    void start() { std::thread(&Sched::loop, this).detach(); }
+    // get runtime statistics of this scheduler (thread-safe)
+    void get_stat(co::sched_stat& s) const {
+        s.id = (int)_id;
+        s.coroutines = atomic_load(&_stat.coroutines, mo_relaxed);
+        s.switches = atomic_load(&_stat.switches, mo_relaxed);
+        s.stack_bytes = atomic_load(&_stat.stack_bytes, mo_relaxed);
+        s.ready = atomic_load(&_stat.ready, mo_relaxed);
+        s.timers = atomic_load(&_stat.timers, mo_relaxed);
+        s.wait_us = atomic_load(&_stat.wait_us, mo_relaxed);
+        s.run_us = atomic_load(&_stat.run_us, mo_relaxed);
+        s.io_events = atomic_load(&_stat.io_events, mo_relaxed);
+        s.overruns = atomic_load(&_stat.overruns, mo_relaxed);
+        s.buf_hits = atomic_load(&_stat.buf_hits, mo_relaxed);
+        s.buf_misses = atomic_load(&_stat.buf_misses, mo_relaxed);
+    }
+
+    // start the scheduler thread, return after the scheduler was initialized
+    void start();
 
     // stop the scheduler thread
     void stop();
@@ -400,39 +852,86 @@ class Sched {
     // entry function for coroutine
     static void main_func(tb_context_from_t from);
 
+    // Counters are written only by the scheduler thread, and may be read from
+    // other threads. No atomic read-modify-write operation is needed here.
+    static void stat_add(uint64& x, uint64 n) {
+        atomic_store(&x, x + n, mo_relaxed);
+    }
+
     // save stack for the coroutine
     void save_stack(Coroutine* co) {
         if (co) {
-            if (!co->pbuf && !_bufs.empty()) co->pbuf = _bufs.pop_back();
+            const size_t n = co->stack->top - (char*)co->ctx;
+            if (co->buf.capacity() < n) {
+                if (co->pbuf) _bufs.push(co->pbuf);
+                stat_add(_bufs.pop(n, &co->pbuf) ? _stat.buf_hits : _stat.buf_misses, 1);
+            }
             co->buf.clear();
-            co->buf.append(co->ctx, co->stack->top - (char*)co->ctx);
+            co->buf.append(co->ctx, n);
+            stat_add(_stat.stack_bytes, n);
         }
     }
 
+    // log statistics of this scheduler
+    void log_stat();
+
+    // destroy the coroutine-local values, called when the coroutine ends
+    static void del_locals(Coroutine* co);
+
+    // End the wait of a cancelled coroutine, remove its timer. Return false if
+    // it has been woken up by the event it waits for.
+    bool cancel_wait(Coroutine* co);
+
+    // handle requests to cancel coroutines in this scheduler
+    void cancel_tasks();
+
+    // check whether there are tasks in the high priority lane
+    bool has_prio_tasks() const {
+        return _prio_pos < _prio_cos.size() || _task_mgr.has_prio_tasks();
+    }
+
+    // Resume at most co_prio_quota tasks in the high priority lane. Tasks left
+    // over will be resumed next time, after at least one task in the normal lane.
+    void resume_prio_tasks();
+
+    // resume a coroutine in the normal lane, and then the high priority tasks if any
+    void resume_normal(Coroutine* co) {
+        this->resume(co);
+        if (this->has_prio_tasks()) this->resume_prio_tasks();
+    }
+
     // pop a Coroutine from the pool
-    Coroutine* new_coroutine(Closure* cb) {
+    Coroutine* new_coroutine(const task_t& task) {
         Coroutine* co = _co_pool.pop();
-        co->cb = cb;
-        if (!co->sched) {
-            co->sched = this;
+        co->cb = task.cb;
+        co->sched = this;
+        co->prio = task.prio;
+        co->group = 0;
+        co->cancelled = 0;
+        uint32 n = task.stack_size;
+        if (n == 0 && FLG_co_dedicated_stack) n = _stack_size;
+        if (n == 0) {
             co->stack = &_stack[co->id & (_stack_num - 1)];
+        } else {
+            co->stack = _stack_pool.pop(n);
+            co->stack->co = co;
         }
-        new(&co->it) timer_id_t(_timer_mgr.end());
+        _timer_mgr.init_timer(co);
+        stat_add(_stat.coroutines, 1);
         return co;
     }
 
+    // A coroutine with requests to cancel it not handled yet goes back to the
+    // pool in cancel_tasks(), as the requests still point to it. cb is cleared
+    // to mark that it has terminated.
     void recycle(Coroutine* co) {
-        co->it.~timer_id_t();
+        stat_add(_stat.coroutines, (uint64)-1);
+        if (co->stack->size) _stack_pool.push(co->stack);
         if (co->pbuf) {
-            if (co->buf.capacity() > 8192 || _bufs.size() >= 128) {
-                co->buf.reset();
-                goto end;
-            }
-            _bufs.push_back(co->pbuf);
+            _bufs.push(co->pbuf);
             co->pbuf = 0;
         }
-
-      end:
+        if (atomic_load(&co->cancels, mo_acquire) != 0) { co->cb = 0; return; }
         _co_pool.push(co);
     }
 
@@ -446,15 +945,18 @@ class Sched {
             co::sync_event ev;
             Epoll* epoll;
             bool stopped;
+            bool waiting; // waiting for events in epoll
+            uint64 preempt; // switches when the time slice was used up
         }_x;
         char _c1[co::cache_line_size];
     };
     TaskManager _task_mgr;
 
+    co::sched_stat _stat;
     TimerManager _timer_mgr;
     uint32 _wait_ms;     // time the epoll to wait for
     bool _timeout;
-    co::vector<void*> _bufs;
+    BufferPool _bufs;    // buffers for saving stack data
     CoroutinePool _co_pool;
     Coroutine* _running; // the current running coroutine
     Coroutine* _main_co; // save the main context
@@ -463,6 +965,40 @@ class Sched {
     uint32 _stack_num;   // number of stacks per scheduler
     uint32 _stack_size;  // size of the stack
     Stack* _stack;       // stack array
+    StackPool _stack_pool; // dedicated stacks
+    co::vector<task_t> _prio_new;     // new tasks in the high priority lane
+    co::vector<Coroutine*> _prio_cos; // coroutines in the high priority lane to resume
+    size_t _prio_pos;    // position of the next coroutine to resume in _prio_cos
+    int _cpu;            // cpu the scheduler thread is pinned to, -1 for none
+  #ifndef _WIN32
+    pthread_t _tid;      // the scheduler thread
+  #endif
+};
+
+// The watchdog thread checks the schedulers periodically. A scheduler is busy
+// in the same coroutine, if it is not waiting for events and no context switch
+// has happened since the last check. The time slice of the coroutine is used up
+// after co_time_slice_ms, and it is an overrun after co_watchdog_ms.
+class Watchdog {
+  public:
+    Watchdog() : _ev(), _done(), _state(0) {}
+    ~Watchdog() = default;
+
+    // start the watchdog thread if it is not running (thread-safe)
+    void start(const co::vector<Sched*>& scheds);
+
+    // check whether the watchdog thread has been started
+    bool started() const { return atomic_load(&_state, mo_relaxed) != 0; }
+
+    // stop the watchdog thread
+    void stop();
+
+  private:
+    void loop(const co::vector<Sched*>& scheds);
+
+    co::sync_event _ev;   // signaled to stop the thread
+    co::sync_event _done; // signaled when the thread is done
+    int _state;           // 0: not started, 1: running, 2: stopped
 };
 
 class SchedManager {
@@ -472,6 +1008,11 @@ class SchedManager {
 
     Sched* next_sched() const { return _next(_scheds); }
 
+    // wake up an idle scheduler other than @s, so that it can steal tasks from @s
+    void wake_idle_sched(Sched* s);
+
+    Watchdog& watchdog() { return _watchdog; }
+
     const co::vector<Sched*>& scheds() const {
         return _scheds;
     }
@@ -481,6 +1022,7 @@ class SchedManager {
   private:
     std::function<Sched*(const co::vector<Sched*>&)> _next;
     co::vector<Sched*> _scheds;
+    Watchdog _watchdog;
 };
 
 static bool g_is_active;
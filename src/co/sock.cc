@@ -122,7 +122,7 @@ sock_t accept(sock_t fd, void* addr, int* addrlen) {
       #endif
 
         if (errno == EWOULDBLOCK || errno == EAGAIN) {
-            ev.wait();
+            if (!ev.wait()) return -1;
         } else if (errno != EINTR) {
             return -1;
         }
@@ -120,7 +120,7 @@ sock_t accept(sock_t fd, void* addr, int* addrlen) {
     if (r == FALSE) {
         e = WSAGetLastError();
         if (e != ERROR_IO_PENDING) goto err;
-        ev.wait();
+        if (!ev.wait()) { e = co::error(); goto err; } // ECANCELED
     }
 
     // https://docs.microsoft.com/en-us/windows/win32/api/mswsock/nf-mswsock-acceptex
@@ -262,7 +262,7 @@ int recvfrom(sock_t fd, void* buf, int n, void* addr, int* addrlen, int ms) {
     }
 
     if (r == 0) {
-        if (!can_skip_iocp_on_success) ev.wait();
+        if (!can_skip_iocp_on_success && !ev.wait()) return -1;
     } else {
         e = WSAGetLastError();
         if (e == WSA_IO_PENDING) {
@@ -318,7 +318,7 @@ int sendto(sock_t fd, const void* buf, int n, const void* addr, int addrlen, int
     do {
         r = __sys_api(WSASendTo)(fd, &ev->buf, 1, &ev->n, 0, (const sockaddr*)addr, addrlen, &ev->ol, 0);
         if (r == 0) {
-            if (!can_skip_iocp_on_success) ev.wait();
+            if (!can_skip_iocp_on_success && !ev.wait()) return -1;
         } else {
             e = WSAGetLastError();
             if (e == WSA_IO_PENDING) {
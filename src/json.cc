@@ -98,6 +98,11 @@ char* alloc_string(const void* p, size_t n) {
     return s;
 }
 
+void fail_arena_write() {
+    fputs("a Json parsed into a co::arena can't be modified, use dup() to copy it\n", stderr);
+    abort();
+}
+
 inline void* alloc_array(void** p, uint32 n) {
     auto h = (Array::_H*) co::alloc(sizeof(Array::_H) + sizeof(void*) * n);
     h->cap = n;
@@ -130,19 +135,61 @@ inline _H* make_string(_A& a, const void* p, size_t n) {
     return new(a.alloc()) _H(p, n);
 }
 
+inline _H* make_null(_A&) { return 0; }
 inline _H* make_bool(_A& a, bool v) { return new(a.alloc()) _H(v); }
 inline _H* make_int(_A& a, int64 v) { return new(a.alloc()) _H(v); }
 inline _H* make_double(_A& a, double v) { return new(a.alloc()) _H(v); }
 inline _H* make_object(_A& a) { return new(a.alloc()) _H(Json::_obj_t()); }
 inline _H* make_array(_A& a)  { return new(a.alloc()) _H(Json::_arr_t()); }
+inline void* alloc_array(_A&, void** p, uint32 n) { return xx::alloc_array(p, n); }
+
+// nodes allocated from an arena are marked, Json::reset() leaves them to the arena
+inline _H* make_node(co::arena& a, uint32 type) {
+    _H* h = (_H*) a.alloc(sizeof(_H));
+    h->type = (uint16)type;
+    h->arena = 1;
+    return h;
+}
+
+inline char* make_key(co::arena& a, const void* p, size_t n) {
+    char* s = (char*) a.alloc(n + 1);
+    memcpy(s, p, n);
+    s[n] = '\0';
+    return s;
+}
+
+inline _H* make_string(co::arena& a, const void* p, size_t n) {
+    _H* h = make_node(a, Json::t_string);
+    h->size = (uint32)n;
+    h->s = make_key(a, p, n);
+    return h;
+}
+
+// null in an arena is a node too, so that writes to it are caught as well
+inline _H* make_null(co::arena& a) { _H* h = make_node(a, Json::t_null); h->p = 0; return h; }
+inline _H* make_bool(co::arena& a, bool v) { _H* h = make_node(a, Json::t_bool); h->b = v; return h; }
+inline _H* make_int(co::arena& a, int64 v) { _H* h = make_node(a, Json::t_int); h->i = v; return h; }
+inline _H* make_double(co::arena& a, double v) { _H* h = make_node(a, Json::t_double); h->d = v; return h; }
+inline _H* make_object(co::arena& a) { _H* h = make_node(a, Json::t_object); h->p = 0; return h; }
+inline _H* make_array(co::arena& a)  { _H* h = make_node(a, Json::t_array); h->p = 0; return h; }
+
+inline void* alloc_array(co::arena& a, void** p, uint32 n) {
+    auto h = (xx::Array::_H*) a.alloc(sizeof(xx::Array::_H) + sizeof(void*) * n);
+    h->cap = n;
+    h->size = n;
+    memcpy(h->p, p, sizeof(void*) * n);
+    return h;
+}
 
 // json parser
 //   @b: beginning of the string
 //   @e: end of the string
 // return the current position, or NULL on any error
+//   - A: xx::Alloc or co::arena, where the nodes are allocated from
+template<typename A>
 class Parser {
   public:
-    Parser() : _a(xx::jalloc()) {}
+    explicit Parser(A& n) : _a(xx::jalloc()), _n(n) {}
     ~Parser() = default;
 
     bool parse(S b, S e, void_ptr_t& v);
@@ -155,35 +202,40 @@ class Parser {
     S parse_null(S b, S e, void_ptr_t& v);
 
   private:
-    xx::Alloc& _a;
+    xx::Alloc& _a; // for the stacks of the parser
+    A& _n;
 };
 
-inline S Parser::parse_key(S b, S e, void_ptr_t& key) {
+template<typename A>
+inline S Parser<A>::parse_key(S b, S e, void_ptr_t& key) {
     if (*b++ != '"') return 0;
     S p = (S) memchr(b, '"', e - b);
-    if (p) key = make_key(_a, b, p - b);
+    if (p) key = make_key(_n, b, p - b);
     return p;
 }
 
-inline S Parser::parse_false(S b, S e, void_ptr_t& v) {
+template<typename A>
+inline S Parser<A>::parse_false(S b, S e, void_ptr_t& v) {
     if (e - b >= 5 && b[1] == 'a' && b[2] == 'l' && b[3] == 's' && b[4] == 'e') {
-        v = make_bool(_a, false);
+        v = make_bool(_n, false);
         return b + 4;
     }
     return 0;
 }
 
-inline S Parser::parse_true(S b, S e, void_ptr_t& v) {
+template<typename A>
+inline S Parser<A>::parse_true(S b, S e, void_ptr_t& v) {
     if (e - b >= 4 && b[1] == 'r' && b[2] == 'u' && b[3] == 'e') {
-        v = make_bool(_a, true);
+        v = make_bool(_n, true);
         return b + 3;
     }
     return 0;
 }
 
-inline S Parser::parse_null(S b, S e, void_ptr_t& v) {
+template<typename A>
+inline S Parser<A>::parse_null(S b, S e, void_ptr_t& v) {
     if (e - b >= 4 && b[1] == 'u' && b[2] == 'l' && b[3] == 'l') {
-        v = 0;
+        v = make_null(_n);
         return b + 3;
     }
     return 0;
@@ -229,7 +281,8 @@ inline bool is_white_space(char c) {
 
 // This is a non-recursive implement of json parser.
 // stack: |prev size|prev state|val|....
-bool Parser::parse(S b, S e, void_ptr_t& val) {
+template<typename A>
+bool Parser<A>::parse(S b, S e, void_ptr_t& val) {
     union { uint32 state; void* pstate; };
     union { uint32 size;  void* psize; };
     void_ptr_t key;
@@ -246,7 +299,7 @@ bool Parser::parse(S b, S e, void_ptr_t& val) {
   obj_beg:
     u.push_back(psize);  // prev size
     u.push_back(pstate); // prev state
-    s.push_back(make_object(_a));
+    s.push_back(make_object(_n));
     size = s.size(); // current size
     state = '{';
 
@@ -298,7 +351,7 @@ bool Parser::parse(S b, S e, void_ptr_t& val) {
   arr_beg:
     u.push_back(psize);  // prev size
     u.push_back(pstate); // prev state
-    s.push_back(make_array(_a));
+    s.push_back(make_array(_n));
     size = s.size(); // current size
     state = '[';
 
@@ -340,7 +393,7 @@ bool Parser::parse(S b, S e, void_ptr_t& val) {
   arr_end:
   obj_end:
     if (s.size() > size) {
-        void* p = xx::alloc_array(s.data() + size, s.size() - size);
+        void* p = alloc_array(_n, s.data() + size, s.size() - size);
         s.resize(size);
         ((_H*)s.back())->p = p;
     }
@@ -381,7 +434,7 @@ bool Parser::parse(S b, S e, void_ptr_t& val) {
     while (s.size() > 0) {
         if (s.size() > size) {
             if (state == '{' && ((s.size() - size) & 1)) s.push_back(0);
-            void* p = xx::alloc_array(s.data() + size, s.size() - size);
+            void* p = alloc_array(_n, s.data() + size, s.size() - size);
             s.resize(size);
             ((_H*)s.back())->p = p;
         }
@@ -434,12 +487,13 @@ Initializer::Initializer() {
 
 } // xx
 
-S Parser::parse_string(S b, S e, void_ptr_t& v) {
+template<typename A>
+S Parser<A>::parse_string(S b, S e, void_ptr_t& v) {
     S p, q;
     if ((p = find_quote(++b, e)) == 0) return 0;
     q = find_slash(b, p);
     if (q == 0) {
-        v = make_string(_a, b, p - b);
+        v = make_string(_n, b, p - b);
         return p;
     }
 
@@ -467,7 +521,7 @@ S Parser::parse_string(S b, S e, void_ptr_t& v) {
         q = find_slash(b, p);
         if (q == 0) {
             s.append(b, p - b);
-            v = make_string(_a, s.data(), s.size());
+            v = make_string(_n, s.data(), s.size());
             return p;
         }
     } while (true);
@@ -497,7 +551,8 @@ inline const char* parse_hex(const char* b, const char* e, uint32& u) {
 // \uXXXX\uYYYY
 //   D800 <= XXXX <= DBFF
 //   DC00 <= XXXX <= DFFF
-S Parser::parse_unicode(S b, S e, fastream& s) {
+template<typename A>
+S Parser<A>::parse_unicode(S b, S e, fastream& s) {
     uint32 u = 0;
     b = parse_hex(b, e, u);
     if (b == 0) return 0;
@@ -553,7 +608,8 @@ inline bool is_digit(char c) {
     return '0' <= c && c <= '9';
 }
 
-S Parser::parse_number(S b, S e, void_ptr_t& v) {
+template<typename A>
+S Parser<A>::parse_number(S b, S e, void_ptr_t& v) {
     bool is_double = false;
     S p = b;
 
@@ -595,12 +651,12 @@ S Parser::parse_number(S b, S e, void_ptr_t& v) {
         int m = ::memcmp(b, (*b != '-' ? "18446744073709551615" : "-9223372036854775808"), 20);
         if (m < 0) goto to_int;
         if (m > 0) goto to_dbl;
-        v = make_int(_a, *b != '-' ? MAX_UINT64 : MIN_INT64);
+        v = make_int(_n, *b != '-' ? MAX_UINT64 : MIN_INT64);
         return p - 1;
     }
 
   to_int:
-    v = make_int(_a, str2int(b, p));
+    v = make_int(_n, str2int(b, p));
     return p - 1;
 
   to_dbl:
@@ -611,7 +667,7 @@ S Parser::parse_number(S b, S e, void_ptr_t& v) {
         b = fs.c_str();
     }
     if (str2double(b, d)) {
-        v = make_double(_a, d);
+        v = make_double(_n, d);
         return p - 1;
     }
     return 0;
@@ -619,7 +675,15 @@ S Parser::parse_number(S b, S e, void_ptr_t& v) {
 
 bool Json::parse_from(const char* s, size_t n) {
     if (_h) this->reset();
-    Parser parser;
+    Parser<_A> parser(xx::jalloc());
+    bool r = parser.parse(s, s + n, *(void**)&_h);
+    if (unlikely(!r && _h)) this->reset();
+    return r;
+}
+
+bool Json::parse_from(const char* s, size_t n, co::arena& a) {
+    if (_h) this->reset();
+    Parser<co::arena> parser(a);
     bool r = parser.parse(s, s + n, *(void**)&_h);
     if (unlikely(!r && _h)) this->reset();
     return r;
@@ -662,7 +726,7 @@ inline const char* find_escapse(const char* b, const char* e, char& c) {
 }
 
 fastream& Json::_json2str(fastream& fs, bool debug, int mdp) const {
-    if (!_h) return fs.append("null", 4);
+    if (this->is_null()) return fs.append("null", 4);
 
     switch (_h->type) {
       case t_string: {
@@ -726,7 +790,7 @@ fastream& Json::_json2str(fastream& fs, bool debug, int mdp) const {
 // @indent:  4 spaces by default
 // @n:       number of spaces to insert at the beginning for the current line
 fastream& Json::_json2pretty(fastream& fs, int indent, int n, int mdp) const {
-    if (!_h) return fs.append("null", 4);
+    if (this->is_null()) return fs.append("null", 4);
 
     switch (_h->type) {
       case t_object: {
@@ -781,11 +845,12 @@ bool Json::has_member(const char* key) const {
 }
 
 Json& Json::operator[](const char* key) const {
-    assert(!_h || _h->type & t_object);
+    assert(this->is_null() || this->is_object());
     for (auto it = this->begin(); it != this->end(); ++it) {
         if (strcmp(key, it.key()) == 0) return it.value();
     }
 
+    this->_check_writable();
     if (!_h) {
         ((Json*)this)->_h = make_object(xx::jalloc());
         new (&_h->p) xx::Array(8);
@@ -815,6 +880,7 @@ Json& Json::get(const char* key) const {
 }
 
 void Json::remove(const char* key) {
+    this->_check_writable();
     if (this->is_object()) {
         const uint32 n = _h->p ? _array().size() : 0;
         if (n > 0) {
@@ -833,6 +899,7 @@ void Json::remove(const char* key) {
 }
 
 void Json::erase(const char* key) {
+    this->_check_writable();
     if (this->is_object()) {
         const uint32 n = _h->p ? _array().size() : 0;
         if (n > 0) {
@@ -851,6 +918,7 @@ void Json::erase(const char* key) {
 }
 
 Json& Json::_set(uint32 i) {
+    this->_check_writable();
   beg:
     if (this->is_null()) {
         for (uint32 k = 0; k < i; ++k) {
@@ -878,6 +946,7 @@ Json& Json::_set(uint32 i) {
 }
 
 Json& Json::_set(const char* key) {
+    this->_check_writable();
   beg:
     if (this->is_null()) {
         this->add_member(key, Json());
@@ -899,6 +968,7 @@ Json& Json::_set(const char* key) {
 
 void Json::reset() {
     if (_h) {
+        if (_h->arena) { _h = 0; return; } // released with the arena
         auto& a = xx::jalloc();
         switch (_h->type) {
           case t_object:
@@ -951,9 +1021,12 @@ void* Json::_dup() const {
           case t_string:
             h = make_string(xx::jalloc(), _h->s, _h->size);
             break;
+          case t_null: // from an arena
+            break;
           default:
             h = (_H*) xx::jalloc().alloc();
             h->type = _h->type;
+            h->arena = 0;
             h->i = _h->i;
         }
     }
@@ -15,6 +15,8 @@
 #ifdef HAS_BACKTRACE_H
 #include <backtrace.h>
 #include <cxxabi.h>
+#elif defined(__GLIBC__)
+#include <execinfo.h>
 #endif
 #endif
 #include <time.h>
@@ -727,6 +729,8 @@ class StackTrace : public StackWalker {
 
     virtual ~StackTrace() = default;
 
+    void prepare() {}
+
     void dump_stack(void* f, int skip) {
         _f = (write_cb_t) f;
         _skip = skip;
@@ -756,7 +760,8 @@ class StackTrace{
   public:
     typedef void (*write_cb_t)(const char*, size_t);
     StackTrace()
-        : _f(0), _buf((char*)::malloc(4096)), _size(4096), _s(4096), _exe(os::exepath()) {
+        : _f(0), _state(0), _raw(false), _buf((char*)::malloc(4096)), _size(4096), _s(4096),
+          _exe(os::exepath()) {
         memset(_buf, 0, 4096);
         memset((char*)_s.data(), 0, _s.capacity());
         (void) _exe.c_str();
@@ -766,12 +771,17 @@ class StackTrace{
         if (_buf) { ::free(_buf); _buf = NULL; }
     }
 
+    // Load what dump_stack() needs, so that it can be called in a signal handler
+    // that may interrupt malloc. Names are not demangled after that.
+    void prepare();
     void dump_stack(void* f, int skip);
     char* demangle(const char* name);
     int backtrace(const char* file, int line, const char* func, int& count);
 
   private:
     write_cb_t _f;
+    void* _state;  // backtrace_state of libbacktrace
+    bool _raw;     // no demangling, nothing is allocated in dump_stack()
     char* _buf;    // for demangle
     size_t _size;  // buf size
     fastream _s;   // for stack trace
@@ -806,31 +816,66 @@ int backtrace_cb(void* data, uintptr_t /*pc*/, const char* file, int line, const
     return ud->st->backtrace(file, line, func, ud->count);
 }
 
+int nop_cb(void*, uintptr_t, const char*, int, const char*) { return 0; }
+
+// the debug info is read by the first backtrace, not by backtrace_create_state()
+void StackTrace::prepare() {
+    if (!_state) _state = backtrace_create_state(_exe.c_str(), 1, error_cb, NULL);
+    backtrace_full((struct backtrace_state*)_state, 0, nop_cb, error_cb, NULL);
+    _raw = true;
+}
+
 void StackTrace::dump_stack(void* f, int skip) {
     _f = (write_cb_t) f;
     struct user_data_t ud = { this, 0 };
-    struct backtrace_state* state = backtrace_create_state(_exe.c_str(), 1, error_cb, NULL);
-    backtrace_full(state, skip, backtrace_cb, error_cb, (void*)&ud);
+    if (!_state) _state = backtrace_create_state(_exe.c_str(), 1, error_cb, NULL);
+    backtrace_full((struct backtrace_state*)_state, skip, backtrace_cb, error_cb, (void*)&ud);
 }
 
+inline size_t cut_1k(const char* s) {
+    const size_t n = strlen(s);
+    return n < 1024 ? n : 1024;
+}
+
+// names are cut to 1K, so that a line always fits in _s, which never grows
 int StackTrace::backtrace(const char* file, int line, const char* func, int& count) {
     if (!file && !func) return 0;
-    if (func) {
+    if (func && !_raw) {
         char* p = this->demangle(func);
         if (p) func = p;
     }
+    if (!func) func = "???";
+    if (!file) file = "???";
 
     _s.clear();
-    _s << '#' << (count++) << "  in " << (func ? func : "???") << " at " 
-       << (file ? file : "???") << ':' << line << '\n';
+    _s << '#' << (count++) << "  in ";
+    _s.append(func, cut_1k(func)) << " at ";
+    _s.append(file, cut_1k(file)) << ':' << line << '\n';
 
     if (_f) _f(_s.data(), _s.size());
     log2stderr(_s.data(), _s.size());
     return 0;
 }
 
+#elif defined(__GLIBC__)
+char* StackTrace::demangle(const char*) { return 0; }
+
+// backtrace() of glibc loads libgcc and may malloc on the first call
+void StackTrace::prepare() {
+    void* buf[1];
+    (void) ::backtrace(buf, 1);
+}
+
+// backtrace_symbols() mallocs, the symbols are written to stderr only
+void StackTrace::dump_stack(void*, int skip) {
+    void* buf[64];
+    const int n = ::backtrace(buf, 64);
+    if (n > skip) backtrace_symbols_fd(buf + skip, n - skip, STDERR_FILENO);
+}
+
 #else
 char* StackTrace::demangle(const char*) { return 0; }
+void StackTrace::prepare() {}
 void StackTrace::dump_stack(void*, int) {}
 #endif // HAS_BACKTRACE_H
 
@@ -1112,6 +1157,26 @@ TLogSaver::~TLogSaver() {
     _s.resize(_n);
 }
 
+static StackTrace* g_stack_trace; // for print_stack(), set by prepare_stack()
+static bool g_stack_busy;
+
+void prepare_stack() {
+    static StackTrace* st = []() {
+        StackTrace* const p = co::_make_static<StackTrace>();
+        p->prepare();
+        return p;
+    }();
+    atomic_store(&g_stack_trace, st, mo_release);
+}
+
+void print_stack(const char* s, int skip) {
+    StackTrace* const st = atomic_load(&g_stack_trace, mo_acquire);
+    if (!st || !atomic_bool_cas(&g_stack_busy, false, true, mo_acquire, mo_relaxed)) return;
+    log2stderr(s);
+    st->dump_stack(NULL, skip + 2);
+    atomic_store(&g_stack_busy, false, mo_release);
+}
+
 } // xx
 
 void exit() {
@@ -2,7 +2,9 @@
 #include "co/atomic.h"
 #include "co/clist.h"
 #include "co/god.h"
+#include "co/flag.h"
 #include "co/log.h"
+#include "co/time.h"
 
 #ifdef _WIN32
 #ifndef WIN32_LEAN_AND_MEAN
@@ -15,6 +17,18 @@
 #include <sys/mman.h>
 #endif
 
+#if defined(__linux__) && defined(__GLIBC__)
+#include <execinfo.h>
+#endif
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+DEF_uint32(co_mem_trim_ms, 3000, ">>#1 give free memory of a thread back to the OS if it has not allocated for so many ms, 0 to disable");
+DEF_uint32(co_mem_retain_mb, 2, ">>#1 MB of empty blocks kept by each thread when trimming");
+DEF_uint32(co_mem_cache_mb, 64, ">>#1 MB of freed spans (allocations larger than 128K) cached for reuse, in threads or globally");
+
 
 #ifdef _WIN32
 inline void* _vm_reserve(size_t n) {
@@ -30,10 +44,20 @@ inline void _vm_decommit(void* p, size_t n) {
     VirtualFree(p, n, MEM_DECOMMIT);
 }
 
+// give the pages back to the OS, they are still accessible
+inline void _vm_purge(void* p, size_t n) {
+    (void) VirtualAlloc(p, n, MEM_RESET, PAGE_READWRITE);
+}
+
 inline void _vm_free(void* p, size_t n) {
     VirtualFree(p, 0, MEM_RELEASE);
 }
 
+// reserve and commit @n bytes
+inline void* _vm_map(size_t n) {
+    return VirtualAlloc(NULL, n, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+}
+
 #if __arch64
 inline int _find_msb(size_t x) { /* x != 0 */
     unsigned long i;
@@ -93,10 +117,25 @@ inline void _vm_decommit(void* p, size_t n) {
     );
 }
 
+// give the pages back to the OS, they are still accessible
+inline void _vm_purge(void* p, size_t n) {
+  #if defined(MADV_FREE) && !defined(__linux__)
+    (void) ::madvise(p, n, MADV_FREE);
+  #else
+    (void) ::madvise(p, n, MADV_DONTNEED);
+  #endif
+}
+
 inline void _vm_free(void* p, size_t n) {
     ::munmap(p, n);
 }
 
+// reserve and commit @n bytes
+inline void* _vm_map(size_t n) {
+    void* const p = ::mmap(NULL, n, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return p != MAP_FAILED ? p : NULL;
+}
+
 #if __arch64
 inline int _find_msb(size_t x) { /* x != 0 */
     return 63 - __builtin_clzll(x);
@@ -292,14 +331,57 @@ class Bitset {
         return -1;
     }
 
-    void atomic_set(uint32 i) {
-        atomic_or(&_s[i >> B], C << (i & R), mo_relaxed);
-    }
+    // the word containing bit @i
+    size_t* word(uint32 i) const { return _s + (i >> B); }
 
   private:
     size_t* _s;
 };
 
+// Memory owned by other threads is not freed at once. The bits to set in the
+// owners' bitsets are buffered in the thread, bits of the same word are merged,
+// and each word is updated with a single atomic operation on flush.
+class XFreeBuf {
+  public:
+    static const uint32 N = 64;              // number of slots, power of 2
+    static const uint32 MAX_FREES = 256;     // flush after so many frees
+    static const size_t MAX_BYTES = 1 << 20; // or after so many bytes freed
+
+    XFreeBuf() : _n(0), _bytes(0) { memset(_s, 0, sizeof(_s)); }
+
+    // buffer bits @x of the word @w, for @n bytes freed
+    void add(size_t* w, size_t x, size_t n) {
+        auto& s = _s[((size_t)w / sizeof(size_t)) & (N - 1)];
+        if (s.w == w) {
+            s.x |= x;
+        } else {
+            if (s.w) atomic_or(s.w, s.x, mo_relaxed);
+            s.w = w;
+            s.x = x;
+        }
+        _bytes += n;
+        if (++_n >= MAX_FREES || _bytes >= MAX_BYTES) this->flush();
+    }
+
+    void flush() {
+        if (_n == 0) return;
+        for (uint32 i = 0; i < N; ++i) {
+            auto& s = _s[i];
+            if (s.w) {
+                atomic_or(s.w, s.x, mo_relaxed);
+                s.w = 0;
+            }
+        }
+        _n = 0;
+        _bytes = 0;
+    }
+
+  private:
+    struct { size_t* w; size_t x; } _s[N];
+    uint32 _n;     // number of frees buffered
+    size_t _bytes; // bytes of memory buffered
+};
+
 // 128M on arch64, or 32M on arch32
 // manage and alloc large blocks(2M or 1M)
 class HugeBlock : public co::clink {
@@ -328,10 +410,15 @@ class HugeBlock : public co::clink {
     DISALLOW_COPY_AND_ASSIGN(HugeBlock);
 };
 
+static size_t g_vm_reserved = 0;  // bytes of virtual memory reserved
+static size_t g_vm_committed = 0; // bytes of virtual memory committed
+
 inline HugeBlock* make_huge_block() {
     void* x = _vm_reserve(1u << g_hb_bits);
     if (x) {
         _vm_commit(x, 4096);
+        atomic_add(&g_vm_reserved, (size_t)1 << g_hb_bits, mo_relaxed);
+        atomic_add(&g_vm_committed, 4096, mo_relaxed);
         void* p = god::align_up<(1u << g_lb_bits)>(x);
         if (p == x) p = (char*)x + (1u << g_lb_bits);
         return new (x) HugeBlock(p);
@@ -344,7 +431,7 @@ inline HugeBlock* make_huge_block() {
 class LargeBlock : public co::clink {
   public:
     explicit LargeBlock(HugeBlock* parent)
-        : _p((char*)this + (1u << g_sb_bits)), _parent(parent) {
+        : _p((char*)this + (1u << g_sb_bits)), _dirty(0), _parent(parent) {
         //assert(!next && !prev && _bits == 0);
     }
 
@@ -352,6 +439,7 @@ class LargeBlock : public co::clink {
         const uint32 i = _find_lsb(~_bits);
         if (i < R) {
             _bits |= (C << i);
+            _dirty |= (C << i);
             return _p + (((size_t)i) << g_sb_bits);
         }
         return NULL;
@@ -362,11 +450,29 @@ class LargeBlock : public co::clink {
         return (_bits &= ~(C << i)) == 0;
     }
 
+    bool empty() const { return _bits == 0; }
+
+    // give free small blocks used before back to the OS, return bytes purged
+    size_t purge() {
+        size_t x = _dirty & ~_bits, r = 0;
+        _dirty &= _bits;
+        while (x) {
+            const uint32 i = _find_lsb(x);
+            uint32 j = i + 1;
+            while (j < R && (x & (C << j))) ++j;
+            _vm_purge(_p + (((size_t)i) << g_sb_bits), ((size_t)(j - i)) << g_sb_bits);
+            r += ((size_t)(j - i)) << g_sb_bits;
+            x &= ~((C << j) - (C << i));
+        }
+        return r;
+    }
+
     HugeBlock* parent() const { return _parent; }
 
   private:
     char* _p; // beginning address to alloc
     size_t _bits;
+    size_t _dirty; // small blocks used since the last purge
     HugeBlock* _parent;
     DISALLOW_COPY_AND_ASSIGN(LargeBlock);
 };
@@ -404,7 +510,23 @@ class LargeAlloc : public co::clink {
         return NULL;
     }
 
-    void* try_hard_alloc(uint32 n);
+    // take back memory freed by other threads
+    void collect();
+
+    void* try_hard_alloc(uint32 n) {
+        this->collect();
+        return this->alloc(n);
+    }
+
+    bool empty() const { return _bit == 0; }
+
+    // give pages above the current bit back to the OS, return bytes purged
+    size_t purge() {
+        char* const e = (char*)this + (1u << g_lb_bits);
+        char* const b = _p + (((size_t)_bit) << 12);
+        if (b < e) _vm_purge(b, e - b);
+        return b < e ? e - b : 0;
+    }
 
     bool free(void* p) {
         int i = (int)(((char*)p - _p) >> 12);
@@ -414,9 +536,10 @@ class LargeAlloc : public co::clink {
         return r < i ? ((_bit = r >= 0 ? i : 0) == 0) : false;
     }
 
-    void xfree(void* p) {
+    // free memory of @n bytes in another thread
+    void xfree(void* p, size_t n, XFreeBuf& b) {
         const uint32 i = (uint32)(((char*)p - _p) >> 12);
-        _xbs.atomic_set(i);
+        b.add(_xbs.word(i), C << (i & R), n);
     }
 
     void* realloc(void* p, uint32 o, uint32 n) {
@@ -447,7 +570,8 @@ class LargeAlloc : public co::clink {
     DISALLOW_COPY_AND_ASSIGN(LargeAlloc);
 };
 
-void* LargeAlloc::try_hard_alloc(uint32 n) {
+void LargeAlloc::collect() {
+    if (_bit == 0) return;
     size_t* const p = (size_t*)_pbs;
     size_t* const q = (size_t*)_xpbs;
 
@@ -469,12 +593,6 @@ void* LargeAlloc::try_hard_alloc(uint32 n) {
             x = atomic_load(&q[i], mo_relaxed);
         }
     }
-
-    if (_bit + n <= MAX_BIT) {
-        _bs.set(_bit);
-        return _p + (god::fetch_add(&_bit, n) << 12);
-    }
-    return NULL;
 }
 
 // SmallAlloc is a small block, it allocates memory from 16 to 2K bytes
@@ -519,7 +637,23 @@ class SmallAlloc : public co::clink {
         return p;
     }
 
-    void* try_hard_alloc(uint32 n);
+    // take back memory freed by other threads
+    void collect();
+
+    void* try_hard_alloc(uint32 n) {
+        this->collect();
+        return this->alloc(n);
+    }
+
+    bool empty() const { return _bit == 0; }
+
+    // give pages above the current bit back to the OS, return bytes purged
+    size_t purge() {
+        char* const e = (char*)this + (1u << g_sb_bits);
+        char* const b = god::align_up<4096>(_p + (((size_t)_bit) << 4));
+        if (b < e) _vm_purge(b, e - b);
+        return b < e ? e - b : 0;
+    }
 
     bool free(void* p) {
         const int i = (int)(((char*)p - _p) >> 4);
@@ -529,9 +663,10 @@ class SmallAlloc : public co::clink {
         return r < i ? ((_bit = r >= 0 ? i : 0) == 0) : false;
     }
 
-    void xfree(void* p) {
+    // free memory of @n bytes in another thread
+    void xfree(void* p, size_t n, XFreeBuf& b) {
         const uint32 i = (uint32)(((char*)p - _p) >> 4);
-        _xbs.atomic_set(i);
+        b.add(_xbs.word(i), C << (i & R), n);
     }
 
     void* realloc(void* p, uint32 o, uint32 n) {
@@ -562,7 +697,8 @@ class SmallAlloc : public co::clink {
     DISALLOW_COPY_AND_ASSIGN(SmallAlloc);
 };
 
-void* SmallAlloc::try_hard_alloc(uint32 n) {
+void SmallAlloc::collect() {
+    if (_bit == 0) return;
     size_t* const p = (size_t*)_pbs;
     size_t* const q = (size_t*)_xpbs;
 
@@ -584,12 +720,6 @@ void* SmallAlloc::try_hard_alloc(uint32 n) {
             x = atomic_load(&q[i], mo_relaxed);
         }
     }
-
-    if (_bit + n <= MAX_BIT) {
-        _bs.set(_bit);
-        return _p + (god::fetch_add(&_bit, n) << 4);
-    }
-    return NULL;
 }
 
 
@@ -628,23 +758,318 @@ GlobalAlloc::~GlobalAlloc() {
     }
 }
 
+// Memory larger than 128K is mapped in spans, sizes of which are rounded up to
+// classes of 4 steps in each power of 2. Freed spans not larger than 32M are
+// cached for reuse, the latest first, and at most FLG_co_mem_cache_mb of them,
+// together with those cached in threads.
+// A span grows in place with mremap() on linux.
+class SpanAlloc {
+  public:
+    static const int N = 32; // number of classes cached
+
+    SpanAlloc() : _bytes(0), _tc_bytes(0) { memset(_h, 0, sizeof(_h)); }
+    ~SpanAlloc() { this->trim(0); }
+
+    // size of the span for @n bytes, n > 128K
+    static size_t span_size(size_t n) {
+        const int b = _find_msb(n - 1) - 2;
+        return (((n - 1) >> b) + 1) << b;
+    }
+
+    void* alloc(size_t n, bool zero=false);
+    void free(void* p, size_t n);
+    void* realloc(void* p, size_t o, size_t n);
+    void* try_realloc(void* p, size_t o, size_t n);
+
+    // unmap the spans cached before @ms, or all of them if @ms is 0
+    size_t trim(int64 ms);
+
+    size_t cached() const { return atomic_load(&_bytes, mo_relaxed); }
+
+    // count a span of size @s cached in a thread against FLG_co_mem_cache_mb,
+    // false if there is no room for it
+    bool thread_cache(size_t s) {
+        const size_t max = (size_t)FLG_co_mem_cache_mb << 20;
+        if (atomic_add(&_tc_bytes, s, mo_relaxed) + atomic_load(&_bytes, mo_relaxed) <= max) return true;
+        atomic_sub(&_tc_bytes, s, mo_relaxed);
+        return false;
+    }
+
+    // a span of size @s is no longer cached in a thread
+    void thread_uncache(size_t s) { atomic_sub(&_tc_bytes, s, mo_relaxed); }
+
+  private:
+    // class of the span of size @s, the result is N or larger if not cached
+    static int class_of(size_t s) {
+        const int m = _find_msb(s - 1);
+        return ((m - 17) << 2) + (int)(((s - 1) >> (m - 2)) & 3);
+    }
+
+    // size of spans in the class @c
+    static size_t size_of(int c) {
+        return (size_t)((c & 3) + 5) << ((c >> 2) + 15);
+    }
+
+    void* map(size_t s) {
+        void* p = _vm_map(s);
+        if (p) {
+            atomic_add(&g_vm_reserved, s, mo_relaxed);
+            atomic_add(&g_vm_committed, s, mo_relaxed);
+        }
+        return p;
+    }
+
+    void unmap(void* p, size_t s) {
+        _vm_free(p, s);
+        atomic_sub(&g_vm_reserved, s, mo_relaxed);
+        atomic_sub(&g_vm_committed, s, mo_relaxed);
+    }
+
+    struct Span {
+        Span* next;
+        int64 ms; // time when it was cached
+    };
+
+    std::mutex _mtx;
+    Span* _h[N];      // spans cached in each class
+    size_t _bytes;    // bytes of spans cached
+    size_t _tc_bytes; // bytes of spans cached in threads
+};
+
+void* SpanAlloc::alloc(size_t n, bool zero) {
+    const size_t s = span_size(n);
+    const int c = class_of(s);
+    if (c < N) {
+        Span* x;
+        {
+            std::lock_guard<std::mutex> g(_mtx);
+            x = _h[c];
+            if (x) {
+                _h[c] = x->next;
+                atomic_store(&_bytes, _bytes - s, mo_relaxed);
+            }
+        }
+        if (x) {
+            if (zero) memset(x, 0, n);
+            return x;
+        }
+    }
+    return this->map(s); // new pages are zeroed by the OS
+}
+
+void SpanAlloc::free(void* p, size_t n) {
+    const size_t s = span_size(n);
+    const int c = class_of(s);
+    if (c < N) {
+        Span* const x = (Span*)p;
+        x->ms = now::ms();
+        std::lock_guard<std::mutex> g(_mtx);
+        if (_bytes + s + atomic_load(&_tc_bytes, mo_relaxed) <= ((size_t)FLG_co_mem_cache_mb << 20)) {
+            x->next = _h[c];
+            _h[c] = x;
+            atomic_store(&_bytes, _bytes + s, mo_relaxed);
+            return;
+        }
+    }
+    this->unmap(p, s);
+}
+
+void* SpanAlloc::realloc(void* p, size_t o, size_t n) {
+    const size_t so = span_size(o), s = span_size(n);
+    if (s == so) return p;
+  #ifdef __linux__
+    void* const x = ::mremap(p, so, s, MREMAP_MAYMOVE);
+    if (x == MAP_FAILED) return NULL;
+    atomic_add(&g_vm_reserved, s - so, mo_relaxed);
+    atomic_add(&g_vm_committed, s - so, mo_relaxed);
+    return x;
+  #else
+    void* const x = this->alloc(n);
+    if (x) { memcpy(x, p, o); this->free(p, o); }
+    return x;
+  #endif
+}
+
+void* SpanAlloc::try_realloc(void* p, size_t o, size_t n) {
+    const size_t so = span_size(o), s = span_size(n);
+    if (s == so) return p;
+  #ifdef __linux__
+    void* const x = ::mremap(p, so, s, 0);
+    if (x == MAP_FAILED) return NULL;
+    atomic_add(&g_vm_reserved, s - so, mo_relaxed);
+    atomic_add(&g_vm_committed, s - so, mo_relaxed);
+    return x;
+  #else
+    return NULL;
+  #endif
+}
+
+size_t SpanAlloc::trim(int64 ms) {
+    Span* v[N];
+    size_t r = 0;
+    {
+        std::lock_guard<std::mutex> g(_mtx);
+        for (int c = 0; c < N; ++c) {
+            Span** x = &_h[c];
+            if (ms != 0) {
+                while (*x && (*x)->ms >= ms) x = &(*x)->next;
+            }
+            v[c] = *x;
+            *x = 0;
+            for (Span* k = v[c]; k; k = k->next) r += size_of(c);
+        }
+        atomic_store(&_bytes, _bytes - r, mo_relaxed);
+    }
+
+    for (int c = 0; c < N; ++c) {
+        for (Span* x = v[c]; x;) {
+            Span* const next = x->next;
+            this->unmap(x, size_of(c));
+            x = next;
+        }
+    }
+    return r;
+}
+
+static SpanAlloc* g_sa;
 static uint32 g_talloc_id = (uint32)-1;
+static ThreadAlloc* g_talloc_head = 0; // list of all the thread allocators
+static uint32 g_prof_rate = 0; // the heap profiler samples one in so many allocations
+
+// Number of live samples hashed to each slot, updated under the lock of the
+// profiler. A free looks up the profiler only if the slot of the block is not
+// zero, so frees of blocks not sampled take no lock.
+static uint16 g_prof_filter[1 << 16];
+
+inline uint16* prof_slot(void* p) {
+    return g_prof_filter + (uint32)((((uint64)(size_t)p >> 4) * 0x9E3779B97F4A7C15ull) >> 48);
+}
+
+inline bool prof_sampled(void* p) {
+    return atomic_load(prof_slot(p), mo_relaxed) != 0;
+}
+
+void prof_add(void* p, size_t n);
+void prof_del(void* p);
 
 class alignas(co::cache_line_size) ThreadAlloc {
   public:
     ThreadAlloc(GlobalAlloc* ga)
-        : _lb(0), _la(0), _sa(0), _ga(ga), _s(16 * 1024) {
+        : _lb(0), _la(0), _sa(0), _ga(ga), _s(16 * 1024), _prof_cnt(0),
+          _trim_allocs(0), _idle_ms(0), _trimmed(true) {
         _id = atomic_inc(&g_talloc_id, mo_relaxed);
+        memset(&_st, 0, sizeof(_st));
+        memset(_sc, 0, sizeof(_sc));
+        _next = atomic_load(&g_talloc_head, mo_relaxed);
+        for (;;) {
+            ThreadAlloc* const h = atomic_cas(&g_talloc_head, _next, this, mo_release, mo_relaxed);
+            if (h == _next) break;
+            _next = h;
+        }
     }
     ~ThreadAlloc() = default;
 
     uint32 id() const { return _id; }
+    ThreadAlloc* next() const { return _next; }
     void* alloc(size_t n);
     void* alloc(size_t n, size_t align);
     void free(void* p, size_t n);
     void* realloc(void* p, size_t o, size_t n);
     void* try_realloc(void* p, size_t o, size_t n);
     void* salloc(size_t n) { return _s.alloc(n); }
+    void flush_xfree() { _xf.flush(); }
+    size_t trim(size_t keep);
+    bool trim_if_idle(int64 now_ms);
+
+    // A few spans not larger than 8M are cached in the thread without locks.
+    // They are counted in FLG_co_mem_cache_mb with spans cached in g_sa.
+    void* span_alloc(size_t n) {
+        const size_t s = SpanAlloc::span_size(n);
+        for (int i = 0; i < 4; ++i) {
+            if (_sc[i].s == s) {
+                stat_add(_st.span_cached, -(uint64)s);
+                g_sa->thread_uncache(s);
+                _sc[i].s = 0;
+                return _sc[i].p;
+            }
+        }
+        return g_sa->alloc(n);
+    }
+
+    void span_free(void* p, size_t n) {
+        const size_t s = SpanAlloc::span_size(n);
+        if (s <= (8u << 20)) {
+            for (int i = 0; i < 4; ++i) {
+                if (_sc[i].s == 0) {
+                    if (!g_sa->thread_cache(s)) break;
+                    stat_add(_st.span_cached, s);
+                    _sc[i].p = p; _sc[i].s = s;
+                    return;
+                }
+            }
+        }
+        g_sa->free(p, n);
+    }
+
+    // update statistics after memory was allocated, and sample it for the heap profiler
+    void on_alloc(void* p, size_t n) {
+        const int c = size_class(n);
+        stat_add(_st.allocs, 1);
+        stat_add(_st.alloc_bytes, n);
+        stat_add(_st.objects[c], 1);
+        if (c == mem_stat::N - 1) {
+            stat_add(_st.span_allocs, 1);
+            stat_add(_st.span_bytes, n);
+        }
+        if (unlikely(g_prof_rate != 0) && ++_prof_cnt >= g_prof_rate) {
+            _prof_cnt = 0;
+            prof_add(p, n);
+        }
+    }
+
+    // update statistics before memory is freed
+    void on_free(void* p, size_t n) {
+        const int c = size_class(n);
+        stat_add(_st.frees, 1);
+        stat_add(_st.free_bytes, n);
+        stat_add(_st.objects[c], (uint64)-1);
+        if (c == mem_stat::N - 1) stat_add(_st.span_bytes, (uint64)0 - n);
+        if (unlikely(prof_sampled(p))) prof_del(p);
+    }
+
+    // Counters are written only by the owner thread, and may be read from other
+    // threads. Memory freed by another thread is counted in that thread, so
+    // that objects and span_bytes are meaningful only when summed up.
+    struct Stat {
+        uint64 allocs;
+        uint64 frees;
+        uint64 alloc_bytes;
+        uint64 free_bytes;
+        uint64 xfrees;
+        uint64 span_allocs;
+        uint64 span_bytes;
+        uint64 span_cached;
+        uint64 objects[mem_stat::N];
+        uint32 small_blocks;
+        uint32 large_blocks;
+    };
+
+    const Stat& stat() const { return _st; }
+
+  private:
+    static int size_class(size_t n) {
+        if (n <= 16) return 0;
+        const int c = _find_msb(n - 1) - 3;
+        return c < mem_stat::N ? c : mem_stat::N - 1;
+    }
+
+    static void stat_add(uint64& x, uint64 n) {
+        atomic_store(&x, x + n, mo_relaxed);
+    }
+
+    static void stat_add(uint32& x, uint32 n) {
+        atomic_store(&x, x + n, mo_relaxed);
+    }
 
   private:
     union { LargeBlock* _lb; co::clist _llb; };
@@ -653,6 +1078,14 @@ class alignas(co::cache_line_size) ThreadAlloc {
     uint32 _id;
     GlobalAlloc* _ga;
     StaticAlloc _s; 
+    XFreeBuf _xf; // frees of memory owned by other threads
+    uint32 _prof_cnt;
+    Stat _st;
+    ThreadAlloc* _next;
+    uint64 _trim_allocs; // allocations at the last check for idle
+    int64 _idle_ms;      // time of the last check that found new allocations
+    bool _trimmed;       // trimmed since the last allocation
+    struct { void* p; size_t s; } _sc[4]; // spans cached in the thread
 };
 
 
@@ -661,20 +1094,37 @@ Root& g_root = *(Root*)&g_root_buf;
 static GlobalAlloc* g_ga;
 __thread ThreadAlloc* g_ta;
 static int g_nifty_counter;
+static bool g_exiting; // static objects are being destroyed
 
 Initializer::Initializer() {
     if (g_nifty_counter++ == 0) {
         new (&g_root) Root();
         g_ga = g_root.make<GlobalAlloc>();
+        g_sa = g_root.make<SpanAlloc>();
     }
 }
 
 Initializer::~Initializer() {
+    atomic_store(&g_exiting, true, mo_relaxed);
     if (--g_nifty_counter == 0) g_root.~Root();
 }
 
+// flush the frees buffered and give free memory back when the thread exits,
+// except when the process is exiting, as the memory may be unmapped
+struct TallocCleaner {
+    ~TallocCleaner() {
+        if (g_ta && !atomic_load(&g_exiting, mo_relaxed)) g_ta->trim(0);
+    }
+};
+
+static ThreadAlloc* make_talloc() {
+    static thread_local TallocCleaner f;
+    (void) f;
+    return g_ta = g_root.make<ThreadAlloc>(g_ga);
+}
+
 inline ThreadAlloc* talloc() {
-    return g_ta ? g_ta : (g_ta = g_root.make<ThreadAlloc>(g_ga));
+    return g_ta ? g_ta : make_talloc();
 }
 
 #define _try_alloc(l, n, k) \
@@ -713,12 +1163,16 @@ inline void* GlobalAlloc::alloc(uint32 alloc_id, HugeBlock** parent) {
     } while (0);
 
   end:
-    if (p) _vm_commit(p, 1u << g_lb_bits);
+    if (p) {
+        _vm_commit(p, 1u << g_lb_bits);
+        atomic_add(&g_vm_committed, (size_t)1 << g_lb_bits, mo_relaxed);
+    }
     return p;
 }
 
 inline void GlobalAlloc::free(void* p, HugeBlock* hb, uint32 alloc_id) {
     _vm_decommit(p, 1u << g_lb_bits);
+    atomic_sub(&g_vm_committed, (size_t)1 << g_lb_bits, mo_relaxed);
     auto& x = _x[alloc_id & (g_array_size - 1)];
     bool r;
     {
@@ -726,7 +1180,11 @@ inline void GlobalAlloc::free(void* p, HugeBlock* hb, uint32 alloc_id) {
         r = hb->free(p) && hb != x.hb;
         if (r) x.lhb.erase(hb);
     }
-    if (r) _vm_free(hb, 1u << g_hb_bits);
+    if (r) {
+        _vm_free(hb, 1u << g_hb_bits);
+        atomic_sub(&g_vm_reserved, (size_t)1 << g_hb_bits, mo_relaxed);
+        atomic_sub(&g_vm_committed, 4096, mo_relaxed);
+    }
 }
 
 inline LargeBlock* GlobalAlloc::make_large_block(uint32 alloc_id) {
@@ -764,6 +1222,7 @@ inline void* ThreadAlloc::alloc(size_t n) {
 
         if (_lb && (sa = make_small_alloc(_lb, this))) {
             _lsa.push_front(sa);
+            stat_add(_st.small_blocks, 1);
             p = sa->alloc(u);
             goto end;
         }
@@ -773,6 +1232,7 @@ inline void* ThreadAlloc::alloc(size_t n) {
                 if ((sa = make_small_alloc((LargeBlock*)k, this))) {
                     _llb.move_front(k);
                     _lsa.push_front(sa);
+                    stat_add(_st.small_blocks, 1);
                     p = sa->alloc(u);
                     goto end;
                 }
@@ -783,8 +1243,10 @@ inline void* ThreadAlloc::alloc(size_t n) {
             auto lb = _ga->make_large_block(_id);
             if (lb) {
                 _llb.push_front(lb);
+                stat_add(_st.large_blocks, 1);
                 sa = make_small_alloc(lb, this);
                 _lsa.push_front(sa);
+                stat_add(_st.small_blocks, 1);
                 p = sa->alloc(u);
             }
             goto end;
@@ -807,13 +1269,14 @@ inline void* ThreadAlloc::alloc(size_t n) {
             auto la = _ga->make_large_alloc(_id);
             if (la) {
                 _lla.push_front(la);
+                stat_add(_st.large_blocks, 1);
                 p = la->alloc(u);
             }
             goto end;
         }
 
     } else {
-        p = ::malloc(n);
+        p = this->span_alloc(n);
     }
 
   end:
@@ -833,6 +1296,7 @@ inline void* ThreadAlloc::alloc(size_t n, size_t align) {
 
         if (_lb && (sa = make_small_alloc(_lb, this))) {
             _lsa.push_front(sa);
+            stat_add(_st.small_blocks, 1);
             p = sa->alloc(u, a);
             goto end;
         }
@@ -842,6 +1306,7 @@ inline void* ThreadAlloc::alloc(size_t n, size_t align) {
                 if ((sa = make_small_alloc((LargeBlock*)k, this))) {
                     _llb.move_front(k);
                     _lsa.push_front(sa);
+                    stat_add(_st.small_blocks, 1);
                     p = sa->alloc(u, a);
                     goto end;
                 }
@@ -852,8 +1317,10 @@ inline void* ThreadAlloc::alloc(size_t n, size_t align) {
             auto lb = _ga->make_large_block(_id);
             if (lb) {
                 _llb.push_front(lb);
+                stat_add(_st.large_blocks, 1);
                 sa = make_small_alloc(lb, this);
                 _lsa.push_front(sa);
+                stat_add(_st.small_blocks, 1);
                 p = sa->alloc(u, a);
             }
             goto end;
@@ -874,14 +1341,17 @@ inline void ThreadAlloc::free(void* p, size_t n) {
             if (ta == this) {
                 if (sa->free(p) && sa != _sa) {
                     _lsa.erase(sa);
+                    stat_add(_st.small_blocks, (uint32)-1);
                     const auto lb = sa->parent();
                     if (lb->free(sa) && lb != _lb) {
                         _llb.erase(lb);
+                        stat_add(_st.large_blocks, (uint32)-1);
                         _ga->free(lb, lb->parent(), _id);
                     }
                 }
             } else {
-                sa->xfree(p);
+                sa->xfree(p, n, _xf);
+                stat_add(_st.xfrees, 1);
             }
 
         } else if (n <= g_max_alloc_size) {
@@ -890,21 +1360,23 @@ inline void ThreadAlloc::free(void* p, size_t n) {
             if (ta == this) {
                 if (la->free(p) && la != _la) {
                     _lla.erase(la);
+                    stat_add(_st.large_blocks, (uint32)-1);
                     _ga->free(la, la->parent(), _id);
                 }
             } else {
-                la->xfree(p);
+                la->xfree(p, n, _xf);
+                stat_add(_st.xfrees, 1);
             }
 
         } else {
-            ::free(p);
+            this->span_free(p, n);
         }
     }
 }
 
 inline void* ThreadAlloc::realloc(void* p, size_t o, size_t n) {
     if (unlikely(!p)) return this->alloc(n);
-    if (unlikely(o > g_max_alloc_size)) return ::realloc(p, n);
+    if (unlikely(o > g_max_alloc_size)) return g_sa->realloc(p, o, n);
     CHECK_LT(o, n) << "realloc error, new size must be greater than old size..";
 
     if (o <= 2048) {
@@ -936,7 +1408,8 @@ inline void* ThreadAlloc::realloc(void* p, size_t o, size_t n) {
 }
 
 inline void* ThreadAlloc::try_realloc(void* p, size_t o, size_t n) {
-    if (unlikely(!p || o > g_max_alloc_size)) return NULL;
+    if (unlikely(!p)) return NULL;
+    if (unlikely(o > g_max_alloc_size)) return g_sa->try_realloc(p, o, n);
     CHECK_LT(o, n) << "realloc error, new size must be greater than old size..";
 
     if (o <= 2048) {
@@ -963,6 +1436,167 @@ inline void* ThreadAlloc::try_realloc(void* p, size_t o, size_t n) {
     return NULL;
 }
 
+// Empty small blocks go back to their large blocks, empty large blocks go back
+// to the global allocator (decommitted) except @keep bytes of them, and free
+// pages at the end of the blocks still in use are purged.
+size_t ThreadAlloc::trim(size_t keep) {
+    _xf.flush();
+    size_t r = 0, kept = 0;
+    const size_t lb_size = (size_t)1 << g_lb_bits;
+
+    // move the spans cached to the global cache, where they are trimmed by age
+    for (int i = 0; i < 4; ++i) {
+        if (_sc[i].s) {
+            stat_add(_st.span_cached, -(uint64)_sc[i].s);
+            g_sa->thread_uncache(_sc[i].s);
+            g_sa->free(_sc[i].p, _sc[i].s);
+            _sc[i].s = 0;
+        }
+    }
+
+    for (auto k = _lsa.front(); k;) {
+        const auto sa = (SmallAlloc*)k;
+        k = k->next;
+        sa->collect();
+        if (sa->empty()) {
+            _lsa.erase(sa);
+            stat_add(_st.small_blocks, (uint32)-1);
+            sa->parent()->free(sa);
+        } else {
+            r += sa->purge();
+        }
+    }
+
+    for (auto k = _llb.front(); k;) {
+        const auto lb = (LargeBlock*)k;
+        k = k->next;
+        if (lb->empty() && kept + lb_size > keep) {
+            _llb.erase(lb);
+            stat_add(_st.large_blocks, (uint32)-1);
+            _ga->free(lb, lb->parent(), _id);
+            r += lb_size;
+        } else if (lb->empty()) {
+            kept += lb_size;
+        } else {
+            r += lb->purge();
+        }
+    }
+
+    for (auto k = _lla.front(); k;) {
+        const auto la = (LargeAlloc*)k;
+        k = k->next;
+        la->collect();
+        if (la->empty() && kept + lb_size > keep) {
+            _lla.erase(la);
+            stat_add(_st.large_blocks, (uint32)-1);
+            _ga->free(la, la->parent(), _id);
+            r += lb_size;
+        } else if (la->empty()) {
+            kept += lb_size;
+        } else {
+            r += la->purge();
+        }
+    }
+    return r;
+}
+
+// trim if the thread has not allocated for FLG_co_mem_trim_ms, return true if
+// it is to be trimmed later
+bool ThreadAlloc::trim_if_idle(int64 now_ms) {
+    const uint64 n = _st.allocs;
+    if (n != _trim_allocs) {
+        _trim_allocs = n;
+        _idle_ms = now_ms;
+        _trimmed = false;
+    }
+    if (_trimmed || FLG_co_mem_trim_ms == 0) return false;
+    if (now_ms - _idle_ms < (int64)FLG_co_mem_trim_ms) return true;
+    this->trim((size_t)FLG_co_mem_retain_mb << 20);
+    g_sa->trim(now_ms - FLG_co_mem_trim_ms);
+    _trimmed = true;
+    return false;
+}
+
+// The heap profiler keeps the sampled allocations alive in a hash table. The
+// flag g_in_prof stops the recursion if operator new is replaced by co::alloc().
+class Profiler {
+  public:
+    struct Sample {
+        size_t size;
+        uint32 depth;
+        void* stack[mem_sample::N];
+    };
+
+    Profiler() = default;
+    ~Profiler() = default;
+
+    void add(void* p, size_t n, const Sample& s) {
+        std::lock_guard<std::mutex> g(_mtx);
+        auto r = _m.insert(std::make_pair(p, s));
+        if (!r.second) r.first->second = s;
+        else atomic_inc(prof_slot(p), mo_relaxed);
+        r.first->second.size = n;
+    }
+
+    void del(void* p) {
+        std::lock_guard<std::mutex> g(_mtx);
+        if (_m.erase(p)) atomic_dec(prof_slot(p), mo_relaxed);
+    }
+
+    std::vector<Sample> samples() {
+        std::vector<Sample> v;
+        std::lock_guard<std::mutex> g(_mtx);
+        v.reserve(_m.size());
+        for (auto& x : _m) v.push_back(x.second);
+        return v;
+    }
+
+  private:
+    std::mutex _mtx;
+    std::unordered_map<void*, Sample> _m;
+};
+
+static __thread bool g_in_prof;
+
+inline Profiler* profiler() {
+    static Profiler* p = g_root.make<Profiler>();
+    return p;
+}
+
+// save the return addresses in @s, the first frames may be in the allocator
+// as the compiler may inline some of them
+static uint32 capture_stack(void** s) {
+    const int skip = 1; // capture_stack itself
+  #if defined(_WIN32)
+    return CaptureStackBackTrace(skip, mem_sample::N, s, NULL);
+  #elif defined(__linux__) && defined(__GLIBC__)
+    void* buf[mem_sample::N + skip];
+    const int n = backtrace(buf, mem_sample::N + skip) - skip;
+    if (n <= 0) return 0;
+    memcpy(s, buf + skip, sizeof(void*) * n);
+    return (uint32)n;
+  #else
+    (void) s;
+    return 0;
+  #endif
+}
+
+void prof_add(void* p, size_t n) {
+    if (g_in_prof) return;
+    g_in_prof = true;
+    Profiler::Sample s;
+    s.depth = capture_stack(s.stack);
+    profiler()->add(p, n, s);
+    g_in_prof = false;
+}
+
+void prof_del(void* p) {
+    if (g_in_prof) return;
+    g_in_prof = true;
+    profiler()->del(p);
+    g_in_prof = false;
+}
+
 } // xx
 
 void* _salloc(size_t n) {
@@ -974,25 +1608,68 @@ void _dealloc(std::function<void()>&& f, int x) {
     xx::g_root.add_destructor(std::forward<xx::F>(f), x);
 }
 
+// Schedulers call it before waiting for events. Other threads are not flushed
+// on a timer: one that frees fewer than XFreeBuf::MAX_FREES objects (and less
+// than MAX_BYTES) owned by other threads and then idles keeps them buffered,
+// until it frees more, calls co::mem_trim(), or exits. The owners can't reuse
+// that memory before then.
+void _flush_xfree() {
+    if (xx::g_ta) xx::g_ta->flush_xfree();
+}
+
+bool _trim_if_idle() {
+    return xx::g_ta ? xx::g_ta->trim_if_idle(now::ms()) : false;
+}
+
+size_t mem_trim() {
+    const size_t r = xx::g_ta ? xx::g_ta->trim(0) : 0;
+    return r + xx::g_sa->trim(0);
+}
+
 #ifndef CO_USE_SYS_MALLOC
 void* alloc(size_t n) {
-    return xx::talloc()->alloc(n);
+    const auto ta = xx::talloc();
+    void* p = ta->alloc(n);
+    if (p) ta->on_alloc(p, n);
+    return p;
 }
 
 void* alloc(size_t n, size_t align) {
-    return xx::talloc()->alloc(n, align);
+    const auto ta = xx::talloc();
+    void* p = ta->alloc(n, align);
+    if (p) ta->on_alloc(p, n);
+    return p;
 }
 
 void free(void* p, size_t n) {
-    return xx::talloc()->free(p, n);
+    if (p) {
+        const auto ta = xx::talloc();
+        ta->on_free(p, n);
+        ta->free(p, n);
+    }
 }
 
+// realloc is counted as a free and an allocation
 void* realloc(void* p, size_t o, size_t n) {
-    return xx::talloc()->realloc(p, o, n);
+    const auto ta = xx::talloc();
+    if (p) ta->on_free(p, o);
+    void* x = ta->realloc(p, o, n);
+    if (x) {
+        ta->on_alloc(x, n);
+    } else if (p) {
+        ta->on_alloc(p, o);
+    }
+    return x;
 }
 
 void* try_realloc(void* p, size_t o, size_t n) {
-    return xx::talloc()->try_realloc(p, o, n);
+    const auto ta = xx::talloc();
+    void* x = ta->try_realloc(p, o, n);
+    if (x) {
+        ta->on_free(p, o);
+        ta->on_alloc(x, n);
+    }
+    return x;
 }
 
 #else
@@ -1004,12 +1681,77 @@ void* try_realloc(void*, size_t, size_t) { return NULL; }
 #endif
 
 void* zalloc(size_t size) {
-    if (size <= xx::g_max_alloc_size) {
-        auto p = co::alloc(size);
-        if (p) memset(p, 0, size);
+  #ifndef CO_USE_SYS_MALLOC
+    if (size > xx::g_max_alloc_size) {
+        const auto ta = xx::talloc();
+        void* p = xx::g_sa->alloc(size, true);
+        if (p) ta->on_alloc(p, size);
         return p;
     }
+    auto p = co::alloc(size);
+    if (p) memset(p, 0, size);
+    return p;
+  #else
     return ::calloc(1, size);
+  #endif
+}
+
+arena::arena(size_t block_size)
+    : _p(0), _e(0), _b(0), _bs(block_size < 256 ? 256 : god::align_up<8>(block_size)), _cap(0) {
+}
+
+arena::~arena() {
+    for (_B* b = _b; b;) {
+        _B* const x = b;
+        b = b->next;
+        co::free(x, x->size);
+    }
+}
+
+// Allocations larger than a quarter of the block size are given blocks of their
+// own, linked after the current block, which is still used for the others.
+// Sizes of the blocks are multiples of 8, so _p never passes _e.
+void* arena::_alloc(size_t n, size_t align) {
+    const size_t h = sizeof(_B) + (align > 8 ? align - 8 : 0);
+    n = god::align_up<8>(n);
+    if (n > (_bs >> 2) && _b) {
+        const size_t s = h + n;
+        _B* const b = (_B*) co::alloc(s);
+        b->size = s;
+        b->next = _b->next;
+        _b->next = b;
+        _cap += s;
+        return (void*)(((size_t)(b + 1) + align - 1) & ~(align - 1));
+    }
+
+    size_t s = _bs;
+    if (s < h + n) s = h + n;
+    _B* const b = (_B*) co::alloc(s);
+    b->size = s;
+    b->next = _b;
+    _b = b;
+    _cap += s;
+    if (_bs < (1u << 20)) _bs <<= 1;
+
+    char* const p = (char*)(((size_t)(b + 1) + align - 1) & ~(align - 1));
+    _p = p + n;
+    _e = (char*)b + s;
+    if (_p > _e) _p = _e;
+    return p;
+}
+
+void arena::clear() {
+    if (_b) {
+        for (_B* b = _b->next; b;) {
+            _B* const x = b;
+            b = b->next;
+            co::free(x, x->size);
+        }
+        _b->next = 0;
+        _cap = _b->size;
+        _p = (char*)(_b + 1);
+        _e = (char*)_b + _b->size;
+    }
 }
 
 char* strdup(const char* s) {
@@ -1019,4 +1761,118 @@ char* strdup(const char* s) {
     return p;
 }
 
+mem_stat mem_stats() {
+    mem_stat s;
+    memset(&s, 0, sizeof(s));
+    uint64 alloc_bytes = 0, free_bytes = 0;
+    auto ta = atomic_load(&xx::g_talloc_head, mo_acquire);
+    for (; ta; ta = ta->next()) {
+        const auto& x = ta->stat();
+        alloc_bytes += atomic_load(&x.alloc_bytes, mo_relaxed);
+        free_bytes += atomic_load(&x.free_bytes, mo_relaxed);
+        s.xfrees += atomic_load(&x.xfrees, mo_relaxed);
+        s.span_allocs += atomic_load(&x.span_allocs, mo_relaxed);
+        s.span_bytes += atomic_load(&x.span_bytes, mo_relaxed);
+        s.span_cached += atomic_load(&x.span_cached, mo_relaxed);
+        for (int i = 0; i < mem_stat::N; ++i) {
+            s.objects[i] += atomic_load(&x.objects[i], mo_relaxed);
+        }
+        ++s.threads;
+    }
+    // counters of different threads are not read at the same time
+    s.in_use = alloc_bytes > free_bytes ? alloc_bytes - free_bytes : 0;
+    if ((int64)s.span_bytes < 0) s.span_bytes = 0;
+    for (int i = 0; i < mem_stat::N; ++i) {
+        if ((int64)s.objects[i] < 0) s.objects[i] = 0;
+    }
+    s.span_cached += xx::g_sa->cached();
+    s.reserved = atomic_load(&xx::g_vm_reserved, mo_relaxed);
+    s.committed = atomic_load(&xx::g_vm_committed, mo_relaxed);
+    return s;
+}
+
+size_t mem_thread_stats(mem_thread_stat* v, size_t n) {
+    size_t k = 0;
+    auto ta = atomic_load(&xx::g_talloc_head, mo_acquire);
+    for (; ta; ta = ta->next(), ++k) {
+        if (k >= n) continue;
+        const auto& x = ta->stat();
+        auto& s = v[k];
+        s.id = ta->id();
+        s.small_blocks = atomic_load(&x.small_blocks, mo_relaxed);
+        s.large_blocks = atomic_load(&x.large_blocks, mo_relaxed);
+        s.allocs = atomic_load(&x.allocs, mo_relaxed);
+        s.frees = atomic_load(&x.frees, mo_relaxed);
+        s.alloc_bytes = atomic_load(&x.alloc_bytes, mo_relaxed);
+        s.free_bytes = atomic_load(&x.free_bytes, mo_relaxed);
+        s.xfrees = atomic_load(&x.xfrees, mo_relaxed);
+        s.span_allocs = atomic_load(&x.span_allocs, mo_relaxed);
+    }
+    return k;
+}
+
+void mem_profile(uint32 n) {
+    atomic_store(&xx::g_prof_rate, n, mo_relaxed);
+}
+
+size_t mem_profile_samples(mem_sample* v, size_t n) {
+    typedef xx::Profiler::Sample S;
+    auto less = [](const S& a, const S& b) {
+        if (a.depth != b.depth) return a.depth < b.depth;
+        return memcmp(a.stack, b.stack, sizeof(void*) * a.depth) < 0;
+    };
+    auto same = [](const S& a, const S& b) {
+        return a.depth == b.depth && memcmp(a.stack, b.stack, sizeof(void*) * a.depth) == 0;
+    };
+
+    // group the samples by call stack
+    auto s = xx::profiler()->samples();
+    std::sort(s.begin(), s.end(), less);
+    std::vector<mem_sample> r;
+    for (size_t i = 0; i < s.size(); ++i) {
+        if (i == 0 || !same(s[i], s[i - 1])) {
+            r.push_back(mem_sample());
+            auto& x = r.back();
+            x.bytes = 0;
+            x.count = 0;
+            x.depth = s[i].depth;
+            memcpy(x.stack, s[i].stack, sizeof(void*) * x.depth);
+        }
+        r.back().bytes += s[i].size;
+        r.back().count++;
+    }
+
+    std::sort(r.begin(), r.end(), [](const mem_sample& a, const mem_sample& b) {
+        return a.bytes > b.bytes;
+    });
+    const size_t m = r.size() < n ? r.size() : n;
+    if (m > 0) memcpy(v, r.data(), sizeof(mem_sample) * m);
+    return r.size();
+}
+
+void mem_profile_log(size_t n) {
+    std::vector<mem_sample> v(n);
+    const size_t k = mem_profile_samples(v.data(), n);
+    const size_t m = k < n ? k : n;
+    LOG << "heap profile: " << k << " call stacks, 1 in "
+        << atomic_load(&xx::g_prof_rate, mo_relaxed) << " allocations sampled";
+
+    for (size_t i = 0; i < m; ++i) {
+        const auto& x = v[i];
+        fastream s(256);
+        s << "#" << i << ": " << x.bytes << " bytes in " << x.count << " samples";
+      #if defined(__linux__) && defined(__GLIBC__)
+        char** const syms = backtrace_symbols(x.stack, (int)x.depth);
+        for (uint32 j = 0; j < x.depth; ++j) {
+            s << "\n    ";
+            if (syms) { s << syms[j]; } else { s << x.stack[j]; }
+        }
+        ::free(syms);
+      #else
+        for (uint32 j = 0; j < x.depth; ++j) s << "\n    " << x.stack[j];
+      #endif
+        LOG << s;
+    }
+}
+
 } // co
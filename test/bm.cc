@@ -75,6 +75,35 @@ BM_group(malloc_free) {
     );
 }
 
+// parse a document and discard it, as a server does with a request
+BM_group(json_parse) {
+    const fastring s = json::Json({
+        { "id", 12345 },
+        { "name", "coost" },
+        { "tags", { "json", "parser", "arena" } },
+        { "items", {
+            { { "k", 1 }, { "v", 3.14 }, { "s", "hello world" } },
+            { { "k", 2 }, { "v", 2.71 }, { "s", "hello again" } },
+            { { "k", 3 }, { "v", 1.41 }, { "s", "and again" } },
+        }},
+        { "ok", true },
+    }).str();
+    json::Json v;
+
+    BM_add(json::parse)(
+        v = json::parse(s);
+    );
+    BM_use(v);
+
+    co::arena a;
+    BM_add(json::parse(arena))(
+        v = json::parse(s, a);
+        v.reset();
+        a.clear();
+    );
+    BM_use(v);
+}
+
 int main(int argc, char** argv) {
     flag::parse(argc, argv);
     bm::run_benchmarks();
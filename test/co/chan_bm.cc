@@ -0,0 +1,101 @@
+// Throughput of co::chan in messages per second, for 1:1, N:1 and N:M
+// topologies, with all coroutines in one scheduler or spread over schedulers,
+// with or without batch read_n()/write_n(), and of co::spsc_chan for 1:1.
+//   ./chan_bm -n 1000000 -p 4 -c 4 -co_sched_num 4
+#include "co/co.h"
+#include "co/cout.h"
+#include "co/time.h"
+
+DEF_uint32(n, 200000, "number of messages written by each producer");
+DEF_uint32(p, 4, "number of producers for N:1 and N:M");
+DEF_uint32(c, 4, "number of consumers for N:M");
+DEF_uint32(cap, 64, "capacity of the channel");
+DEF_uint32(b, 32, "number of elements in a batch");
+
+// @np producers and @nc consumers on a channel, all in the scheduler @s if it
+// is not NULL, otherwise spread over the schedulers. Elements are read and
+// written in batches if @batch is true.
+void run(const char* name, uint32 np, uint32 nc, co::Sched* s, bool batch=false) {
+    co::chan<uint32> ch(FLG_cap);
+    const uint64 total = (uint64)FLG_n * np;
+    co::wait_group wg(np + nc);
+    co::Timer t;
+
+    for (uint32 i = 0; i < nc; ++i) {
+        // the first consumer reads the remainder
+        const uint64 m = total / nc + (i == 0 ? total % nc : 0);
+        (s ? s : co::next_sched())->go([ch, wg, m, batch]() {
+            co::vector<uint32> v(FLG_b, 0);
+            for (uint64 k = 0; k < m;) {
+                if (batch) {
+                    const uint64 r = m - k;
+                    k += ch.read_n(v.data(), r < FLG_b ? (size_t)r : FLG_b);
+                } else {
+                    ch >> v[0];
+                    ++k;
+                }
+            }
+            wg.done();
+        });
+    }
+    for (uint32 i = 0; i < np; ++i) {
+        (s ? s : co::next_sched())->go([ch, wg, batch]() {
+            co::vector<uint32> v(FLG_b, 0);
+            for (uint32 k = 0; k < FLG_n;) {
+                if (batch) {
+                    const uint32 r = FLG_n - k < FLG_b ? FLG_n - k : FLG_b;
+                    for (uint32 i = 0; i < r; ++i) v[i] = k + i;
+                    k += (uint32)ch.write_n(v.data(), r);
+                } else {
+                    ch << k++;
+                }
+            }
+            wg.done();
+        });
+    }
+
+    wg.wait();
+    const int64 us = t.us();
+    co::print(name, ": ", (uint64)(total * 1e6 / (us > 0 ? us : 1)), " msgs/s");
+}
+
+// a writer and a reader on a co::spsc_chan
+void run_spsc(const char* name, co::Sched* s) {
+    co::spsc_chan<uint32> ch(FLG_cap);
+    co::wait_group wg(2);
+    co::Timer t;
+
+    (s ? s : co::next_sched())->go([ch, wg]() {
+        uint32 v = 0;
+        for (uint32 k = 0; k < FLG_n; ++k) ch >> v;
+        wg.done();
+    });
+    (s ? s : co::next_sched())->go([ch, wg]() {
+        for (uint32 k = 0; k < FLG_n; ++k) ch << k;
+        wg.done();
+    });
+
+    wg.wait();
+    const int64 us = t.us();
+    co::print(name, ": ", (uint64)(FLG_n * 1e6 / (us > 0 ? us : 1)), " msgs/s");
+}
+
+int main(int argc, char** argv) {
+    flag::parse(argc, argv);
+    if (FLG_b == 0) FLG_b = 1;
+    co::print("schedulers: ", co::sched_num(), ", cap: ", FLG_cap);
+
+    auto s = co::next_sched();
+    run("1:1 same sched  ", 1, 1, s);
+    run("N:1 same sched  ", FLG_p, 1, s);
+    run("N:M same sched  ", FLG_p, FLG_c, s);
+    run("1:1 cross sched ", 1, 1, 0);
+    run("N:1 cross sched ", FLG_p, 1, 0);
+    run("N:M cross sched ", FLG_p, FLG_c, 0);
+    run("1:1 batch       ", 1, 1, 0, true);
+    run("N:1 batch       ", FLG_p, 1, 0, true);
+    run("N:M batch       ", FLG_p, FLG_c, 0, true);
+    run_spsc("spsc same sched ", s);
+    run_spsc("spsc cross sched", 0);
+    return 0;
+}
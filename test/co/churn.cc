@@ -0,0 +1,50 @@
+// RSS over time under coroutine churn, spikes of many coroutines alive at the
+// same time followed by idle periods.
+//   ./churn -n 200000 -rounds 5
+//   ./churn -n 200000 -rounds 5 -co_pool_idle_blocks 64
+//   ./churn -n 200000 -rounds 5 -idle_ms 3000
+#include "co/co.h"
+#include "co/cout.h"
+#include "co/time.h"
+#include <stdio.h>
+
+DEF_uint32(n, 50000, "number of coroutines alive in a spike");
+DEF_uint32(rounds, 3, "number of spikes");
+DEF_uint32(idle_ms, 50, "time in ms to stay idle after each spike");
+
+// resident set size of this process in KB, 0 if /proc/self/statm is not available
+int64 rss_kb() {
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (!f) return 0;
+    long long size = 0, rss = 0;
+    const int r = fscanf(f, "%lld %lld", &size, &rss);
+    fclose(f);
+    return r == 2 ? rss * 4 : 0;
+}
+
+int main(int argc, char** argv) {
+    flag::parse(argc, argv);
+    co::Timer t;
+    co::print(t.ms(), " ms, start, rss: ", rss_kb(), " KB");
+
+    for (uint32 r = 0; r < FLG_rounds; ++r) {
+        co::event ev;
+        co::wait_group wg(FLG_n);
+        uint32 alive = 0;
+        for (uint32 i = 0; i < FLG_n; ++i) {
+            go([ev, wg, &alive]() {
+                atomic_inc(&alive, mo_relaxed);
+                ev.wait();
+                wg.done();
+            });
+        }
+        while (atomic_load(&alive, mo_relaxed) != FLG_n) sleep::ms(1);
+        co::print(t.ms(), " ms, spike ", r, ", rss: ", rss_kb(), " KB");
+
+        ev.signal();
+        wg.wait();
+        sleep::ms(FLG_idle_ms);
+        co::print(t.ms(), " ms, idle ", r, ", rss: ", rss_kb(), " KB");
+    }
+    return 0;
+}
@@ -0,0 +1,62 @@
+// Scatter-gather with co::future/co::promise and co::when_all, compared with
+// a co::chan of size 1 for each sub-request.
+//   ./future -n 10000 -m 8
+#include "co/co.h"
+#include "co/cout.h"
+#include "co/time.h"
+
+DEF_uint32(n, 2000, "number of calls");
+DEF_uint32(m, 8, "number of sub-requests in each call");
+
+// a call with the results of sub-requests returned by chans
+int call_chan() {
+    co::vector<co::chan<int>> cs(FLG_m);
+    for (uint32 i = 0; i < FLG_m; ++i) {
+        cs.emplace_back();
+        co::chan<int> c = cs.back();
+        go([c, i]() { c << (int)i; });
+    }
+    int s = 0, v = 0;
+    for (uint32 i = 0; i < FLG_m; ++i) {
+        cs[i] >> v;
+        s += v;
+    }
+    return s;
+}
+
+// a call with the results of sub-requests returned by futures
+int call_future() {
+    co::vector<co::future<int>> fs(FLG_m);
+    for (uint32 i = 0; i < FLG_m; ++i) {
+        co::promise<int> p;
+        fs.push_back(p.get_future());
+        go([p, i]() { p.set_value((int)i); });
+    }
+    co::when_all(fs).get();
+    int s = 0;
+    for (uint32 i = 0; i < FLG_m; ++i) s += fs[i].get();
+    return s;
+}
+
+template<typename F>
+int64 bench(F&& f) {
+    co::wait_group wg(1);
+    co::Timer t;
+    go([&f, wg]() {
+        int64 s = 0;
+        for (uint32 i = 0; i < FLG_n; ++i) s += f();
+        (void) s;
+        wg.done();
+    });
+    wg.wait();
+    return t.us();
+}
+
+int main(int argc, char** argv) {
+    flag::parse(argc, argv);
+    const int64 a = bench(call_chan);
+    const int64 b = bench(call_future);
+    co::print("chan:   ", a * 1000 / FLG_n, " ns per call");
+    co::print("future: ", b * 1000 / FLG_n, " ns per call");
+    return 0;
+}
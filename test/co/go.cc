@@ -1,5 +1,8 @@
 #include "co/co.h"
 #include "co/cout.h"
+#include "co/time.h"
+
+DEF_uint32(n, 100000, "number of coroutines created in the spawn benchmark");
 
 void f0() {
     co::print("f0()");
@@ -87,5 +90,22 @@ int main(int argc, char** argv) {
     go([]() { co::print("[]()"); });
 
     co::sleep(100);
+
+    // spawn throughput, go() for each task vs go_batch()
+    co::wait_group wg(FLG_n);
+    co::Timer t;
+    for (uint32 i = 0; i < FLG_n; ++i) go([wg]() { wg.done(); });
+    wg.wait();
+    int64 us = t.us();
+    co::print("go: ", FLG_n, " coroutines in ", us, " us, ", FLG_n * 1000.0 / (us + 1), " per ms");
+
+    wg.add(FLG_n);
+    t.restart();
+    co::vector<co::Closure*> v(FLG_n);
+    for (uint32 i = 0; i < FLG_n; ++i) v.push_back(co::new_closure([wg]() { wg.done(); }));
+    co::go_batch(v);
+    wg.wait();
+    us = t.us();
+    co::print("go_batch: ", FLG_n, " coroutines in ", us, " us, ", FLG_n * 1000.0 / (us + 1), " per ms");
     return 0;
 }
@@ -0,0 +1,71 @@
+// Memory after a burst of allocations in coroutines. The schedulers give free
+// memory back to the OS when they have not allocated for co_mem_trim_ms.
+//   ./mem_trim -n 20000 -s 4096 -co_mem_trim_ms 1000
+#include "co/co.h"
+#include "co/cout.h"
+#include "co/time.h"
+
+DEC_uint32(co_mem_trim_ms);
+DEF_uint32(n, 10000, "number of buffers allocated in each coroutine");
+DEF_uint32(s, 2048, "size of the buffers");
+DEF_uint32(c, 8, "number of coroutines");
+
+#ifdef __linux__
+#include <unistd.h>
+
+// resident set size of the process in KB
+uint64 rss_kb() {
+    uint64 pages = 0, rss = 0;
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (f) {
+        if (fscanf(f, "%llu %llu", (unsigned long long*)&pages, (unsigned long long*)&rss) != 2) rss = 0;
+        fclose(f);
+    }
+    return rss * (sysconf(_SC_PAGESIZE) / 1024);
+}
+#else
+uint64 rss_kb() { return 0; }
+#endif
+
+void print(const char* name) {
+    const auto s = co::mem_stats();
+    co::print(name, ": in use ", s.in_use >> 10, " KB, committed ", s.committed >> 10,
+              " KB, rss ", rss_kb(), " KB");
+}
+
+int main(int argc, char** argv) {
+    FLG_co_mem_trim_ms = 500;
+    flag::parse(argc, argv);
+    print("start          ");
+
+    // each coroutine keeps one in 64 buffers, as a cache does
+    co::wait_group wg(FLG_c);
+    co::vector<void*> kept;
+    co::mutex m;
+    for (uint32 i = 0; i < FLG_c; ++i) {
+        go([wg, &kept, &m]() {
+            co::vector<void*> v(FLG_n, 0);
+            for (uint32 k = 0; k < FLG_n; ++k) {
+                v[k] = co::alloc(FLG_s);
+                memset(v[k], 1, FLG_s);
+            }
+            for (uint32 k = 0; k < FLG_n; ++k) {
+                if (k % 64 == 0) {
+                    co::mutex_guard g(m);
+                    kept.push_back(v[k]);
+                } else {
+                    co::free(v[k], FLG_s);
+                }
+            }
+            wg.done();
+        });
+    }
+    wg.wait();
+    print("after the burst");
+
+    co::sleep(FLG_co_mem_trim_ms + 2000);
+    print("after trimming ");
+
+    for (auto p : kept) co::free(p, FLG_s);
+    return 0;
+}
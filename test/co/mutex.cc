@@ -0,0 +1,72 @@
+// Latency of co::mutex::lock() for a short critical section shared by all the
+// schedulers and some threads, with and without spinning before parking.
+//   ./mutex -c 4 -t 2 -n 20000 -cs 200 -co_sched_num 4
+#include "co/co.h"
+#include "co/cout.h"
+#include "co/time.h"
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+DEC_uint32(co_mutex_spin);
+DEF_uint32(c, 4, "number of coroutines in each scheduler");
+DEF_uint32(t, 1, "number of non-coroutine threads");
+DEF_uint32(n, 10000, "number of locks in each coroutine or thread");
+DEF_uint32(cs, 200, "length of the critical section in ns");
+
+co::mutex g_m;
+uint64 g_v = 0;
+
+// lock @n times, and save the time waiting for the lock in @lat
+void work(std::vector<uint32>* lat) {
+    lat->reserve(FLG_n);
+    for (uint32 i = 0; i < FLG_n; ++i) {
+        const int64 beg = now::ns();
+        g_m.lock();
+        const int64 t = now::ns();
+        lat->push_back((uint32)(t - beg));
+        while (now::ns() - t < FLG_cs) ++g_v;
+        g_m.unlock();
+    }
+}
+
+void run(const char* name) {
+    const auto& ss = co::scheds();
+    const size_t nco = ss.size() * FLG_c;
+    std::vector<std::vector<uint32>> lat(nco + FLG_t);
+    co::wait_group wg((uint32)(nco + FLG_t));
+    co::Timer timer;
+
+    for (size_t i = 0; i < nco; ++i) {
+        auto p = &lat[i];
+        ss[i % ss.size()]->go([p, wg]() { work(p); wg.done(); });
+    }
+    for (size_t i = nco; i < lat.size(); ++i) {
+        auto p = &lat[i];
+        std::thread([p, wg]() { work(p); wg.done(); }).detach();
+    }
+    wg.wait();
+    const int64 us = timer.us();
+
+    std::vector<uint32> v;
+    for (auto& x : lat) v.insert(v.end(), x.begin(), x.end());
+    std::sort(v.begin(), v.end());
+    auto p = [&v](double q) { return v[(size_t)((v.size() - 1) * q)]; };
+    co::print(
+        name, ": ", (uint64)(v.size() * 1e6 / (us > 0 ? us : 1)), " locks/s, wait ns: p50 ",
+        p(0.5), ", p90 ", p(0.9), ", p99 ", p(0.99), ", p99.9 ", p(0.999), ", max ", v.back()
+    );
+}
+
+int main(int argc, char** argv) {
+    flag::parse(argc, argv);
+    co::print("schedulers: ", co::sched_num(), ", coroutines: ", co::sched_num() * FLG_c,
+              ", threads: ", FLG_t, ", critical section: ", FLG_cs, " ns");
+
+    const uint32 spin = FLG_co_mutex_spin ? FLG_co_mutex_spin : 200;
+    FLG_co_mutex_spin = 0;
+    run("no spin  ");
+    FLG_co_mutex_spin = spin;
+    run("spin     ");
+    return 0;
+}
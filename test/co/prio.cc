@@ -0,0 +1,54 @@
+// Latency of tasks in the high priority lane and in the normal lane, while the
+// scheduler is busy with bulk work.
+//   ./prio -n 1000 -m 1000 -probes 100
+#include "co/co.h"
+#include "co/cout.h"
+#include "co/time.h"
+#include <thread>
+
+DEF_uint32(n, 1000, "number of coroutines doing bulk work");
+DEF_uint32(m, 200, "number of yields per bulk coroutine");
+DEF_uint32(probes, 50, "number of latency probes in each lane");
+
+co::wait_group wg;
+
+// bulk work, yield and get back to the ready queue again and again
+void bulk() {
+    for (uint32 i = 0; i < FLG_m; ++i) {
+        co::resume(co::coroutine());
+        co::yield();
+    }
+    wg.done();
+}
+
+// start @probes tasks with @spawn, and return the average latency in us
+template<typename F>
+int64 probe(F&& spawn) {
+    int64 lat = 0;
+    co::wait_group w(FLG_probes);
+    for (uint32 i = 0; i < FLG_probes; ++i) {
+        const int64 s = now::us();
+        spawn([s, w, &lat]() {
+            atomic_add(&lat, now::us() - s, mo_relaxed);
+            w.done();
+        });
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    w.wait();
+    return lat / FLG_probes;
+}
+
+int main(int argc, char** argv) {
+    flag::parse(argc, argv);
+    flag::set_value("co_sched_num", "1");
+
+    wg.add(FLG_n);
+    for (uint32 i = 0; i < FLG_n; ++i) go(bulk);
+    const int64 lo = probe([](std::function<void()>&& f) { go(std::move(f)); });
+    const int64 hi = probe([](std::function<void()>&& f) { co::go_prio(std::move(f)); });
+    wg.wait();
+
+    co::print("normal lane, avg latency: ", lo, " us");
+    co::print("high priority lane, avg latency: ", hi, " us");
+    return 0;
+}
@@ -0,0 +1,74 @@
+// Contention of co::shared_mutex against co::mutex on a read-mostly table, and
+// throughput of co::semaphore. Use -hold to keep the lock for some time (the
+// coroutine sleeps with the lock held), as a slow lookup does.
+//   ./rwlock -c 64 -n 20000 -w 5 -co_sched_num 4
+#include "co/co.h"
+#include "co/cout.h"
+#include "co/time.h"
+#include "co/rand.h"
+#include <unordered_map>
+
+DEF_uint32(c, 16, "number of coroutines");
+DEF_uint32(n, 20000, "number of operations in each coroutine");
+DEF_uint32(w, 5, "percent of writes");
+DEF_uint32(hold, 0, "ms to hold the lock in 1 of 100 operations");
+
+std::unordered_map<uint32, uint32> g_table;
+
+// lookup, or update the table
+inline uint32 op(uint32 k, bool write) {
+    if (write) return ++g_table[k & 1023];
+    auto it = g_table.find(k & 1023);
+    return it != g_table.end() ? it->second : 0;
+}
+
+template<typename L, typename U>
+void run(const char* name, L&& lock, U&& unlock) {
+    co::wait_group wg(FLG_c);
+    co::Timer t;
+    for (uint32 i = 0; i < FLG_c; ++i) {
+        go([&lock, &unlock, wg, i]() {
+            uint32 seed = co::rand() + i, s = 0;
+            for (uint32 k = 0; k < FLG_n; ++k) {
+                const uint32 r = co::rand(seed);
+                const bool write = r % 100 < FLG_w;
+                lock(write);
+                s += op(r, write);
+                if (FLG_hold && k % 100 == 0) co::sleep(FLG_hold);
+                unlock(write);
+            }
+            (void) s;
+            wg.done();
+        });
+    }
+    wg.wait();
+    const int64 us = t.us();
+    co::print(name, ": ", (uint64)((uint64)FLG_c * FLG_n * 1e6 / (us > 0 ? us : 1)), " ops/s");
+}
+
+int main(int argc, char** argv) {
+    flag::parse(argc, argv);
+    if (FLG_w > 100) FLG_w = 100;
+    for (uint32 i = 0; i < 1024; ++i) g_table[i] = i;
+    co::print("schedulers: ", co::sched_num(), ", coroutines: ", FLG_c, ", writes: ", FLG_w, "%");
+
+    co::mutex m;
+    run("mutex       ",
+        [&m](bool) { m.lock(); },
+        [&m](bool) { m.unlock(); }
+    );
+
+    co::shared_mutex sm;
+    run("shared_mutex",
+        [&sm](bool w) { w ? sm.lock() : sm.lock_shared(); },
+        [&sm](bool w) { w ? sm.unlock() : sm.unlock_shared(); }
+    );
+
+    // a semaphore of one permit is a mutex
+    co::semaphore s(1);
+    run("semaphore(1)",
+        [&s](bool) { s.acquire(); },
+        [&s](bool) { s.release(); }
+    );
+    return 0;
+}
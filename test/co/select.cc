@@ -0,0 +1,51 @@
+// Fan-in of several channels with co::select, and a timeout. Producers run in
+// different schedulers, the consumer checks that no element is lost or read twice.
+//   ./select -n 100000 -c 4 -co_sched_num 4
+#include "co/co.h"
+#include "co/cout.h"
+#include "co/time.h"
+
+DEF_uint32(n, 20000, "number of elements written by each producer");
+DEF_uint32(c, 4, "number of channels (at most 8)");
+DEF_uint32(ms, 5, "timeout in ms of select");
+
+int main(int argc, char** argv) {
+    flag::parse(argc, argv);
+    if (FLG_c == 0 || FLG_c > 8) FLG_c = 4;
+
+    co::vector<co::chan<uint32>> cs(FLG_c);
+    for (uint32 i = 0; i < FLG_c; ++i) cs.emplace_back(i + 1);
+
+    co::wait_group wg(FLG_c + 1);
+    for (uint32 i = 0; i < FLG_c; ++i) {
+        auto c = cs[i];
+        co::next_sched()->go([c, wg]() {
+            for (uint32 k = 0; k < FLG_n; ++k) {
+                c << k;
+                if ((k & 1023) == 0) co::sleep(1); // let the consumer time out sometimes
+            }
+            wg.done();
+        });
+    }
+
+    uint64 sum = 0, count = 0, timeouts = 0;
+    co::Timer t;
+    go([&, wg]() {
+        uint32 v = 0;
+        co::select_case sc[8];
+        for (uint32 i = 0; i < FLG_c; ++i) sc[i] = co::read_case(cs[i], v);
+        while (count < (uint64)FLG_n * FLG_c) {
+            const int r = co::select(sc, FLG_c, FLG_ms);
+            if (r < 0) { ++timeouts; continue; }
+            sum += v;
+            ++count;
+        }
+        wg.done();
+    });
+    wg.wait();
+
+    const uint64 expected = (uint64)FLG_c * FLG_n * (FLG_n - 1) / 2;
+    co::print("elements: ", count, ", timeouts: ", timeouts, ", ", t.ms(), " ms");
+    co::print(sum == expected ? "sum ok" : "sum mismatch");
+    return sum == expected ? 0 : 1;
+}
@@ -0,0 +1,27 @@
+#include "co/co.h"
+#include "co/cout.h"
+
+DEF_uint32(n, 1000, "coroutine number");
+
+DEF_main(argc, argv) {
+    co::wait_group wg(FLG_n);
+    for (uint32 i = 0; i < FLG_n; ++i) {
+        go([wg]() {
+            co::sleep(10);
+            wg.done();
+        });
+    }
+    wg.wait();
+
+    auto v = co::sched_stats();
+    for (size_t i = 0; i < v.size(); ++i) {
+        auto& s = v[i];
+        co::print(
+            "sched ", s.id, ": coroutines ", s.coroutines, ", switches ", s.switches,
+            ", stack_bytes ", s.stack_bytes, ", ready ", s.ready, ", timers ", s.timers,
+            ", wait_us ", s.wait_us, ", run_us ", s.run_us, ", io_events ", s.io_events,
+            ", overruns ", s.overruns, ", buf_hits ", s.buf_hits, ", buf_misses ", s.buf_misses
+        );
+    }
+    return 0;
+}
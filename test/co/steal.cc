@@ -0,0 +1,46 @@
+// Queueing latency of coroutines under skewed load.
+// Run it with and without -co_steal to see the effect of work stealing:
+//   ./steal -n 20000 -k 64 -heavy_us 2000
+//   ./steal -n 20000 -k 64 -heavy_us 2000 -co_steal
+#include "co/co.h"
+#include "co/cout.h"
+#include "co/time.h"
+#include <algorithm>
+#include <vector>
+
+DEC_bool(co_steal);
+
+DEF_uint32(n, 20000, "number of coroutines");
+DEF_uint32(k, 64, "every k-th coroutine is a heavy one");
+DEF_uint32(heavy_us, 2000, "cpu time in us of a heavy coroutine");
+DEF_uint32(light_us, 2, "cpu time in us of a light coroutine");
+
+static void spin(int64 us) {
+    const int64 end = now::us() + us;
+    while (now::us() < end);
+}
+
+DEF_main(argc, argv) {
+    std::vector<int64> lat(FLG_n);
+    co::wait_group wg(FLG_n);
+
+    co::Timer t;
+    for (uint32 i = 0; i < FLG_n; ++i) {
+        const int64 created = now::us();
+        go([&lat, wg, i, created]() {
+            lat[i] = now::us() - created;
+            spin(i % FLG_k == 0 ? FLG_heavy_us : FLG_light_us);
+            wg.done();
+        });
+    }
+    wg.wait();
+    const int64 total = t.us();
+
+    std::sort(lat.begin(), lat.end());
+    auto pct = [&lat](double p) { return lat[(size_t)((lat.size() - 1) * p)]; };
+    co::print("co_steal: ", FLG_co_steal, " sched_num: ", co::sched_num());
+    co::print("total: ", total / 1000, " ms");
+    co::print("queue latency(us) p50: ", pct(0.5), " p99: ", pct(0.99),
+              " p999: ", pct(0.999), " max: ", lat.back());
+    return 0;
+}
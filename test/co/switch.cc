@@ -0,0 +1,54 @@
+// Cost of context switches of coroutines with deep stacks, on the shared
+// stacks and on dedicated stacks.
+//   ./switch -n 64 -m 10000 -depth 32768
+#include "co/co.h"
+#include "co/cout.h"
+#include "co/time.h"
+
+DEF_uint32(n, 64, "number of coroutines, more than co_stack_num to make them share stacks");
+DEF_uint32(m, 2000, "number of switches per coroutine");
+DEF_uint32(depth, 16 * 1024, "bytes of stack used by each coroutine when it yields");
+
+co::wait_group wg;
+
+// use about @n bytes of stack, and then switch out and in the coroutine
+void deep(uint32 n) {
+    volatile char buf[1024];
+    buf[0] = (char)n;
+    if (n > sizeof(buf)) {
+        deep(n - sizeof(buf));
+    } else {
+        for (uint32 i = 0; i < FLG_m; ++i) {
+            co::resume(co::coroutine());
+            co::yield();
+        }
+    }
+    buf[sizeof(buf) - 1] = buf[0];
+}
+
+void f() {
+    deep(FLG_depth);
+    wg.done();
+}
+
+int main(int argc, char** argv) {
+    flag::parse(argc, argv);
+    flag::set_value("co_sched_num", "1");
+    const double s = (double)FLG_n * FLG_m;
+
+    wg.add(FLG_n);
+    co::Timer t;
+    for (uint32 i = 0; i < FLG_n; ++i) go(f);
+    wg.wait();
+    co::print("shared stack: ", t.us() * 1000 / s, " ns per switch");
+
+    wg.add(FLG_n);
+    t.restart();
+    for (uint32 i = 0; i < FLG_n; ++i) co::go_stack(FLG_depth * 2 + 64 * 1024, f);
+    wg.wait();
+    co::print("dedicated stack: ", t.us() * 1000 / s, " ns per switch");
+
+    auto v = co::sched_stats();
+    co::print("stack save buffers, hits: ", v[0].buf_hits, " misses: ", v[0].buf_misses);
+    return 0;
+}
@@ -0,0 +1,57 @@
+// Fan-out requests to a server that never replies, with a task group. The group
+// times out, and the children blocked in co::recv() are cancelled at once.
+//   ./task_group -n 64 -ms 100
+#include "co/co.h"
+#include "co/cout.h"
+#include "co/time.h"
+
+DEF_uint32(n, 32, "number of requests");
+DEF_uint32(ms, 100, "timeout in ms of the requests");
+DEF_int32(port, 9977, "port of the server");
+
+// accept connections, and keep them open without replying
+void serve(sock_t fd) {
+    while (true) {
+        sock_t c = co::accept(fd, 0, 0);
+        if (c == (sock_t)-1) break;
+        go([c]() {
+            char buf[8];
+            co::recv(c, buf, sizeof(buf));
+            co::close(c);
+        });
+    }
+}
+
+int main(int argc, char** argv) {
+    flag::parse(argc, argv);
+
+    struct sockaddr_in addr;
+    co::init_addr(&addr, "127.0.0.1", FLG_port);
+    sock_t fd = co::tcp_socket();
+    co::set_reuseaddr(fd);
+    if (co::bind(fd, &addr, sizeof(addr)) != 0 || co::listen(fd, 1024) != 0) {
+        co::print("bind or listen failed: ", co::strerror());
+        return 1;
+    }
+    go(serve, fd);
+
+    uint32 cancelled = 0;
+    co::Timer t;
+    co::task_group g;
+    for (uint32 i = 0; i < FLG_n; ++i) {
+        g.go([&addr, &cancelled]() {
+            sock_t c = co::tcp_socket();
+            if (co::connect(c, &addr, sizeof(addr)) != 0) { co::close(c); return false; }
+            char buf[8];
+            const int r = co::recv(c, buf, sizeof(buf)); // no reply, blocks until cancelled
+            if (r < 0 && co::error() == ECANCELED) atomic_inc(&cancelled, mo_relaxed);
+            co::close(c);
+            return r > 0;
+        });
+    }
+
+    const bool ok = g.wait(FLG_ms);
+    co::print("wait: ", ok, ", error: ", co::strerror(g.error()), ", ", t.ms(), " ms");
+    co::print("requests cancelled: ", cancelled, "/", FLG_n);
+    return 0;
+}
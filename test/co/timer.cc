@@ -0,0 +1,53 @@
+// Cost of timers in coroutines, run it with and without -co_timer_wheel:
+//   ./timer -n 100000
+//   ./timer -n 100000 -co_timer_wheel
+#include "co/co.h"
+#include "co/cout.h"
+#include "co/time.h"
+
+DEC_bool(co_timer_wheel);
+DEF_uint32(n, 10000, "number of coroutines waiting with a timer");
+DEF_uint32(ms, 3600 * 1000, "timeout in ms of the pending timers");
+
+int main(int argc, char** argv) {
+    flag::parse(argc, argv);
+    co::print("co_timer_wheel: ", FLG_co_timer_wheel, " timers: ", FLG_n);
+
+    // park coroutines with pending timers, then wake them up before timeout
+    co::event ev(true);
+    co::wait_group wg(FLG_n);
+    uint32 parked = 0;
+    co::Timer t;
+    for (uint32 i = 0; i < FLG_n; ++i) {
+        go([ev, wg, &parked]() {
+            atomic_inc(&parked, mo_relaxed);
+            ev.wait(FLG_ms);
+            wg.done();
+        });
+    }
+    while (atomic_load(&parked, mo_relaxed) != FLG_n) sleep::ms(1);
+    co::print("park: ", t.us(), " us");
+
+    sleep::ms(50);
+    t.restart();
+    ev.signal();
+    wg.wait();
+    co::print("wake: ", t.us(), " us");
+
+    // timers expired, the lateness is the time after the expected timeout
+    int64 late = 0;
+    wg.add(FLG_n);
+    t.restart();
+    for (uint32 i = 0; i < FLG_n; ++i) {
+        go([wg, i, &late]() {
+            const uint32 ms = i % 100 + 1;
+            const int64 s = now::us();
+            co::sleep(ms);
+            atomic_add(&late, now::us() - s - ms * 1000, mo_relaxed);
+            wg.done();
+        });
+    }
+    wg.wait();
+    co::print("expire: ", t.us(), " us, avg lateness: ", late / FLG_n, " us");
+    return 0;
+}
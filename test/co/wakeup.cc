@@ -0,0 +1,96 @@
+// Cross-thread co::resume() latency and read/write syscalls per wakeup.
+//   ./wakeup -n 10000 -gap_us 200
+#include "co/co.h"
+#include "co/cout.h"
+#include "co/time.h"
+#include <stdio.h>
+#include <mutex>
+#include <thread>
+
+DEF_uint32(n, 2000, "number of wakeups");
+DEF_uint32(gap_us, 200, "interval in us between wakeups, the scheduler is sleeping then");
+
+// number of read and write syscalls of this process, 0 if /proc/self/io is not available
+int64 syscalls() {
+    FILE* f = fopen("/proc/self/io", "r");
+    if (!f) return 0;
+    char k[32];
+    long long v, n = 0;
+    while (fscanf(f, "%31s %lld", k, &v) == 2) {
+        if (strcmp(k, "syscr:") == 0 || strcmp(k, "syscw:") == 0) n += v;
+    }
+    fclose(f);
+    return n;
+}
+
+void* g_co = 0;
+int64 g_ns = 0;   // time when the coroutine was resumed
+int64 g_lat = 0;  // total latency in ns
+co::wait_group wg;
+
+// the coroutine yields and records the latency each time it is resumed
+void f() {
+    for (uint32 i = 0; i < FLG_n; ++i) {
+        atomic_store(&g_co, co::coroutine(), mo_release);
+        co::yield();
+        g_lat += now::ns() - g_ns;
+    }
+    wg.done();
+}
+
+void* wait_co() {
+    void* co;
+    while (!(co = atomic_swap(&g_co, (void*)0, mo_acquire))) std::this_thread::sleep_for(std::chrono::microseconds(10));
+    return co;
+}
+
+// all the coroutines yield, and are resumed in a burst by another thread
+co::vector<void*> g_cos;
+std::mutex g_mtx;
+
+void g() {
+    {
+        std::lock_guard<std::mutex> x(g_mtx);
+        g_cos.push_back(co::coroutine());
+    }
+    co::yield();
+    wg.done();
+}
+
+int main(int argc, char** argv) {
+    flag::parse(argc, argv);
+
+    // wakeups with the scheduler sleeping in epoll
+    wg.add(1);
+    go(f);
+    int64 s = syscalls();
+    for (uint32 i = 0; i < FLG_n; ++i) {
+        void* co = wait_co();
+        std::this_thread::sleep_for(std::chrono::microseconds(FLG_gap_us));
+        g_ns = now::ns();
+        co::resume(co);
+    }
+    wg.wait();
+    s = syscalls() - s;
+    co::print("sleeping sched, avg latency: ", g_lat / FLG_n, " ns, syscalls per wakeup: ",
+              (double)s / FLG_n);
+
+    // wakeups in a burst
+    wg.add(FLG_n);
+    for (uint32 i = 0; i < FLG_n; ++i) go(g);
+    while (true) {
+        sleep::ms(1);
+        std::lock_guard<std::mutex> x(g_mtx);
+        if (g_cos.size() == FLG_n) break;
+    }
+    sleep::ms(10);
+
+    s = syscalls();
+    co::Timer t;
+    for (size_t i = 0; i < g_cos.size(); ++i) co::resume(g_cos[i]);
+    wg.wait();
+    const int64 us = t.us();
+    s = syscalls() - s;
+    co::print("burst, total: ", us, " us, syscalls per wakeup: ", (double)s / FLG_n);
+    return 0;
+}
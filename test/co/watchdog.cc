@@ -0,0 +1,60 @@
+// CPU-heavy coroutines with and without co::maybe_yield(), and the watchdog
+// for coroutines running too long without yielding.
+//   ./watchdog -ms 200 -co_watchdog_ms 50 -co_time_slice_ms 5
+#include "co/co.h"
+#include "co/cout.h"
+#include "co/time.h"
+
+DEC_uint32(co_watchdog_ms);
+DEF_uint32(ms, 100, "time in ms each CPU-heavy coroutine runs");
+
+// busy loop for @ms milliseconds, call co::maybe_yield() in the loop if @fair is true
+void spin(uint32 ms, bool fair) {
+    const int64 end = now::ms() + ms;
+    uint64 x = 0;
+    while (now::ms() < end) {
+        for (int i = 0; i < 1000; ++i) x += i;
+        if (fair) co::maybe_yield();
+    }
+    volatile uint64 v = x;
+    (void) v;
+}
+
+// max delay of a coroutine sleeping 1ms in a loop, while another coroutine is spinning
+int64 max_delay(bool fair) {
+    co::wait_group wg(2);
+    int64 delay = 0;
+    bool done = false;
+    auto s = co::next_sched();
+    s->go([&, wg]() {
+        while (!atomic_load(&done, mo_acquire)) {
+            const int64 t = now::ms();
+            co::sleep(1);
+            const int64 d = now::ms() - t - 1;
+            if (d > delay) delay = d;
+        }
+        wg.done();
+    });
+    s->go([&, wg, fair]() {
+        co::sleep(5);
+        spin(FLG_ms, fair);
+        atomic_store(&done, true, mo_release);
+        wg.done();
+    });
+    wg.wait();
+    return delay;
+}
+
+int main(int argc, char** argv) {
+    flag::parse(argc, argv);
+    if (FLG_co_watchdog_ms == 0) flag::set_value("co_watchdog_ms", "50");
+
+    co::print("without maybe_yield(), max delay of the timer: ", max_delay(false), " ms");
+    co::print("with maybe_yield(), max delay of the timer: ", max_delay(true), " ms");
+
+    uint64 overruns = 0;
+    auto v = co::sched_stats();
+    for (size_t i = 0; i < v.size(); ++i) overruns += v[i].overruns;
+    co::print("overruns: ", overruns);
+    return 0;
+}
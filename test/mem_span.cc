@@ -0,0 +1,82 @@
+// Cost of allocations larger than 128K with co::alloc() and ::malloc(), and of
+// growing a buffer by doubling it with co::realloc() and ::realloc().
+//   ./mem_span -n 10000 -s 1048576 -t 4
+#include "co/co.h"
+#include "co/cout.h"
+#include "co/time.h"
+#include <thread>
+#include <vector>
+
+DEF_uint32(n, 2000, "number of allocations in each thread");
+DEF_uint32(s, 1024 * 1024, "size of the allocations");
+DEF_uint32(t, 2, "number of threads");
+DEF_uint32(max, 64, "MB the buffer grows to in the realloc test");
+
+char* volatile g_sink;
+
+// @n allocations and frees of @s bytes in each thread, touching the first page
+template<typename A, typename F>
+void run(const char* name, A&& alloc, F&& free) {
+    std::vector<std::thread> v;
+    co::Timer t;
+    for (uint32 i = 0; i < FLG_t; ++i) {
+        v.emplace_back([&alloc, &free]() {
+            for (uint32 k = 0; k < FLG_n; ++k) {
+                char* p = (char*) alloc(FLG_s);
+                p[0] = (char)k;
+                g_sink = p; // keep the compiler from eliding malloc/free
+                free(p, FLG_s);
+            }
+        });
+    }
+    for (auto& x : v) x.join();
+    const int64 us = t.us();
+    const uint64 total = (uint64)FLG_n * FLG_t;
+    co::print(name, ": ", (uint64)(total * 1e6 / (us > 0 ? us : 1)), " alloc/free pairs per second");
+}
+
+// grow a buffer from 256K to FLG_max MB by doubling it, writing the new part
+template<typename R>
+void run_realloc(const char* name, R&& realloc) {
+    const size_t max = (size_t)FLG_max << 20;
+    co::Timer t;
+    size_t n = 256 * 1024;
+    char* p = (char*) realloc(NULL, 0, n);
+    memset(p, 1, n);
+    while (n < max) {
+        p = (char*) realloc(p, n, n * 2);
+        memset(p + n, 1, n);
+        n *= 2;
+    }
+    const int64 us = t.us();
+    co::print(name, ": ", us, " us to grow to ", FLG_max, " MB");
+    (void) p;
+}
+
+int main(int argc, char** argv) {
+    flag::parse(argc, argv);
+    co::print("threads: ", FLG_t, ", size: ", FLG_s);
+
+    run("co::alloc/co::free",
+        [](size_t n) { return co::alloc(n); },
+        [](void* p, size_t n) { co::free(p, n); }
+    );
+    run("::malloc/::free   ",
+        [](size_t n) { return ::malloc(n); },
+        [](void* p, size_t) { ::free(p); }
+    );
+
+    void* p = 0;
+    size_t n = 0;
+    run_realloc("co::realloc", [&p, &n](void* x, size_t o, size_t m) {
+        n = m;
+        return p = co::realloc(x, o, m);
+    });
+    co::free(p, n);
+
+    run_realloc("::realloc  ", [&p](void* x, size_t, size_t m) {
+        return p = ::realloc(x, m);
+    });
+    ::free(p);
+    return 0;
+}
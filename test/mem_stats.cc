@@ -0,0 +1,64 @@
+// Print statistics of co::alloc(), and the call stacks holding the most memory
+// sampled by the heap profiler.
+//   ./mem_stats -n 100000 -rate 100
+#include "co/co.h"
+#include "co/cout.h"
+#include "co/log.h"
+#include <thread>
+#include <vector>
+
+DEF_uint32(n, 50000, "number of allocations in each thread");
+DEF_uint32(t, 2, "number of threads");
+DEF_uint32(rate, 64, "the heap profiler samples one in so many allocations");
+
+// keep the memory, as a cache does
+void* small_objects(uint32 i) { return co::alloc(16 + (i & 255)); }
+void* buffers(uint32 i) { return co::alloc(4096 + (i & 7) * 1024); }
+
+void print_stats() {
+    const auto s = co::mem_stats();
+    co::print("in use: ", s.in_use, ", reserved: ", s.reserved, ", committed: ", s.committed,
+              ", xfrees: ", s.xfrees, ", span allocs: ", s.span_allocs, ", span bytes: ", s.span_bytes);
+    fastream o(256);
+    o << "objects:";
+    for (int i = 0; i < co::mem_stat::N; ++i) o << ' ' << s.objects[i];
+    co::print(o);
+
+    std::vector<co::mem_thread_stat> v(s.threads);
+    const size_t k = co::mem_thread_stats(v.data(), v.size());
+    for (size_t i = 0; i < k && i < v.size(); ++i) {
+        const auto& x = v[i];
+        co::print("thread allocator ", x.id, ": small blocks ", x.small_blocks,
+                  ", large blocks ", x.large_blocks, ", allocs ", x.allocs, ", frees ", x.frees,
+                  ", bytes in use ", (int64)(x.alloc_bytes - x.free_bytes), ", xfrees ", x.xfrees);
+    }
+}
+
+int main(int argc, char** argv) {
+    flag::parse(argc, argv);
+    FLG_cout = true;
+    co::mem_profile(FLG_rate);
+
+    std::vector<std::vector<void*>> v(FLG_t);
+    for (uint32 k = 0; k < FLG_t; ++k) {
+        auto p = &v[k];
+        std::thread([p, k]() {
+            for (uint32 i = 0; i < FLG_n; ++i) {
+                p->push_back(i % 16 == 0 ? buffers(i) : small_objects(i));
+            }
+            // free half of the memory owned by the previous thread
+            if (k > 0) {
+                auto& x = *(p - 1);
+                for (uint32 i = 0; i < FLG_n; i += 2) {
+                    co::free(x[i], i % 16 == 0 ? 4096 + (i & 7) * 1024 : 16 + (i & 255));
+                    x[i] = 0;
+                }
+            }
+        }).join();
+    }
+
+    print_stats();
+    co::mem_profile_log(4);
+    log::exit();
+    return 0;
+}
@@ -0,0 +1,68 @@
+// Throughput of co::alloc() on one thread and co::free() on another, as a
+// pipeline handing buffers between threads does. Frees of memory owned by
+// another thread are buffered and flushed in batches.
+//   ./xfree -n 1000000 -s 64 -p 2
+#include "co/co.h"
+#include "co/cout.h"
+#include "co/time.h"
+#include <thread>
+
+DEF_uint32(n, 200000, "number of buffers allocated by each producer");
+DEF_uint32(s, 64, "size of the buffers");
+DEF_uint32(b, 64, "number of buffers handed over at a time");
+DEF_uint32(p, 1, "number of producer-consumer pairs");
+DEF_bool(sys, false, "also run with ::malloc and ::free");
+
+template<typename A, typename F>
+void run(const char* name, A&& alloc, F&& free) {
+    co::wait_group wg(FLG_p * 2);
+    co::Timer t;
+
+    for (uint32 k = 0; k < FLG_p; ++k) {
+        co::chan<void*> ch(FLG_b * 4);
+        std::thread([ch, wg, &alloc]() {
+            co::vector<void*> v(FLG_b, 0);
+            for (uint32 i = 0; i < FLG_n;) {
+                const uint32 m = FLG_n - i < FLG_b ? FLG_n - i : FLG_b;
+                for (uint32 j = 0; j < m; ++j) v[j] = alloc(FLG_s);
+                ch.write_n(v.data(), m);
+                i += m;
+            }
+            wg.done();
+        }).detach();
+
+        std::thread([ch, wg, &free]() {
+            co::vector<void*> v(FLG_b, 0);
+            for (uint32 i = 0; i < FLG_n;) {
+                const size_t m = ch.read_n(v.data(), FLG_b);
+                for (size_t j = 0; j < m; ++j) free(v[j], FLG_s);
+                i += (uint32)m;
+            }
+            wg.done();
+        }).detach();
+    }
+
+    wg.wait();
+    const int64 us = t.us();
+    const uint64 total = (uint64)FLG_n * FLG_p;
+    co::print(name, ": ", (uint64)(total * 1e6 / (us > 0 ? us : 1)), " alloc/free pairs per second");
+}
+
+int main(int argc, char** argv) {
+    flag::parse(argc, argv);
+    if (FLG_b == 0) FLG_b = 1;
+    co::print("pairs: ", FLG_p, ", size: ", FLG_s, ", batch: ", FLG_b);
+
+    run("co::alloc/co::free",
+        [](size_t n) { return co::alloc(n); },
+        [](void* p, size_t n) { co::free(p, n); }
+    );
+
+    if (FLG_sys) {
+        run("::malloc/::free   ",
+            [](size_t n) { return ::malloc(n); },
+            [](void* p, size_t) { ::free(p); }
+        );
+    }
+    return 0;
+}
@@ -1,6 +1,7 @@
 #include "co/unitest.h"
 #include "co/co.h"
 #include "co/cout.h"
+#include "co/time.h"
 
 namespace test {
 
@@ -149,111 +150,108 @@ struct Coroutine {
         Buffer buf;   // for saving stack data of this coroutine
         void* pbuf;
     };
-    void* x[5];
+    Coroutine* next;
+    void* x[4];
 };
 
+inline uint32 find_lsb(uint32 x) {
+    return __builtin_ctz(x);
+}
+
 class CoroutinePool {
   public:
     static const int E = 5;
     static const int N = 1 << E; // max coroutines per block
-    static const int M = 4;
+    static const int M = 32;     // number of blocks added each time the pool grows
 
-    CoroutinePool()
-        : _c(0), _o(0), _v(M), _use_count(M) {
-        _v.resize(M);
-        _use_count.resize(M);
+    explicit CoroutinePool(uint32 idle_blocks)
+        : _idle(0), _idle_blocks(idle_blocks) {
+        this->grow();
     }
 
     ~CoroutinePool() {
-        for (size_t i = 0; i < _v.size(); ++i) {
-            if (_v[i]) ::free(_v[i]);
+        for (size_t i = 0; i < _blks.size(); ++i) {
+            if (_blks[i].p) ::free(_blks[i].p);
         }
-        _v.clear();
     }
 
     Coroutine* pop() {
-        int id = 0;
-        if (!_v0.empty()) { id = _v0.pop_back(); goto reuse; }
-        if (!_vc.empty()) { id = _vc.pop_back(); goto reuse; }
-        if (_o < N) goto newco;
-        _c = !_blks.empty() ? *_blks.begin() : _c + 1;
-        if (!_blks.empty()) _blks.erase(_blks.begin());
-        _o = 0;
-
-      newco:
-        {
-            if (_c < _v.size()) {
-                if (!_v[_c]) _v[_c] = (Coroutine*) ::calloc(N, sizeof(Coroutine));
-            } else {
-                const int c = god::align_up<M>(_c + 1);
-                _v.resize(c);
-                _use_count.resize(c);
-                _v[_c] = (Coroutine*) ::calloc(N, sizeof(Coroutine));
-            }
-
-            auto& co = _v[_c][_o];
-            co.id = (_c << E) + _o++;
-            _use_count[_c]++;
-            return &co;
+        const uint32 q = this->find_block();
+        blk_t& b = _blks[q];
+        if (!b.p) {
+            b.p = (Coroutine*) ::calloc(N, sizeof(Coroutine));
+        } else if (b.used == 0 && q != 0) {
+            --_idle;
         }
 
-      reuse:
-        {
-            const int q = id >> E;
-            const int r = id & (N - 1);
-            auto& co = _v[q][r];
-            co.ctx = 0;
-            _use_count[q]++;
-            return &co;
+        Coroutine* co;
+        if (b.free) {
+            co = b.free;
+            b.free = co->next;
+            co->ctx = 0;
+        } else {
+            co = &b.p[b.o];
+            co->id = (q << E) + b.o++;
         }
+        if (++b.used == N) _bits[q >> 5] &= ~(1u << (q & 31));
+        return co;
     }
 
     void push(Coroutine* co) {
-        const int id = co->id;
-        const int q = id >> E;
-        if (q == 0) {
-            if (_v0.capacity() == 0) _v0.reserve(N);
-            _v0.push_back(id);
-            goto end;
-        }
-        if (q == _c) {
-            if (_vc.capacity() == 0) _vc.reserve(N);
-            _vc.push_back(id);
-            goto end;
-        }
-
-      end:
-        if (--_use_count[q] == 0) {
-            ::free(_v[q]);
-            _v[q] = 0;
-            if (q != _c) {
-                _blks.insert(q);
+        const uint32 q = co->id >> E;
+        blk_t& b = _blks[q];
+        co->next = b.free;
+        b.free = co;
+        if (b.used-- == N) _bits[q >> 5] |= 1u << (q & 31);
+        if (b.used == 0 && q != 0) {
+            if (_idle < _idle_blocks) {
+                ++_idle;
             } else {
-                _vc.clear();
-                _o = 0;
-                if (!_blks.empty() && *_blks.begin() < _c) {
-                    _blks.insert(_c);
-                    _c = *_blks.begin();
-                    _blks.erase(_blks.begin());
-                }
+                ::free(b.p);
+                b.p = 0;
+                b.free = 0;
+                b.o = 0;
             }
         }
     }
 
     Coroutine& operator[](int i) const {
-        const int q = i >> E;
-        const int r = i & (N - 1);
-        return _v[q][r];
+        return _blks[i >> E].p[i & (N - 1)];
+    }
+
+    // number of blocks allocated
+    int blocks() const {
+        int n = 0;
+        for (size_t i = 0; i < _blks.size(); ++i) n += !!_blks[i].p;
+        return n;
     }
 
   private:
-    int _c; // current block
-    int _o; // offset in the current block [0, S)
-    co::vector<Coroutine*> _v;
-    co::vector<int> _use_count;
-    co::vector<int> _v0; // id of coroutine in _v[0]
-    co::vector<int> _vc; // id of coroutine in _v[_c]
-    co::set<int> _blks; // blocks available
+    struct blk_t {
+        Coroutine* p;
+        Coroutine* free;
+        uint32 used;
+        uint32 o;
+    };
+
+    uint32 find_block() {
+        for (size_t i = 0; i < _bits.size(); ++i) {
+            if (_bits[i]) return (uint32)(i << 5) + find_lsb(_bits[i]);
+        }
+        const uint32 q = (uint32)_blks.size();
+        this->grow();
+        return q;
+    }
+
+    void grow() {
+        _blks.append(M, blk_t{ 0, 0, 0, 0 });
+        _bits.append(M / 32, ~0u);
+    }
+
+    co::vector<blk_t> _blks;
+    co::vector<uint32> _bits;
+    uint32 _idle;
+    uint32 _idle_blocks;
 };
 
 DEF_test(co) {
@@ -279,6 +277,180 @@ DEF_test(co) {
         v = 0;
     }
 
+    DEF_case(task_group) {
+        int n = 0;
+        {
+            co::task_group g;
+            for (int i = 0; i < 8; ++i) {
+                g.go([&n]() { atomic_inc(&n, mo_relaxed); });
+            }
+            EXPECT(g.wait());
+            EXPECT_EQ(g.error(), 0);
+            EXPECT_EQ(n, 8);
+        }
+
+        // the first failure cancels the others
+        n = 0;
+        {
+            co::task_group g;
+            for (int i = 0; i < 4; ++i) {
+                g.go([&n]() {
+                    co::sleep(10000);
+                    if (co::cancelled()) atomic_inc(&n, mo_relaxed);
+                });
+            }
+            g.go([]() {
+                co::sleep(1);
+                co::error(EINVAL);
+                return false;
+            });
+            const int64 t = now::ms();
+            EXPECT_EQ(g.wait(), false);
+            EXPECT_LT(now::ms() - t, 5000);
+            EXPECT_EQ(g.error(), EINVAL);
+            EXPECT(g.cancelled());
+            EXPECT_EQ(n, 4);
+        }
+
+        // children waiting for an event are cancelled on timeout
+        n = 0;
+        {
+            co::event ev;
+            co::task_group g;
+            for (int i = 0; i < 4; ++i) {
+                g.go([ev, &n]() {
+                    if (!ev.wait(10000)) atomic_inc(&n, mo_relaxed);
+                    ev.wait(); // fails at once in a cancelled group
+                });
+            }
+            EXPECT_EQ(g.wait(20), false);
+            EXPECT_EQ(g.error(), ETIMEDOUT);
+            EXPECT_EQ(n, 4);
+        }
+
+        // the destructor cancels the children running
+        n = 0;
+        {
+            co::task_group g;
+            g.go([&n]() {
+                co::sleep(10000);
+                n = co::cancelled() ? 1 : 2;
+            });
+            co::sleep(1);
+        }
+        EXPECT_EQ(n, 1);
+
+        // a child blocked in accept() is cancelled
+        n = 0;
+        {
+            co::task_group g;
+            g.go([&n]() {
+                sock_t fd = co::tcp_socket();
+                struct sockaddr_in addr;
+                co::init_addr(&addr, "127.0.0.1", 0);
+                if (co::bind(fd, &addr, sizeof(addr)) == 0 && co::listen(fd) == 0) {
+                    if (co::accept(fd, 0, 0) == (sock_t)-1 && co::error() == ECANCELED) n = 1;
+                }
+                co::close(fd);
+            });
+            EXPECT_EQ(g.wait(20), false);
+        }
+        EXPECT_EQ(n, 1);
+
+        // children finish while requests to cancel them are still queued
+        n = 0;
+        for (int k = 0; k < 200; ++k) {
+            co::task_group g;
+            for (int i = 0; i < 16; ++i) {
+                g.go([i]() { return i != 0; });
+            }
+            if (!g.wait()) ++n;
+        }
+        EXPECT_EQ(n, 200);
+        n = 0;
+    }
+
+    DEF_case(future) {
+        {
+            co::promise<int> p;
+            auto f = p.get_future();
+            EXPECT(f.valid());
+            EXPECT_EQ(f.ready(), false);
+            EXPECT_EQ(f.wait(1), false);
+            go([p]() {
+                co::sleep(1);
+                p.set_value(7);
+            });
+            EXPECT_EQ(f.get(), 7);
+            EXPECT(f.has_value());
+            EXPECT_EQ(p.set_value(8), false);
+            EXPECT_EQ(f.get(), 7);
+        }
+
+        // the value is destroyed with the last reference
+        const int c = gc;
+        const int d = gd;
+        {
+            co::promise<TestChan> p;
+            auto f = p.get_future();
+            {
+                auto x = f;
+                p.set_value();
+                EXPECT_EQ(x.get().v, 0);
+            }
+            EXPECT_EQ(gc - c, 1);
+            EXPECT_EQ(gd - d, 0);
+        }
+        EXPECT_EQ(gd - d, 1);
+
+        // broken promise
+        {
+            auto f = []() {
+                co::promise<int> p;
+                return p.get_future();
+            }();
+            f.wait();
+            EXPECT(f.ready());
+            EXPECT_EQ(f.has_value(), false);
+        }
+
+        // when_all, when_any
+        {
+            co::vector<co::promise<int>> ps(8);
+            co::vector<co::future<int>> fs(8);
+            for (int i = 0; i < 8; ++i) {
+                ps.emplace_back();
+                fs.push_back(ps.back().get_future());
+            }
+            auto all = co::when_all(fs);
+            auto any = co::when_any(fs);
+            EXPECT_EQ(any.ready(), false);
+
+            ps[5].set_value(5);
+            EXPECT_EQ(any.get(), 5);
+            EXPECT_EQ(all.ready(), false);
+
+            co::wait_group wg(7);
+            for (int i = 0; i < 8; ++i) {
+                if (i == 5) continue;
+                auto p = ps[i];
+                go([p, i, wg]() { p.set_value(i); wg.done(); });
+            }
+            all.get();
+            int s = 0;
+            for (int i = 0; i < 8; ++i) s += fs[i].get();
+            EXPECT_EQ(s, 28);
+            wg.wait();
+        }
+        {
+            auto all = co::when_all((co::future<int>*)0, 0);
+            EXPECT(all.ready());
+            auto any = co::when_any((co::future<int>*)0, 0);
+            EXPECT(any.ready());
+            EXPECT_EQ(any.has_value(), false);
+        }
+    }
+
     DEF_case(queue) {
         queue q;
         EXPECT(q.empty());
@@ -327,9 +499,9 @@ DEF_test(co) {
     }
 
     DEF_case(CoroutinePool) {
-        CoroutinePool p;
+        CoroutinePool p(1);
         typedef Coroutine* pco;
-        pco a, b, c, d, e, f, o, x, y, z;
+        pco a, b, c, d, e, f, o, x, z;
         a = p.pop();
         b = p.pop();
         EXPECT_EQ(a->id, 0);
@@ -358,34 +530,95 @@ DEF_test(co) {
         EXPECT_EQ(e->id, 34);
         EXPECT_EQ(f->id, 33);
 
-        for (int i = 0; i < 29; ++i) ac.push_back(p.pop());
-        for (int i = 0; i < 64; ++i) ac.push_back(p.pop());
-        x = p.pop();
-        y = p.pop();
-        EXPECT_EQ(x->id, 128);
-        EXPECT_EQ(y->id, 129);
-
+        // the lowest block with free slots goes first
         p.push(b); // push 2
         z = p.pop();
         EXPECT_EQ(z->id, 2);
+
+        for (int i = 0; i < 29; ++i) ac.push_back(p.pop());
+        co::vector<Coroutine*> ac2;
+        for (int i = 0; i < 32; ++i) ac2.push_back(p.pop());
+        EXPECT_EQ(ac2[0]->id, 64);
+        x = p.pop();
+        EXPECT_EQ(x->id, 96);
+        EXPECT_EQ(p.blocks(), 4);
+
+        // one idle block is kept, and the others are freed
+        for (size_t i = 0; i < ac2.size(); ++i) p.push(ac2[i]);
+        EXPECT_EQ(p.blocks(), 4);
+        p.push(x);
+        EXPECT_EQ(p.blocks(), 3);
+
         o = p.pop();
-        EXPECT_EQ(o->id, 130);
+        EXPECT_EQ(o->id, 95);
+        EXPECT_EQ(&p[95], o);
+        p.push(o);
 
         p.push(d);
         p.push(e);
         p.push(f);
-        for (int i = 29; i < 58; ++i) {
-            p.push(ac[i]);
-        }
-
-        p.push(x);
-        p.push(y);
-        p.push(o);
+        for (int i = 29; i < 58; ++i) p.push(ac[i]);
+        EXPECT_EQ(p.blocks(), 2);
 
         o = p.pop();
         EXPECT_EQ(o->id, 32);
     }
 
+    DEF_case(coroutine_local) {
+        static co::coroutine_local<TestChan> x;
+        static co::coroutine_local<int> y;
+        co::wait_group wg(2);
+        int v[2] = { 0, 0 };
+        bool has[2] = { true, true };
+        const int c = gc;
+        const int d = gd;
+
+        for (int i = 0; i < 2; ++i) {
+            go([wg, i, &v, &has]() {
+                has[i] = x.has_value();
+                x->v = i + 1;
+                *y = i + 7;
+                co::sleep(1);
+                v[i] = x->v + *y;
+                wg.done();
+            });
+        }
+        wg.wait();
+        sleep::ms(10);
+        EXPECT_EQ(has[0], false);
+        EXPECT_EQ(has[1], false);
+        EXPECT_EQ(v[0], 8);
+        EXPECT_EQ(v[1], 10);
+        EXPECT_EQ(gc - c, 2);
+        EXPECT_EQ(gd - d, 2);
+
+        wg.add(1);
+        go([wg, &v]() {
+            x->v = 3;
+            x.reset();
+            v[0] = x.has_value() ? 1 : 0;
+            wg.done();
+        });
+        wg.wait();
+        EXPECT_EQ(v[0], 0);
+        EXPECT_EQ(gc - c, 3);
+        EXPECT_EQ(gd - d, 3);
+
+        // a destructor sets a value with a larger key, which grows the values
+        static co::coroutine_local<TestChan> z[32];
+        struct D { ~D() { z[31]->v = 1; } };
+        static co::coroutine_local<D> w;
+        wg.add(1);
+        go([wg]() {
+            (void) w.get();
+            wg.done();
+        });
+        wg.wait();
+        sleep::ms(10);
+        EXPECT_EQ(gc - c, 4);
+        EXPECT_EQ(gd - d, 4);
+    }
+
     DEF_case(mutex) {
         co::mutex m;
         co::wait_group wg;
@@ -429,6 +662,127 @@ DEF_test(co) {
         wg.wait();
         EXPECT_EQ(v, 16);
         v = 0;
+
+        // coroutines and threads contend for the lock
+        wg.add(12);
+        auto f = [wg, m, &v]() {
+            for (int k = 0; k < 2000; ++k) {
+                co::mutex_guard g(m);
+                ++v;
+            }
+            wg.done();
+        };
+        for (int i = 0; i < 8; ++i) go(f);
+        for (int i = 0; i < 4; ++i) std::thread(f).detach();
+        wg.wait();
+        EXPECT_EQ(v, 12 * 2000);
+        v = 0;
+    }
+
+    DEF_case(shared_mutex) {
+        co::shared_mutex m;
+        m.lock_shared();
+        m.lock_shared();
+        EXPECT_EQ(m.try_lock(), false);
+        m.unlock_shared();
+        m.unlock_shared();
+        EXPECT_EQ(m.try_lock(), true);
+        EXPECT_EQ(m.try_lock_shared(), false);
+        m.unlock();
+
+        // new readers wait if a writer is waiting
+        {
+            co::wait_group wg(1);
+            m.lock_shared();
+            go([wg, m]() {
+                {
+                    co::unique_guard g(m);
+                }
+                wg.done();
+            });
+            sleep::ms(20);
+            EXPECT_EQ(m.try_lock_shared(), false);
+            m.unlock_shared();
+            wg.wait();
+            EXPECT_EQ(m.try_lock_shared(), true);
+            m.unlock_shared();
+        }
+
+        // readers always see a == b
+        {
+            int a = 0, b = 0, bad = 0;
+            co::wait_group wg(20);
+            auto f = [wg, m, &a, &b, &bad](int i) {
+                for (int k = 0; k < 1000; ++k) {
+                    if (k % 10 == i % 10) {
+                        co::unique_guard g(m);
+                        ++a;
+                        if (k % 100 == 0) co::sleep(0);
+                        ++b;
+                    } else {
+                        co::shared_guard g(m);
+                        if (a != b) atomic_inc(&bad, mo_relaxed);
+                    }
+                }
+                wg.done();
+            };
+            for (int i = 0; i < 16; ++i) go(f, i);
+            for (int i = 16; i < 20; ++i) std::thread(f, i).detach();
+            wg.wait();
+            EXPECT_EQ(bad, 0);
+            EXPECT_EQ(a, 20 * 100);
+            EXPECT_EQ(b, 20 * 100);
+        }
+    }
+
+    DEF_case(semaphore) {
+        {
+            co::semaphore s(2);
+            EXPECT_EQ(s.try_acquire(), true);
+            EXPECT_EQ(s.try_acquire(), true);
+            EXPECT_EQ(s.try_acquire(), false);
+            s.release(2);
+            EXPECT_EQ(s.try_acquire(), true);
+            s.release();
+        }
+
+        // at most 3 holders at the same time
+        {
+            co::semaphore s(3);
+            co::wait_group wg(24);
+            int n = 0, max = 0;
+            auto f = [s, wg, &n, &max]() {
+                for (int k = 0; k < 20; ++k) {
+                    s.acquire();
+                    const int x = atomic_inc(&n);
+                    int y = atomic_load(&max);
+                    while (x > y && !atomic_bool_cas(&max, y, x)) y = atomic_load(&max);
+                    co::sleep(1);
+                    atomic_dec(&n);
+                    s.release();
+                }
+                wg.done();
+            };
+            for (int i = 0; i < 20; ++i) go(f);
+            for (int i = 0; i < 4; ++i) std::thread(f).detach();
+            wg.wait();
+            EXPECT_EQ(n, 0);
+            EXPECT_LE(max, 3);
+            EXPECT_GT(max, 0);
+        }
+
+        // waiters are woken up by release(n)
+        {
+            co::semaphore s;
+            co::wait_group wg(8);
+            for (int i = 0; i < 8; ++i) {
+                go([s, wg]() { s.acquire(); wg.done(); });
+            }
+            sleep::ms(10);
+            s.release(8);
+            wg.wait();
+            EXPECT_EQ(s.try_acquire(), false);
+        }
     }
 
     DEF_case(event) {
@@ -777,11 +1131,217 @@ DEF_test(co) {
             EXPECT_EQ(i, 6);
         }
 
+        // batch read and write
+        {
+            co::chan<int> ch(8);
+            co::wait_group wg(1);
+            int a[100], b[100];
+            for (int i = 0; i < 100; ++i) a[i] = i;
+            go([ch, wg, &a]() {
+                ch.write_n(a, 100);
+                wg.done();
+            });
+
+            size_t n = 0, m = 0;
+            while (n < 100) {
+                const size_t r = ch.read_n(b + n, 100 - n);
+                if (r == 0) break;
+                n += r;
+                ++m;
+            }
+            wg.wait();
+            EXPECT_EQ(n, 100);
+            EXPECT_LT(m, 100);
+            bool ok = true;
+            for (int i = 0; i < 100; ++i) ok = ok && b[i] == i;
+            EXPECT(ok);
+
+            EXPECT_EQ(ch.write_n(a, 5), 5);
+            EXPECT(ch.done());
+            ch.close();
+            EXPECT_EQ(ch.write_n(a, 5), 0);
+            EXPECT(!ch.done());
+            EXPECT_EQ(ch.read_n(b, 10), 5);
+            EXPECT(ch.done());
+            EXPECT_EQ(ch.read_n(b, 10), 0);
+            EXPECT(!ch.done());
+        }
+
+        {
+            const int c = gc;
+            const int d = gd;
+            {
+                co::chan<TestChan> ch(4, 10);
+                TestChan x[6], y[6];
+                for (int i = 0; i < 6; ++i) x[i].v = i + 1;
+                EXPECT_EQ(ch.move_n(x, 6), 4); // timeout
+                EXPECT(!ch.done());
+                EXPECT_EQ(ch.read_n(y, 6), 4);
+                EXPECT_EQ(y[3].v, 4);
+            }
+            EXPECT_EQ(gc - c, gd - d);
+        }
+
+        // a channel used by one scheduler switches to the mutex once a thread uses it
+        {
+            co::chan<int> ch(8);
+            co::wait_group wg(2);
+            int64 sum = 0;
+            auto s = co::next_sched();
+            s->go([ch, wg]() {
+                for (int i = 0; i < 10000; ++i) ch << i;
+                wg.done();
+            });
+            s->go([ch, wg, &sum]() {
+                int v = 0;
+                for (int i = 0; i < 20000; ++i) { ch >> v; sum += v; }
+                wg.done();
+            });
+            for (int i = 0; i < 10000; ++i) ch << i;
+            wg.wait();
+            EXPECT_EQ(sum, 9999LL * 10000);
+        }
+
         EXPECT_NE(gc, 0);
         EXPECT_NE(gd, 0);
         EXPECT_EQ(gc, gd);
     }
 
+    DEF_case(spsc_chan) {
+        {
+            co::spsc_chan<int> ch(16);
+            go([ch]() {
+                for (int i = 0; i < 100000; ++i) ch << i;
+                ch.close();
+            });
+
+            int64 sum = 0;
+            int v = 0, n = 0;
+            while (ch >> v, ch.done()) { sum += v; ++n; }
+            EXPECT_EQ(n, 100000);
+            EXPECT_EQ(sum, 99999LL * 100000 / 2);
+            EXPECT(!ch);
+            ch << 3;
+            EXPECT(!ch.done());
+        }
+
+        {
+            co::spsc_chan<int> ch(4, 10);
+            co::wait_group wg(1);
+            bool r[2] = { true, true };
+            go([ch, wg, &r]() {
+                int v = 0;
+                ch >> v;
+                r[0] = ch.done();
+                for (int i = 0; i < 4; ++i) ch << i;
+                ch << 4;
+                r[1] = ch.done();
+                wg.done();
+            });
+            wg.wait();
+            EXPECT_EQ(r[0], false);
+            EXPECT_EQ(r[1], false);
+        }
+
+        // elements not read are destroyed with the channel
+        {
+            const int c = gc;
+            const int d = gd;
+            {
+                co::spsc_chan<TestChan> ch(8);
+                co::wait_group wg(2);
+                go([&ch, wg]() {
+                    for (int i = 0; i < 1000; ++i) ch << TestChan(i);
+                    wg.done();
+                });
+                go([&ch, wg]() {
+                    {
+                        TestChan t;
+                        for (int i = 0; i < 995; ++i) ch >> t;
+                    }
+                    wg.done();
+                });
+                wg.wait();
+            }
+            EXPECT_EQ(gc - c, gd - d);
+        }
+    }
+
+    DEF_case(select) {
+        {
+            co::chan<int> a, b(4);
+            co::wait_group wg(1);
+            int r[6] = { 0 };
+            int x = 0, y = 0;
+            go([&]() {
+                b << 3;
+                r[0] = co::select({ co::read_case(a, x), co::read_case(b, y) });
+                r[1] = co::select({ co::read_case(a, x), co::read_case(b, y) }, 10);
+
+                go([a]() { co::sleep(1); a << 7; });
+                r[2] = co::select({ co::read_case(a, x), co::read_case(b, y) });
+
+                // b is full, and a is empty
+                for (int i = 0; i < 4; ++i) b << i;
+                r[3] = co::select({ co::write_case(b, 8), co::write_case(a, 9) });
+                a >> x;
+                r[4] = co::select({ co::write_case(b, 8) }, 0);
+
+                a.close();
+                r[5] = co::select({ co::read_case(a, x) });
+                r[5] += a.done() ? 10 : 0;
+                wg.done();
+            });
+            wg.wait();
+            EXPECT_EQ(r[0], 1);
+            EXPECT_EQ(y, 3);
+            EXPECT_EQ(r[1], -1);
+            EXPECT_EQ(r[2], 0);
+            EXPECT_EQ(r[3], 1);
+            EXPECT_EQ(x, 9);
+            EXPECT_EQ(r[4], -1);
+            EXPECT_EQ(r[5], 0);
+        }
+
+        // elements written to the channels are all read by select exactly once
+        {
+            const int c = gc;
+            const int d = gd;
+            co::chan<TestChan> a, b(2);
+            co::wait_group wg(3);
+            int n = 0, m = 0;
+            go([a, wg]() {
+                {
+                    TestChan t;
+                    for (int i = 0; i < 1000; ++i) a << t;
+                }
+                wg.done();
+            });
+            go([b, wg]() {
+                for (int i = 0; i < 1000; ++i) b << TestChan();
+                wg.done();
+            });
+            go([a, b, wg, &n, &m]() {
+                {
+                    TestChan t;
+                    int k = 0;
+                    while (n + m < 2000 && k < 100) {
+                        switch (co::select({ co::read_case(a, t), co::read_case(b, t) }, 100)) {
+                          case 0: ++n; break;
+                          case 1: ++m; break;
+                          default: ++k; break;
+                        }
+                    }
+                }
+                wg.done();
+            });
+            wg.wait();
+            EXPECT_EQ(n, 1000);
+            EXPECT_EQ(m, 1000);
+            EXPECT_EQ(gc - c, gd - d);
+        }
+    }
+
     DEF_case(pool) {
         co::pool p(
             []() { return (void*) co::make<int>(0); },
@@ -2,8 +2,28 @@
 #include "co/json.h"
 #include "co/str.h"
 
+#ifndef _WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
 namespace test {
 
+#ifndef _WIN32
+// run @f in a child process, return true if the child was killed by a signal
+template<typename F>
+static bool dies(F&& f) {
+    const pid_t pid = fork();
+    if (pid == 0) {
+        if (!freopen("/dev/null", "w", stderr)) _exit(1);
+        f();
+        _exit(0);
+    }
+    int st = 0;
+    return pid > 0 && waitpid(pid, &st, 0) == pid && WIFSIGNALED(st);
+}
+#endif
+
 DEF_test(json) {
     DEF_case(null) {
         co::Json n;
@@ -630,6 +650,65 @@ DEF_test(json) {
         EXPECT(json::parse("{ \"key\" : null88 }").is_null());
         EXPECT(json::parse("{ \"key\" : abcc }").is_null());
     }
+
+    DEF_case(parse_arena) {
+        co::arena a;
+        fastring s = "{\"a\":[1,2.5,\"x\\ty\",true,null,{}],\"b\":{\"c\":\"s\"}}";
+        co::Json v = json::parse(s, a);
+        EXPECT(v.is_object());
+        EXPECT_EQ(v.str(), s);
+        EXPECT_EQ(v.get("a", 2).as_string(), "x\ty");
+        EXPECT(v.get("b", "c") == "s");
+
+        // a copy does not use the arena
+        co::Json u = v.dup();
+        const size_t n = a.capacity();
+        v.reset();
+        EXPECT_EQ(u.str(), s);
+        u.add_member("d", 3);
+        EXPECT_EQ(u["d"].as_int(), 3);
+
+        // a node moved out of the document is not freed either
+        v = json::parse(s, a);
+        co::Json x = v["b"];
+        EXPECT(v["b"].is_null());
+        x.reset();
+
+        // the document is read-only
+        v = json::parse("{\"a\":1,\"b\":[1]}", a);
+        EXPECT_EQ(v["a"].as_int(), 1);
+        EXPECT(v.get("missing").is_null());
+        EXPECT_EQ(v.str(), "{\"a\":1,\"b\":[1]}");
+      #ifndef _WIN32
+        EXPECT(dies([&]() { v["missing"]; }));
+        EXPECT(dies([&]() { v.add_member("c", 2); }));
+        EXPECT(dies([&]() { v["b"].push_back(2); }));
+        EXPECT(dies([&]() { v.set("b", 0, 3); }));
+        EXPECT(dies([&]() { v.remove("a"); }));
+        EXPECT(dies([&]() { v["a"] = 2; }));
+        EXPECT(!dies([&]() { co::Json w = v.dup(); w["missing"] = 2; w.add_member("c", 2); }));
+
+        // so are its null members
+        co::Json t = json::parse("{\"k\":null,\"n\":[null]}", a);
+        EXPECT(t["k"].is_null());
+        EXPECT(t.get("n", 0).is_null());
+        EXPECT_EQ(t.str(), "{\"k\":null,\"n\":[null]}");
+        EXPECT(dies([&]() { t["k"] = 1; }));
+        EXPECT(dies([&]() { t["k"].push_back(1); }));
+        EXPECT(dies([&]() { t["k"].add_member("x", 1); }));
+        EXPECT(dies([&]() { t["n"][0] = 1; }));
+        EXPECT(dies([&]() { t.set("n", 0, 1); }));
+        EXPECT(t.dup().get("n", 0).is_null());
+      #endif
+        v = json::parse(s, a); // replaced by another document from the arena
+        EXPECT_EQ(v.str(), s);
+
+        EXPECT(json::parse("{\"a\": 1,", a).is_null());
+        EXPECT(!v.parse_from("[1, 2", a));
+        EXPECT(v.is_null());
+        EXPECT_GE(a.capacity(), n);
+        a.clear();
+    }
 }
 
 } // namespace test
@@ -1,5 +1,7 @@
 #include "co/unitest.h"
 #include "co/mem.h"
+#include <thread>
+#include <vector>
 
 #ifdef _WIN32
 #ifndef WIN32_LEAN_AND_MEAN
@@ -9,6 +11,8 @@
 #include <intrin.h>
 #endif
 
+DEC_uint32(co_mem_cache_mb);
+
 
 namespace test {
 namespace mem {
@@ -279,6 +283,177 @@ DEF_test(mem) {
         co::free(p, 256 * 1024);
     }
 
+    // free memory allocated by another thread
+    DEF_case(xfree) {
+        const int N = 600;
+        void* v[N];
+        auto size = [](int i) -> size_t { return i & 1 ? 32 : 8192; };
+        auto alloc = [&]() {
+            for (int i = 0; i < N; ++i) {
+                v[i] = co::alloc(size(i));
+                memset(v[i], 1, size(i));
+            }
+        };
+        auto free = [&]() {
+            for (int i = 0; i < N; ++i) co::free(v[i], size(i));
+        };
+
+        // frees buffered in a thread are flushed when it exits
+        alloc();
+        std::thread(free).join();
+        alloc();
+        bool ok = true;
+        for (int i = 0; i < N; ++i) ok = ok && v[i] != 0;
+        EXPECT(ok);
+        free();
+
+        std::thread(alloc).join();
+        free();
+        co::_flush_xfree();
+        co::_flush_xfree();
+        std::thread([&]() { alloc(); free(); }).join();
+    }
+
+    DEF_case(stats) {
+        const int N = 64;
+        const int c = 8; // size class of 3000 bytes: (2K, 4K]
+        void* v[N];
+        auto a = co::mem_stats();
+        for (int i = 0; i < N; ++i) v[i] = co::alloc(3000);
+        void* x = co::alloc(1 << 20);
+        auto b = co::mem_stats();
+        EXPECT_GE(b.objects[c], a.objects[c] + N);
+        EXPECT_GE(b.in_use, a.in_use + N * 3000);
+        EXPECT_EQ(b.span_allocs, a.span_allocs + 1);
+        EXPECT_GE(b.span_bytes, (uint64)(1 << 20));
+        EXPECT_GT(b.threads, 0);
+        EXPECT_GT(b.committed, 0);
+        EXPECT_GE(b.reserved, b.committed);
+
+        for (int i = 0; i < N; ++i) co::free(v[i], 3000);
+        co::free(x, 1 << 20);
+        auto d = co::mem_stats();
+        EXPECT_LE(d.objects[c] + N, b.objects[c]);
+        EXPECT_LE(d.in_use + N * 3000, b.in_use);
+
+        std::vector<co::mem_thread_stat> t(d.threads);
+        const size_t k = co::mem_thread_stats(t.data(), t.size());
+        EXPECT_GE(k, t.size());
+        uint64 allocs = 0;
+        for (auto& s : t) allocs += s.allocs;
+        EXPECT_GE(allocs, (uint64)N);
+    }
+
+    DEF_case(profile) {
+        auto total = []() {
+            co::mem_sample s[64];
+            const size_t k = co::mem_profile_samples(s, 64);
+            uint64 n = 0;
+            for (size_t i = 0; i < k && i < 64; ++i) n += s[i].bytes;
+            return n;
+        };
+
+        co::mem_profile(1);
+        void* p = co::alloc(100);
+        void* q = co::alloc(5000);
+        q = co::realloc(q, 5000, 9000);
+        co::mem_profile(0);
+
+        const uint64 n = total();
+        EXPECT_GE(n, 9100);
+        co::mem_sample s;
+        EXPECT_GE(co::mem_profile_samples(&s, 1), 1);
+      #if defined(__linux__) && defined(__GLIBC__)
+        EXPECT_GT(s.depth, 0);
+      #endif
+
+        co::free(p, 100);
+        co::free(q, 9000);
+        EXPECT_LE(total() + 9100, n);
+    }
+
+    DEF_case(span) {
+        const size_t K = 1024;
+        auto check = [](const char* p, size_t n, char c) {
+            for (size_t i = 0; i < n; i += 4096) if (p[i] != c) return false;
+            return p[n - 1] == c;
+        };
+
+        // freed spans are cached and reused
+        char* p = (char*) co::alloc(200 * K);
+        memset(p, 1, 200 * K);
+        co::free(p, 200 * K);
+        EXPECT_GE(co::mem_stats().span_cached, 200 * K);
+        char* q = (char*) co::alloc(210 * K);
+        EXPECT_EQ(p, q);
+
+        // grow in the same class, then across classes
+        EXPECT_EQ(co::try_realloc(q, 210 * K, 220 * K), (void*)q);
+        memset(q, 2, 220 * K);
+        q = (char*) co::realloc(q, 220 * K, 1024 * K);
+        EXPECT(check(q, 220 * K, 2));
+        memset(q, 3, 1024 * K);
+        q = (char*) co::realloc(q, 1024 * K, 8192 * K);
+        EXPECT(check(q, 1024 * K, 3));
+        co::free(q, 8192 * K);
+
+        // memory from the cache is zeroed by zalloc
+        p = (char*) co::alloc(300 * K);
+        memset(p, 4, 300 * K);
+        co::free(p, 300 * K);
+        q = (char*) co::zalloc(300 * K);
+        EXPECT(check(q, 300 * K, 0));
+        co::free(q, 300 * K);
+
+        // small memory grows into a span
+        p = (char*) co::alloc(100 * K);
+        memset(p, 5, 100 * K);
+        p = (char*) co::realloc(p, 100 * K, 500 * K);
+        EXPECT(check(p, 100 * K, 5));
+        co::free(p, 500 * K);
+
+        co::mem_trim();
+        EXPECT_EQ(co::mem_stats().span_cached, 0);
+
+        // spans cached in the thread count in co_mem_cache_mb
+        const uint32 mb = FLG_co_mem_cache_mb;
+        FLG_co_mem_cache_mb = 1;
+        void* a[4];
+        for (int i = 0; i < 4; ++i) a[i] = co::alloc(512 * K);
+        for (int i = 0; i < 4; ++i) co::free(a[i], 512 * K);
+        EXPECT_LE(co::mem_stats().span_cached, 1024 * K);
+        co::mem_trim();
+        FLG_co_mem_cache_mb = mb;
+    }
+
+    DEF_case(trim) {
+        std::thread([&]() {
+            const int N = 4096;
+            std::vector<void*> v(N);
+            auto size = [](int i) -> size_t { return i & 1 ? 1000 : 64 * 1024; };
+            auto alloc = [&]() {
+                for (int i = 0; i < N; ++i) {
+                    v[i] = co::alloc(size(i));
+                    memset(v[i], 1, size(i));
+                }
+            };
+
+            alloc();
+            void* x = co::alloc(100);
+            for (int i = 0; i < N; ++i) co::free(v[i], size(i));
+            EXPECT_GT(co::mem_trim(), 0);
+
+            // the memory is reused after trimming
+            alloc();
+            bool ok = true;
+            for (int i = 0; i < N; ++i) ok = ok && v[i] != 0;
+            EXPECT(ok);
+            for (int i = 0; i < N; ++i) co::free(v[i], size(i));
+            co::free(x, 100);
+            co::mem_trim();
+        }).join();
+    }
+
     DEF_case(static) {
         int* x = co::make_static<int>(7);
         EXPECT_NE(x, (void*)0);
@@ -387,6 +562,59 @@ DEF_test(mem) {
         EXPECT_EQ(a.ref_count(), 0);
         EXPECT_EQ(gd, 2);
     }
+
+    DEF_case(arena) {
+        co::arena a(1024);
+        EXPECT_EQ(a.capacity(), 0);
+
+        char* p = (char*) a.alloc(10);
+        char* q = (char*) a.alloc(10);
+        EXPECT_EQ(q, p + 16);
+        EXPECT_EQ(a.capacity(), 1024);
+
+        void* x = a.alloc(24, 64);
+        EXPECT_EQ((size_t)x & 63, 0);
+
+        // a large allocation gets a block of its own
+        char* l = (char*) a.alloc(4096);
+        memset(l, 1, 4096);
+        EXPECT_EQ(a.alloc(8), (void*)((char*)x + 24));
+
+        // blocks grow, and the last one is kept by clear()
+        for (int i = 0; i < 200; ++i) a.alloc(100);
+        const size_t n = a.capacity();
+        EXPECT_GT(n, 4096 + 1024 * 3);
+
+        a.clear();
+        EXPECT_LT(a.capacity(), n);
+        EXPECT_GE(a.capacity(), 1024 * 8);
+        EXPECT_NE(a.alloc(8), (void*)0);
+
+        std::vector<int, co::arena_allocator<int>> v(a);
+        for (int i = 0; i < 1000; ++i) v.push_back(i);
+        EXPECT_EQ(v.size(), 1000);
+        EXPECT_EQ(v[999], 999);
+
+        co::arena b;
+        std::vector<int, co::arena_allocator<int>> u(b);
+        EXPECT(u.get_allocator() != v.get_allocator());
+        EXPECT(co::arena_allocator<char>(a) == v.get_allocator());
+
+        // an odd-sized first block never lets the pointer pass its end
+        co::arena c;
+        char* y = (char*) c.alloc(5001, 64);
+        char* z = (char*) c.alloc(1, 16);
+        char* w = (char*) c.alloc(8);
+        EXPECT_EQ((size_t)z & 15, 0);
+        EXPECT(z >= y + 5001 && w >= z + 1);
+        const size_t cap = c.capacity();
+        for (int i = 0; i < 1024; ++i) c.alloc(8);
+        EXPECT_GE(c.capacity(), cap + 8192);
+        EXPECT_NE(co::arena().alloc(0), (void*)0);
+        co::arena d(1001);
+        for (int i = 0; i < 300; ++i) d.alloc(3);
+        EXPECT_EQ((size_t)d.alloc(1) & 7, 0);
+    }
 }
 
 } // namespace test